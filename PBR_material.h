@@ -5,6 +5,8 @@
 #include <filesystem>
 
 #include "texture_loader.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
 
 
 const int EXTENSION_COUNT = 2;
@@ -13,34 +15,115 @@ const int EXTENSION_COUNT = 2;
 class PBRMaterial 
 {
 public:
-    unsigned int albedoTexture;
-    unsigned int normalTexture;
-    unsigned int metallicTexture;
-    unsigned int roughnessTexture;
-    unsigned int aoTexture;
+    // shared with every other material and model using the same images
+    CachedTexture albedoTexture;
+    CachedTexture normalTexture;
+    CachedTexture ormTexture; // R = ao, G = roughness, B = metallic
 
     PBRMaterial(const std::string pathToMaterial) 
     {
+        TRACE_SCOPE_DETAIL("PBRMaterial", pathToMaterial.c_str());
+
         albedoTexture = LoadTextureWithAnyExtension(pathToMaterial, "albedo");
         normalTexture = LoadTextureWithAnyExtension(pathToMaterial, "normal");
-        metallicTexture = LoadTextureWithAnyExtension(pathToMaterial, "metallic");
-        roughnessTexture = LoadTextureWithAnyExtension(pathToMaterial, "roughness");
-        aoTexture = LoadTextureWithAnyExtension(pathToMaterial, "ao");
+        ormTexture = LoadPackedORM(pathToMaterial);
     }
 
-private:
-    unsigned int LoadTextureWithAnyExtension(const std::string& folder, const std::string& name) 
+    // empty string if there is no such map
+    static std::string FindTextureWithAnyExtension(const std::string& folder, const std::string& name)
     {
         constexpr const char* extensions[EXTENSION_COUNT] = {".png", ".tga"};
 
         for (int i = 0; i < EXTENSION_COUNT; i++) {
             std::filesystem::path file = folder + "/" + name + extensions[i];
             if (std::filesystem::exists(file)) {
-                return TextureFromFile(file.string().c_str());
+                return file.string();
             }
         }
 
-        return 0;
+        return std::string();
+    }
+
+    // ao, roughness and metallic of a folder packed into one RGB image, free with FreeImageData
+    static ImageData LoadORMImage(const std::string& folder)
+    {
+        ImageData maps[3]; // ao, roughness, metallic
+        const char* names[3] = {"ao", "roughness", "metallic"};
+        for (int i = 0; i < 3; i++)
+        {
+            const std::string file = FindTextureWithAnyExtension(folder, names[i]);
+            if (!file.empty())
+                maps[i] = LoadImageData(file.c_str());
+        }
+
+        ImageData packed = PackORMImage(maps[0], maps[1], maps[2]);
+        for (ImageData& map : maps)
+            FreeImageData(map);
+
+        return packed;
+    }
+
+private:
+    CachedTexture LoadTextureWithAnyExtension(const std::string& folder, const std::string& name) 
+    {
+        const std::string file = FindTextureWithAnyExtension(folder, name);
+        return file.empty() ? CachedTexture() : Textures.load(file, RGB);
+    }
+
+    // The three single channel maps go into one RGB texture
+    CachedTexture LoadPackedORM(const std::string& folder)
+    {
+        // cached under a path of its own, other materials with the same maps hit the content hash
+        const std::string packedPath = folder + "/orm.packed";
+        CachedTexture cached = Textures.find(packedPath, RGB);
+        if (cached)
+            return cached;
+
+        ImageData packed = LoadORMImage(folder);
+        cached = Textures.fromImage(packedPath, packed, RGB);
+        FreeImageData(packed);
+
+        return cached;
+    }
+};
+
+// The same maps streamed by a TextureStreamer, nothing is decoded on the calling thread
+class StreamedPBRMaterial
+{
+public:
+    StreamedTextureHandle albedoTexture;
+    StreamedTextureHandle normalTexture;
+    StreamedTextureHandle ormTexture;
+
+    StreamedPBRMaterial(TextureStreamer& streamer, const std::string& pathToMaterial)
+    {
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        const unsigned char flatNormal[4] = { 128, 128, 255, 255 };
+        const unsigned char defaultORM[4] = { 255, 255, 0, 255 };
+
+        albedoTexture = streamer.add(PBRMaterial::FindTextureWithAnyExtension(pathToMaterial, "albedo"), RGB, white);
+        normalTexture = streamer.add(PBRMaterial::FindTextureWithAnyExtension(pathToMaterial, "normal"), RGB, flatNormal);
+        ormTexture = streamer.add(pathToMaterial + "/orm.packed",
+                                  [pathToMaterial]() { return PBRMaterial::LoadORMImage(pathToMaterial); },
+                                  RGB, defaultORM);
+    }
+
+    // pixels covered by the object the material is on
+    void request(TextureStreamer& streamer, float pixels) const
+    {
+        streamer.request(albedoTexture, pixels);
+        streamer.request(normalTexture, pixels);
+        streamer.request(ormTexture, pixels);
+    }
+
+    void bind(const TextureStreamer& streamer, unsigned int firstUnit = 0) const
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_2D, streamer.getTexture(albedoTexture));
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_2D, streamer.getTexture(normalTexture));
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_2D, streamer.getTexture(ormTexture));
     }
 };
 
@@ -5,6 +5,9 @@
 #ifndef PBR_SETUP_H
 #define PBR_SETUP_H
 
+#include <string>
+#include <filesystem>
+
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
@@ -13,134 +16,97 @@
 #include "shader.h"
 #include "texture_loader.h"
 #include "render_shapes.h"
+#include "spherical_harmonics.h"
+#include "gl_resources.h"
 
 
-struct PBRsetup {
-    unsigned int gBuffer;
-    unsigned int gPositionMetallic;
-    unsigned int gNormalRoughness;
-    unsigned int gAlbedoAo;
-    unsigned int brdfLUTTexture;
-};
-
 struct IBLmaps {
-    unsigned int irradianceMap;
-    unsigned int prefilterMap;
+    GLTexture irradianceMap;
+    GLTexture prefilterMap;
 };
 
 struct IBLmaps_env {
-    unsigned int irradianceMap;
-    unsigned int prefilterMap;
-    unsigned int envCubemap;
+    GLBuffer irradianceSH; // SHIrradiance uniform block
+    GLTexture prefilterMap;
+    GLTexture envCubemap;
 };
 
-static unsigned int captureFBO = 0;
-static unsigned int captureRBO = 0;
+// Shared by all the offscreen captures, free with PBR_releaseCaptureBuffers when done
+static GLFramebuffer captureFBO;
+static GLRenderbuffer captureRBO;
+
+void PBR_releaseCaptureBuffers()
+{
+    captureFBO.reset();
+    captureRBO.reset();
+}
 
 // PBR framebuffers and textures
 // -----------------------------
 
-// 3x4f means three buffers with 4 floats for deferred shading
-PBRsetup PBR_deferredFramebuffersSetup3x4f(const float width, const float height)
+// BRDF lookup texture, loaded from bakedBRDFLUT (KTX from tools/ibl_baker)
+// when it exists, rendered otherwise
+GLTexture PBR_brdfLUTSetup(const char *bakedBRDFLUT = nullptr)
 {
-    // Load shader porgrams
-    // --------------------
-    Shader brdfShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/cubemap/cubemap_brdfconv.glsl");
-    
-    // Set up framebuffers
-    // -------------------
-
-    // geometry pass framebuffer
-    unsigned int gBuffer;
-    glGenFramebuffers(1, &gBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-    unsigned int gPositionMetallic, gNormalRoughness, gAlbedoAo;
-    
-    // - position + metallic color buffer
-    glGenTextures(1, &gPositionMetallic);
-    glBindTexture(GL_TEXTURE_2D, gPositionMetallic);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPositionMetallic, 0);
-    
-    // - normal + roughness color buffer
-    glGenTextures(1, &gNormalRoughness);
-    glBindTexture(GL_TEXTURE_2D, gNormalRoughness);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormalRoughness, 0);
-    
-    // - color + ao color buffer
-    glGenTextures(1, &gAlbedoAo);
-    glBindTexture(GL_TEXTURE_2D, gAlbedoAo);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gAlbedoAo, 0);
-    
-    // - tell OpenGL which color attachments we'll use (of this framebuffer) for rendering 
-    unsigned int attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, attachments);
-
-    unsigned int gDepth;
-    glGenRenderbuffers(1, &gDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, gDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gDepth);
-
-    // BRDF lookup texture
-    unsigned int brdfLUTTexture;
-    glGenTextures(1, &brdfLUTTexture);
-
-    // pre-allocate enough memory for the LUT texture.
-    glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // Generate BRDF lookup texture
-    if (!captureFBO)
-    {
-        glGenFramebuffers(1, &captureFBO);
-        glGenRenderbuffers(1, &captureRBO);
-    }
+    TRACE_GPU_SCOPE("PBR_brdfLUTSetup");
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
+    GLTexture brdfLUTTexture;
+    if (bakedBRDFLUT && std::filesystem::exists(bakedBRDFLUT))
+        brdfLUTTexture = GLTexture(loadKTXTexture(bakedBRDFLUT, GPUMemory_Environment));
 
-    glViewport(0, 0, 512, 512);
-    brdfShader.use();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    renderQuad();
+    if (!brdfLUTTexture)
+    {
+        brdfLUTTexture = GLTexture::create();
+
+        // pre-allocate enough memory for the LUT texture.
+        glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
+        GPUMemoryTrackTexture(brdfLUTTexture, GPUMemory_Environment, GL_RG16F, 512, 512);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // Generate BRDF lookup texture
+        if (!captureFBO)
+        {
+            captureFBO = GLFramebuffer::create();
+            captureRBO = GLRenderbuffer::create();
+            captureRBO.track(GPUMemory_RenderTargets, GPUTextureBytes(GL_DEPTH_COMPONENT24, 512, 512));
+        }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
 
-    brdfShader.deleteProgram();
+        Shader brdfShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/cubemap/cubemap_brdfconv.glsl");
+        glViewport(0, 0, 512, 512);
+        brdfShader.use();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderQuad();
+    }
 
-    return {gBuffer, gPositionMetallic, gNormalRoughness, gAlbedoAo, brdfLUTTexture};
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return brdfLUTTexture;
 }
 
 // Generares IBL cubemaps for a probe
 IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirectangularShader,
                             Shader &irradianceShader, Shader &prefilterShader)
 {
+    TRACE_GPU_SCOPE("generateIBLCubemaps");
+
     // Load the texture
     // ----------------
-    const unsigned int hdrTexture = loadHdrTexture(environmentTexturePath);
+    const GLTexture hdrTexture(loadHdrTexture(environmentTexturePath));
 
     // Cubemap framebuffer
     if (!captureFBO)
     {
-        glGenFramebuffers(1, &captureFBO);
-        glGenRenderbuffers(1, &captureRBO);
+        captureFBO = GLFramebuffer::create();
+        captureRBO = GLRenderbuffer::create();
+        captureRBO.track(GPUMemory_RenderTargets, GPUTextureBytes(GL_DEPTH_COMPONENT24, 512, 512));
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
@@ -149,14 +115,14 @@ IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirect
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
 
     // - create a cubemap to render to
-    unsigned int envCubemap;
-    glGenTextures(1, &envCubemap);
+    GLTexture envCubemap = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
     for (unsigned int i = 0; i < 6; ++i)
     {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 
                     512, 512, 0, GL_RGB, GL_FLOAT, nullptr);
     }
+    GPUMemoryTrackTexture(envCubemap, GPUMemory_Environment, GL_RGB16F, 512, 512, 6, true);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -164,14 +130,14 @@ IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirect
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Irradiance cubemap - convoluting the envCubemap (diffuse irradiance)
-    unsigned int irradianceMap;
-    glGenTextures(1, &irradianceMap);
+    GLTexture irradianceMap = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
     for (unsigned int i = 0; i < 6; ++i)
     {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, 
                     GL_RGB, GL_FLOAT, nullptr);
     }
+    GPUMemoryTrackTexture(irradianceMap, GPUMemory_Environment, GL_RGB16F, 32, 32, 6);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -179,13 +145,13 @@ IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirect
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // Prefiltered environment cubemap (specular IBL)
-    unsigned int prefilterMap;
-    glGenTextures(1, &prefilterMap);
+    GLTexture prefilterMap = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
     for (unsigned int i = 0; i < 6; ++i)
     {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
     }
+    GPUMemoryTrackTexture(prefilterMap, GPUMemory_Environment, GL_RGB16F, 128, 128, 6, true);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -254,6 +220,7 @@ IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirect
     // Prefilter the cubemap to use for specular IBL
     prefilterShader.use();
     prefilterShader.setInt("environmentMap", 0);
+    prefilterShader.setFloat("environmentResolution", 512.0f);
     prefilterShader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
@@ -282,26 +249,26 @@ IBLmaps generateIBLCubemaps(const char *environmentTexturePath, Shader &equirect
         }
     }
 
-    // Cleanup openGL objects no longer of use
-    deleteTexture(hdrTexture);
-    deleteTexture(envCubemap);
-
-    return {irradianceMap, prefilterMap};
+    // hdrTexture and envCubemap are no longer of use and get deleted here
+    return {std::move(irradianceMap), std::move(prefilterMap)};
 }
 
 // Generares IBL cubemaps for a probe, also returns the environment cubemap
 IBLmaps_env generateIBLCubemaps_env(const char *environmentTexturePath, Shader &equirectangularShader,
-                                    Shader &irradianceShader, Shader &prefilterShader)
+                                    Shader &prefilterShader)
 {
+    TRACE_GPU_SCOPE("generateIBLCubemaps_env");
+
     // Load the texture
     // ----------------
-    const unsigned int hdrTexture = loadHdrTexture(environmentTexturePath);
+    const GLTexture hdrTexture(loadHdrTexture(environmentTexturePath));
 
     // Cubemap framebuffer
     if (!captureFBO)
     {
-        glGenFramebuffers(1, &captureFBO);
-        glGenRenderbuffers(1, &captureRBO);
+        captureFBO = GLFramebuffer::create();
+        captureRBO = GLRenderbuffer::create();
+        captureRBO.track(GPUMemory_RenderTargets, GPUTextureBytes(GL_DEPTH_COMPONENT24, 512, 512));
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
@@ -310,43 +277,28 @@ IBLmaps_env generateIBLCubemaps_env(const char *environmentTexturePath, Shader &
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
 
     // - create a cubemap to render to
-    unsigned int envCubemap;
-    glGenTextures(1, &envCubemap);
+    GLTexture envCubemap = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
     for (unsigned int i = 0; i < 6; ++i)
     {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 
                     512, 512, 0, GL_RGB, GL_FLOAT, nullptr);
     }
+    GPUMemoryTrackTexture(envCubemap, GPUMemory_Environment, GL_RGB16F, 512, 512, 6, true);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Irradiance cubemap - convoluting the envCubemap (diffuse irradiance)
-    unsigned int irradianceMap;
-    glGenTextures(1, &irradianceMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, 
-                    GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     // Prefiltered environment cubemap (specular IBL)
-    unsigned int prefilterMap;
-    glGenTextures(1, &prefilterMap);
+    GLTexture prefilterMap = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
     for (unsigned int i = 0; i < 6; ++i)
     {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
     }
+    GPUMemoryTrackTexture(prefilterMap, GPUMemory_Environment, GL_RGB16F, 128, 128, 6, true);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -389,32 +341,14 @@ IBLmaps_env generateIBLCubemaps_env(const char *environmentTexturePath, Shader &
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-    // Convolute the cubemap to use for diffuse irradiance
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
-
-    irradianceShader.use();
-    irradianceShader.setInt("environmentMap", 0);
-    irradianceShader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-
-    glViewport(0, 0, 32, 32);
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradianceShader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
-                            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        renderCube();
-    }
+    // Diffuse irradiance as spherical harmonics, projected on the CPU from the 128px mip
+    const int irradianceLevel = CubemapLevelAtMost(envCubemap, SH_PROJECTION_SIZE);
+    GLBuffer irradianceSH = CreateSH9UniformBuffer(ComputeCubemapIrradianceSH9(envCubemap, irradianceLevel));
 
     // Prefilter the cubemap to use for specular IBL
     prefilterShader.use();
     prefilterShader.setInt("environmentMap", 0);
+    prefilterShader.setFloat("environmentResolution", 512.0f);
     prefilterShader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
@@ -443,10 +377,31 @@ IBLmaps_env generateIBLCubemaps_env(const char *environmentTexturePath, Shader &
         }
     }
 
-    // Cleanup openGL objects no longer of use
-    deleteTexture(hdrTexture);
+    // hdrTexture is no longer of use and gets deleted here
+    return {std::move(irradianceSH), std::move(prefilterMap), std::move(envCubemap)};
+}
+
+// Loads an environment baked by tools/ibl_baker (environment.ktx, prefiltered.ktx),
+// envCubemap is 0 when the folder doesn't have them
+IBLmaps_env loadIBLCubemaps_env(const std::string &folder)
+{
+    TRACE_GPU_SCOPE("loadIBLCubemaps_env");
+
+    const std::string environmentPath = folder + "/environment.ktx";
+    const std::string prefilteredPath = folder + "/prefiltered.ktx";
+    if (!std::filesystem::exists(environmentPath) || !std::filesystem::exists(prefilteredPath))
+        return {};
+
+    GLTexture envCubemap(loadKTXTexture(environmentPath.c_str(), GPUMemory_Environment));
+    GLTexture prefilterMap(loadKTXTexture(prefilteredPath.c_str(), GPUMemory_Environment));
+    if (!envCubemap || !prefilterMap)
+        return {};
+
+    // same as the generated path, whatever face size the environment was baked at
+    const int irradianceLevel = CubemapLevelAtMost(envCubemap, SH_PROJECTION_SIZE);
+    GLBuffer irradianceSH = CreateSH9UniformBuffer(ComputeCubemapIrradianceSH9(envCubemap, irradianceLevel));
 
-    return {irradianceMap, prefilterMap, envCubemap};
+    return {std::move(irradianceSH), std::move(prefilterMap), std::move(envCubemap)};
 }
 
 #endif
@@ -0,0 +1,175 @@
+// Dual filter bloom over a mip chain of the HDR scene, as render graph passes
+//
+// The lighting pass and the skybox render into an HDR transient instead of
+// the window. The "Bloom" pass reduces it to a chain of `levels` half size
+// transients: the first step keeps only what is brighter than the threshold
+// (soft knee, Karis averaged against fireflies), every step uses a 13 tap
+// filter. The chain is then walked back up, each level adding a 3x3 tent
+// upsample of the one below. Each level costs a quarter of the one above, so
+// the whole chain costs about a third of one half resolution pass whatever
+// the bloom radius. The composite pass adds the bloom to the scene and
+// tonemaps it into the window.
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "render_graph.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const int BLOOM_MAX_LEVELS = 8;
+
+class Bloom
+{
+public:
+    Bloom()
+        : downsampleShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/lighting/bloom_downsample.glsl"),
+          upsampleShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/lighting/bloom_upsample.glsl"),
+          compositeShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/lighting/bloom_composite.glsl")
+    {
+    }
+
+    void init(int levelCount = 6)
+    {
+        levels = std::clamp(levelCount, 1, BLOOM_MAX_LEVELS);
+
+        downsampleShader.use();
+        downsampleShader.setInt("source", 0);
+        upsampleShader.use();
+        upsampleShader.setInt("source", 0);
+        compositeShader.use();
+        compositeShader.setInt("scene", 0);
+        compositeShader.setInt("bloom", 1);
+    }
+
+    // More levels = wider bloom, each one adds a quarter of the previous cost
+    void setLevels(int levelCount)
+    {
+        levels = std::clamp(levelCount, 1, BLOOM_MAX_LEVELS);
+    }
+
+    // threshold: scene luminance where bloom starts, knee: width of the soft transition,
+    // intensity: amount of bloom added back, radius: tent size in texels of each level
+    void setParameters(float bloomThreshold, float bloomKnee, float bloomIntensity, float bloomRadius = 1.0f)
+    {
+        threshold = std::max(bloomThreshold, 0.0f);
+        knee = std::max(bloomKnee, 1e-4f);
+        intensity = std::max(bloomIntensity, 0.0f);
+        radius = std::max(bloomRadius, 0.0f);
+    }
+
+    // Adds the pass building the bloom of scene (width x height), returns the
+    // half resolution bloom before the intensity
+    RGTexture addPass(RenderGraph& graph, RGTexture scene, int width, int height)
+    {
+        chain.clear();
+        graph.addPass("Bloom", [&](RGPassBuilder& builder)
+        {
+            builder.read(scene);
+
+            // half size per level, stops early when a level would drop below 2 pixels
+            int levelWidth = width, levelHeight = height;
+            for (int i = 0; i < levels; i++)
+            {
+                levelWidth /= 2;
+                levelHeight /= 2;
+                if (levelWidth < 2 || levelHeight < 2)
+                    break;
+
+                // no alpha, bloom only carries color
+                chain.push_back(builder.create("Bloom level", { levelWidth, levelHeight, GL_R11F_G11F_B10F, GL_LINEAR }));
+            }
+        },
+        [this, scene](const RGResources& resources)
+        {
+            render(resources, scene);
+        });
+
+        return chain.empty() ? RG_NONE : chain[0];
+    }
+
+    // Adds the pass writing scene + bloom, tonemapped, into the window
+    void addCompositePass(RenderGraph& graph, RGTexture scene, RGTexture bloom, int width, int height)
+    {
+        graph.addPass("Bloom composite", [&](RGPassBuilder& builder)
+        {
+            builder.read(scene);
+            builder.read(bloom);
+            builder.windowOutput(width, height);
+        },
+        [this, scene, bloom](const RGResources& resources)
+        {
+            glDisable(GL_DEPTH_TEST);
+
+            compositeShader.use();
+            // every level adds a full copy of the bright parts
+            compositeShader.setFloat("intensity", chain.empty() ? 0.0f : intensity / chain.size());
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(scene));
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(bloom));
+            renderQuad();
+        });
+    }
+
+private:
+    Shader downsampleShader;
+    Shader upsampleShader;
+    Shader compositeShader;
+
+    std::vector<RGTexture> chain;   // this frame's levels
+    int levels = 6;
+
+    float threshold = 1.0f;
+    float knee = 0.5f;
+    float intensity = 0.3f;
+    float radius = 1.0f;
+
+    void render(const RGResources& resources, RGTexture scene)
+    {
+        glDisable(GL_DEPTH_TEST);
+        glActiveTexture(GL_TEXTURE0);
+
+        // down: each level is a 13 tap reduction of the previous one
+        downsampleShader.use();
+        downsampleShader.setVec4("curve", glm::vec4(threshold, threshold - knee, 2.0f * knee, 0.25f / knee));
+        RGTexture source = scene;
+        for (int i = 0; i < (int)chain.size(); i++)
+        {
+            resources.bindFramebuffer({ chain[i] });
+            downsampleShader.setBool("firstLevel", i == 0);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(source));
+            renderQuad();
+            source = chain[i];
+        }
+
+        // up: each level adds the tent filtered level below it. Leaves the
+        // renderer's alpha blend function behind, the overlays rely on it
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glBlendEquation(GL_FUNC_ADD);
+        upsampleShader.use();
+        upsampleShader.setFloat("radius", radius);
+        for (int i = (int)chain.size() - 1; i > 0; i--)
+        {
+            resources.bindFramebuffer({ chain[i - 1] });
+            glBindTexture(GL_TEXTURE_2D, resources.texture(chain[i]));
+            renderQuad();
+        }
+        glDisable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+};
+
+#endif
@@ -0,0 +1,300 @@
+// Cascaded shadow maps for one directional light
+//
+// The view frustum up to `shadowDistance` is split into 2-4 slices with the
+// practical split scheme (a blend of logarithmic and uniform splits). Every
+// slice gets an orthographic light projection around its bounding sphere,
+// rendered into one layer of a depth GL_TEXTURE_2D_ARRAY. The sphere keeps
+// the projection size constant while the camera turns, and its center is
+// snapped to whole shadow texels, so the shadows don't shimmer when the camera moves.
+// The lighting pass doesn't sample the array itself: renderMask() resolves
+// the shadow of every visible pixel into a screen space mask with a few
+// rotated hardware PCF taps, and a temporal history accumulates the taps of
+// successive frames into a soft, stable shadow.
+
+#ifndef CASCADED_SHADOWS_H
+#define CASCADED_SHADOWS_H
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "temporal_accumulation.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const int CSM_MAX_CASCADES = 4;             // keep in sync with the lighting shader
+const float CSM_SPLIT_LAMBDA = 0.75f;       // 0 uniform, 1 logarithmic
+const float CSM_CASTER_EXTENSION = 20.0f;   // how far behind a slice casters are still rendered
+
+class CascadedShadowMap
+{
+public:
+    void init(int mapResolution = 2048, int cascades = CSM_MAX_CASCADES)
+    {
+        resolution = mapResolution;
+        cascadeCount = std::clamp(cascades, 2, CSM_MAX_CASCADES);
+
+        depthArray = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, cascadeCount, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // depth compare + linear filtering = 2x2 PCF per fetch
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        const float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        GPUMemoryTrackTexture(depthArray, GPUMemory_RenderTargets, GL_DEPTH_COMPONENT24, resolution, resolution, cascadeCount);
+
+        framebuffer = GLFramebuffer::create();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::CASCADED_SHADOWS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Fits the cascades to the camera, once per frame before rendering them.
+    // lightDirection points from the light into the scene
+    void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float shadowDistance,
+                const glm::vec3& lightDirection)
+    {
+        TRACE_SCOPE("CascadedShadowMap::update");
+
+        // practical split scheme
+        splits[0] = nearPlane;
+        for (int i = 1; i <= cascadeCount; i++)
+        {
+            const float t = (float)i / cascadeCount;
+            const float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, t);
+            const float uniformSplit = nearPlane + (shadowDistance - nearPlane) * t;
+            splits[i] = CSM_SPLIT_LAMBDA * logSplit + (1.0f - CSM_SPLIT_LAMBDA) * uniformSplit;
+        }
+
+        // a fixed rotation, only the translation follows the camera
+        const glm::vec3 direction = glm::normalize(lightDirection);
+        const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+        const glm::mat4 inverseView = glm::inverse(view);
+        const float tanY = std::tan(fovY * 0.5f);
+        const float tanX = tanY * aspect;
+
+        for (int i = 0; i < cascadeCount; i++)
+        {
+            // slice corners in world space
+            glm::vec3 corners[8];
+            for (int c = 0; c < 8; c++)
+            {
+                const float depth = (c & 4) ? splits[i + 1] : splits[i];
+                const float x = ((c & 1) ? 1.0f : -1.0f) * tanX * depth;
+                const float y = ((c & 2) ? 1.0f : -1.0f) * tanY * depth;
+                corners[c] = glm::vec3(inverseView * glm::vec4(x, y, -depth, 1.0f));
+            }
+
+            glm::vec3 center(0.0f);
+            for (const glm::vec3& corner : corners)
+                center += corner;
+            center /= 8.0f;
+
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f; // no size jitter from float noise
+
+            // snap the center to the texel grid of the cascade
+            const float texel = 2.0f * radius / resolution;
+            glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+            lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+            lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+            Cascade& cascade = cascades[i];
+            cascade.center = lightCenter;
+            cascade.radius = radius;
+            cascade.texelSize = texel;
+            cascade.projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+                                            lightCenter.y - radius, lightCenter.y + radius,
+                                            -lightCenter.z - radius - CSM_CASTER_EXTENSION, -lightCenter.z + radius);
+            cascade.viewProjection = cascade.projection * lightView;
+        }
+    }
+
+    // Binds the cascade's layer for rendering casters with a depth only shader,
+    // its lightSpaceMatrix is set here
+    void beginCascade(int cascade, Shader& depthShader)
+    {
+        if (cascade == 0)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glViewport(0, 0, resolution, resolution);
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_DEPTH_CLAMP);        // casters in front of the near plane still write depth
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(2.0f, 4.0f);
+        }
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, cascade);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        depthShader.use();
+        depthShader.setMat4("lightSpaceMatrix", cascades[cascade].viewProjection);
+    }
+
+    void end(int viewportWidth, int viewportHeight)
+    {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+    }
+
+    // Caster culling against the light volume of one cascade
+    bool isVisible(int cascade, const glm::vec3& center, float radius) const
+    {
+        const Cascade& c = cascades[cascade];
+        const glm::vec3 p = glm::vec3(lightView * glm::vec4(center, 1.0f));
+
+        return std::abs(p.x - c.center.x) <= c.radius + radius &&
+               std::abs(p.y - c.center.y) <= c.radius + radius &&
+               p.z - radius <= c.center.z + c.radius + CSM_CASTER_EXTENSION &&
+               p.z + radius >= c.center.z - c.radius;
+    }
+
+    // Screen space mask of the sun's shadow for the current G-buffer, call
+    // after update() and the cascades. Follows the window size
+    void renderMask(unsigned int gPosition, unsigned int gNormal, const glm::mat4& view, const glm::mat4& projection,
+                    int width, int height)
+    {
+        TRACE_GPU_SCOPE("Sun shadow mask");
+        resizeMask(width, height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, maskFramebuffer);
+        glViewport(0, 0, width, height);
+        glDisable(GL_DEPTH_TEST);
+
+        maskShader.use();
+        maskShader.setInt("gPosition", 0);
+        maskShader.setInt("gNormal", 1);
+        maskShader.setMat4("view", view);
+        maskShader.setInt("frameIndex", frame++);
+        setUniforms(maskShader, 2);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gPosition);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gNormal);
+        renderQuad();
+
+        temporal.resolve(maskTexture, maskDepthNormal, view, projection);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Accumulated shadow mask in .r, 1 lit
+    unsigned int getMaskTexture() const
+    {
+        return temporal.getTexture();
+    }
+
+    int getCascadeCount() const
+    {
+        return cascadeCount;
+    }
+
+    unsigned int getTexture() const
+    {
+        return depthArray;
+    }
+
+private:
+    struct Cascade {
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        glm::vec3 center;   // light view space
+        float radius;
+        float texelSize;    // world units per shadow texel
+    };
+
+    GLTexture depthArray;
+    GLFramebuffer framebuffer;
+    int resolution = 2048;
+    int cascadeCount = CSM_MAX_CASCADES;
+
+    glm::mat4 lightView = glm::mat4(1.0f);
+    Cascade cascades[CSM_MAX_CASCADES] = {};
+    float splits[CSM_MAX_CASCADES + 1] = {};
+
+    Shader maskShader = Shader("shaders/vertex/2d_tex.glsl", "shaders/fragment/lighting/sun_shadow_mask.glsl");
+    TemporalAccumulator temporal;
+    GLTexture maskTexture, maskDepthNormal;
+    GLFramebuffer maskFramebuffer;
+    int maskWidth = 0, maskHeight = 0;
+    int frame = 0;
+
+    // Cascade uniforms of the mask shader, the array goes on `unit`
+    void setUniforms(const Shader& shader, int unit) const
+    {
+        shader.setInt("cascadeCount", cascadeCount);
+        for (int i = 0; i < cascadeCount; i++)
+        {
+            const std::string index = "[" + std::to_string(i) + "]";
+            shader.setMat4("cascadeMatrices" + index, cascades[i].viewProjection);
+            shader.setFloat("cascadeSplits" + index, splits[i + 1]);
+            shader.setFloat("cascadeTexelSizes" + index, cascades[i].texelSize);
+        }
+
+        shader.setInt("shadowMap", unit);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+    }
+
+    void resizeMask(int width, int height)
+    {
+        if (width == maskWidth && height == maskHeight)
+            return;
+
+        maskWidth = width;
+        maskHeight = height;
+
+        maskTexture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, maskTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GPUMemoryTrackTexture(maskTexture, GPUMemory_RenderTargets, GL_R8, width, height);
+
+        maskDepthNormal = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, maskDepthNormal);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GPUMemoryTrackTexture(maskDepthNormal, GPUMemory_RenderTargets, GL_RGBA16F, width, height);
+
+        maskFramebuffer = GLFramebuffer::create();
+        glBindFramebuffer(GL_FRAMEBUFFER, maskFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, maskTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, maskDepthNormal, 0);
+        const unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::CASCADED_SHADOWS::MASK_FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        temporal.resize(width, height);
+    }
+};
+
+#endif
@@ -3,10 +3,13 @@
 
 #include <iostream>
 #include <string>
+#include <cstdio>
 
 #include <glad/glad.h>
 
 #include "shader.h"
+#include "gl_resources.h"
+#include "text_rendering.h"
 
 // Simple light error checker
 GLenum glCheckError_(const char *file, int line)
@@ -29,6 +32,26 @@ GLenum glCheckError_(const char *file, int line)
 }
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
+// Live breakdown of the GPU memory registry, same render state requirements as RenderText
+void RenderGPUMemoryOverlay(Shader &textShader, float x, float y, float scale)
+{
+    const GPUMemoryTotals& totals = GPUMemoryGetTotals();
+    const float lineHeight = 48.0f * scale * 1.2f; // font is loaded with 48px height
+
+    char line[96];
+    std::snprintf(line, sizeof(line), "GPU memory %.1f MB", GPUMemoryTotalBytes() / (1024.0 * 1024.0));
+    RenderText(textShader, line, x, y, scale, glm::vec3(0.0f, 1.0f, 0.0f));
+    y -= lineHeight;
+
+    for (unsigned int i = 0; i < GPUMemory_CategoryCount; i++)
+    {
+        std::snprintf(line, sizeof(line), "%-16s %4u  %8.2f MB", GPU_MEMORY_CATEGORY_NAMES[i],
+                      totals.objects[i], totals.bytes[i] / (1024.0 * 1024.0));
+        RenderText(textShader, line, x, y, scale, glm::vec3(1.0f, 1.0f, 1.0f));
+        y -= lineHeight;
+    }
+}
+
 // EXTENSION OR OPENGL 4.3+ REQUIRED FOR THE FOLLOWING TO WORK:
 
 // Heavier debug output
@@ -106,17 +129,15 @@ GLenum glCheckError_(const char *file, int line)
 void DisplayFramebufferTexture(unsigned int textureID)
 {
     static bool initialized = false;
-    static unsigned int shaderDisplayFBOOutput = 0;
-    static unsigned int vaoDebugTexturedRect = 0;
+    static Shader shaderDisplayFBOOutput("shaders/debug/vertex/framebuffer.glsl", "shaders/debug/fragment/framebuffer.glsl");
+    static GLVertexArray vaoDebugTexturedRect;
+    static GLBuffer vbo;
 
     if (!initialized)
     {
-        // Shader creation and configuration
-        Shader shaderCreation("shaders/debug/vertex/framebuffer.glsl", "shaders/debug/fragment/framebuffer.glsl");
-        shaderCreation.use();
-        shaderCreation.setInt("fboAttachment", 0);
-
-        shaderDisplayFBOOutput = shaderCreation.ID;
+        // Shader configuration
+        shaderDisplayFBOOutput.use();
+        shaderDisplayFBOOutput.setInt("fboAttachment", 0);
 
         // VAO creation and configuration
         const float vertices[] = {
@@ -129,9 +150,8 @@ void DisplayFramebufferTexture(unsigned int textureID)
             0.9375f,  0.9375f,  1.0f, 1.0f,   // Top-right
         };
 
-        unsigned int vbo;
-        glGenVertexArrays(1, &vaoDebugTexturedRect);
-        glGenBuffers(1, &vbo);
+        vaoDebugTexturedRect = GLVertexArray::create();
+        vbo = GLBuffer::create();
 
         glBindVertexArray(vaoDebugTexturedRect);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -146,7 +166,7 @@ void DisplayFramebufferTexture(unsigned int textureID)
     }
   
     glActiveTexture(GL_TEXTURE0);  	
-    glUseProgram(shaderDisplayFBOOutput);
+    glUseProgram(shaderDisplayFBOOutput.ID);
         glBindTexture(GL_TEXTURE_2D, textureID);
         glBindVertexArray(vaoDebugTexturedRect);
             glDrawArrays(GL_TRIANGLES, 0, 6);
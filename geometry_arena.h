@@ -0,0 +1,405 @@
+// Shared vertex/index buffers for all static geometry of one vertex layout
+//
+// Meshes get a range of a few big buffers instead of their own VAO/VBO/EBO,
+// so everything with the same layout draws with one VAO bind, and whole
+// lists of meshes go out in a single glMultiDrawElementsBaseVertex.
+// Indices stay relative to the mesh, baseVertex moves them into its range.
+
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+
+
+enum VertexLayout {
+    VertexLayout_Mesh,          // Vertex from mesh.h: position, normal, uv, tangent
+    VertexLayout_PosNormalUV,   // shapes: 3 + 3 + 2 floats
+    VertexLayout_PosUV,         // screen quads: 2 + 2 floats
+    VertexLayout_Count
+};
+
+struct VertexAttribute {
+    unsigned int location;
+    int components;
+    unsigned int offset;
+};
+
+struct VertexLayoutDesc {
+    unsigned int stride;
+    unsigned int attributeCount;
+    VertexAttribute attributes[4];
+};
+
+const VertexLayoutDesc VERTEX_LAYOUTS[VertexLayout_Count] = {
+    { 11 * sizeof(float), 4, {{0, 3, 0}, {1, 3, 3 * sizeof(float)}, {2, 2, 6 * sizeof(float)}, {3, 3, 8 * sizeof(float)}} },
+    {  8 * sizeof(float), 3, {{0, 3, 0}, {1, 3, 3 * sizeof(float)}, {2, 2, 6 * sizeof(float)}} },
+    {  4 * sizeof(float), 2, {{0, 2, 0}, {1, 2, 2 * sizeof(float)}} },
+};
+
+// Initial sizes per layout, the buffers double when they run out. The first
+// allocation gets the size it needs when that's more
+struct GeometryArenaSize {
+    unsigned int vertices;
+    unsigned int indices;
+};
+
+const GeometryArenaSize GEOMETRY_ARENA_INITIAL_SIZES[VertexLayout_Count] = {
+    { 1 << 16, 1 << 18 },   // model meshes
+    { 1 << 13, 1 << 14 },   // the unit sphere and cube
+    { 0, 0 },               // just the screen quad
+};
+
+// Where a mesh lives inside its arena
+struct GeometryRange {
+    int baseVertex = 0;
+    unsigned int vertexCount = 0;
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+};
+
+// First fit allocator over [0, capacity), freed ranges merge with their neighbours
+class RangeAllocator
+{
+public:
+    void init(unsigned int capacity)
+    {
+        this->capacity = capacity;
+        freeRanges.assign(1, {0, capacity});
+    }
+
+    // false if no free range is big enough
+    bool allocate(unsigned int count, unsigned int& offset)
+    {
+        for (size_t i = 0; i < freeRanges.size(); i++)
+        {
+            FreeRange& range = freeRanges[i];
+            if (range.count < count)
+                continue;
+
+            offset = range.offset;
+            range.offset += count;
+            range.count -= count;
+            if (range.count == 0)
+                freeRanges.erase(freeRanges.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    void free(unsigned int offset, unsigned int count)
+    {
+        if (count == 0)
+            return;
+
+        // keep the list sorted by offset
+        auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+                                     [](const FreeRange& range, unsigned int value) { return range.offset < value; });
+        next = freeRanges.insert(next, {offset, count});
+
+        // merge with the following range, then with the previous one
+        if (next + 1 != freeRanges.end() && next->offset + next->count == (next + 1)->offset)
+        {
+            next->count += (next + 1)->count;
+            freeRanges.erase(next + 1);
+        }
+        if (next != freeRanges.begin() && (next - 1)->offset + (next - 1)->count == next->offset)
+        {
+            (next - 1)->count += next->count;
+            freeRanges.erase(next);
+        }
+    }
+
+    // Adds [capacity, newCapacity) to the free list
+    void grow(unsigned int newCapacity)
+    {
+        const unsigned int oldCapacity = capacity;
+        capacity = newCapacity;
+        free(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    unsigned int getCapacity() const
+    {
+        return capacity;
+    }
+
+    unsigned int freeCount() const
+    {
+        unsigned int count = 0;
+        for (const FreeRange& range : freeRanges)
+            count += range.count;
+        return count;
+    }
+
+private:
+    struct FreeRange {
+        unsigned int offset;
+        unsigned int count;
+    };
+
+    unsigned int capacity = 0;
+    std::vector<FreeRange> freeRanges;
+};
+
+class GeometryArena
+{
+public:
+    explicit GeometryArena(VertexLayout layout) : layout(layout) {}
+
+    // Copies the data into the arena, indices are relative to the first vertex
+    GeometryRange allocate(const void *vertices, unsigned int vertexCount,
+                           const unsigned int *indices, unsigned int indexCount)
+    {
+        if (!vao)
+            init(vertexCount, indexCount);
+
+        GeometryRange range;
+        unsigned int vertexOffset, indexOffset;
+
+        while (!vertexAllocator.allocate(vertexCount, vertexOffset))
+            growVertices(vertexCount);
+        while (!indexAllocator.allocate(indexCount, indexOffset))
+            growIndices(indexCount);
+
+        range.baseVertex = static_cast<int>(vertexOffset);
+        range.vertexCount = vertexCount;
+        range.firstIndex = indexOffset;
+        range.indexCount = indexCount;
+
+        const unsigned int stride = VERTEX_LAYOUTS[layout].stride;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)vertexOffset * stride, (GLsizeiptr)vertexCount * stride, vertices);
+
+        // the element buffer binding is VAO state
+        glBindVertexArray(vao);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)indexOffset * sizeof(unsigned int),
+                        (GLsizeiptr)indexCount * sizeof(unsigned int), indices);
+        glBindVertexArray(0);
+
+        return range;
+    }
+
+    void free(const GeometryRange& range)
+    {
+        vertexAllocator.free(static_cast<unsigned int>(range.baseVertex), range.vertexCount);
+        indexAllocator.free(range.firstIndex, range.indexCount);
+    }
+
+    void bind() const
+    {
+        glBindVertexArray(vao);
+    }
+
+    unsigned int getVAO() const
+    {
+        return vao;
+    }
+
+    void draw(const GeometryRange& range, GLenum mode = GL_TRIANGLES) const
+    {
+        glDrawElementsBaseVertex(mode, range.indexCount, GL_UNSIGNED_INT,
+                                 (void*)((size_t)range.firstIndex * sizeof(unsigned int)), range.baseVertex);
+    }
+
+    void drawInstanced(const GeometryRange& range, unsigned int instanceCount, GLenum mode = GL_TRIANGLES) const
+    {
+        glDrawElementsInstancedBaseVertex(mode, range.indexCount, GL_UNSIGNED_INT,
+                                          (void*)((size_t)range.firstIndex * sizeof(unsigned int)),
+                                          instanceCount, range.baseVertex);
+    }
+
+private:
+    VertexLayout layout;
+    GLVertexArray vao;
+    GLBuffer vbo, ebo;
+    RangeAllocator vertexAllocator, indexAllocator;
+
+    void init(unsigned int vertexCount, unsigned int indexCount)
+    {
+        vao = GLVertexArray::create();
+        vbo = GLBuffer::create();
+        ebo = GLBuffer::create();
+
+        const GeometryArenaSize& initial = GEOMETRY_ARENA_INITIAL_SIZES[layout];
+        vertexAllocator.init(std::max(initial.vertices, vertexCount));
+        indexAllocator.init(std::max(initial.indices, indexCount));
+
+        const VertexLayoutDesc& desc = VERTEX_LAYOUTS[layout];
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexAllocator.getCapacity() * desc.stride, nullptr, GL_STATIC_DRAW);
+        vbo.track(GPUMemory_Geometry, (size_t)vertexAllocator.getCapacity() * desc.stride);
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexAllocator.getCapacity() * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        ebo.track(GPUMemory_Geometry, (size_t)indexAllocator.getCapacity() * sizeof(unsigned int));
+        setupAttributes();
+        glBindVertexArray(0);
+    }
+
+    void setupAttributes()
+    {
+        const VertexLayoutDesc& desc = VERTEX_LAYOUTS[layout];
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        for (unsigned int i = 0; i < desc.attributeCount; i++)
+        {
+            const VertexAttribute& attribute = desc.attributes[i];
+            glEnableVertexAttribArray(attribute.location);
+            glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE,
+                                  desc.stride, (void*)(size_t)attribute.offset);
+        }
+    }
+
+    // Copies the contents into a bigger buffer on the GPU, ranges keep their offsets
+    GLBuffer grownBuffer(const GLBuffer& old, size_t oldBytes, size_t newBytes)
+    {
+        GLBuffer buffer = GLBuffer::create();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newBytes, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, old);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)oldBytes);
+        buffer.track(GPUMemory_Geometry, newBytes);
+        return buffer;
+    }
+
+    void growVertices(unsigned int needed)
+    {
+        const unsigned int stride = VERTEX_LAYOUTS[layout].stride;
+        const unsigned int oldCapacity = vertexAllocator.getCapacity();
+        const unsigned int newCapacity = std::max(oldCapacity * 2, oldCapacity + needed);
+
+        vbo = grownBuffer(vbo, (size_t)oldCapacity * stride, (size_t)newCapacity * stride);
+        vertexAllocator.grow(newCapacity);
+
+        glBindVertexArray(vao);
+        setupAttributes();
+        glBindVertexArray(0);
+    }
+
+    void growIndices(unsigned int needed)
+    {
+        const unsigned int oldCapacity = indexAllocator.getCapacity();
+        const unsigned int newCapacity = std::max(oldCapacity * 2, oldCapacity + needed);
+
+        ebo = grownBuffer(ebo, (size_t)oldCapacity * sizeof(unsigned int), (size_t)newCapacity * sizeof(unsigned int));
+        indexAllocator.grow(newCapacity);
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBindVertexArray(0);
+    }
+};
+
+// One arena per layout, the GL objects are created on first use.
+// Globals so they outlive the function statics holding allocations
+static GeometryArena geometryArenas[VertexLayout_Count] = {
+    GeometryArena(VertexLayout_Mesh),
+    GeometryArena(VertexLayout_PosNormalUV),
+    GeometryArena(VertexLayout_PosUV),
+};
+
+inline GeometryArena& GetGeometryArena(VertexLayout layout)
+{
+    return geometryArenas[layout];
+}
+
+// Range owned by a mesh, returned to its arena on destruction
+class GeometryAllocation
+{
+public:
+    GeometryAllocation() = default;
+
+    GeometryAllocation(VertexLayout layout, const void *vertices, unsigned int vertexCount,
+                       const unsigned int *indices, unsigned int indexCount)
+        : layout(layout), range(GetGeometryArena(layout).allocate(vertices, vertexCount, indices, indexCount)), owned(true) {}
+
+    ~GeometryAllocation() { reset(); }
+
+    GeometryAllocation(const GeometryAllocation&) = delete;
+    GeometryAllocation& operator=(const GeometryAllocation&) = delete;
+
+    GeometryAllocation(GeometryAllocation&& other) noexcept
+        : layout(other.layout), range(other.range), owned(other.owned) { other.owned = false; }
+    GeometryAllocation& operator=(GeometryAllocation&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            layout = other.layout;
+            range = other.range;
+            owned = other.owned;
+            other.owned = false;
+        }
+        return *this;
+    }
+
+    const GeometryRange& getRange() const { return range; }
+    GeometryArena& getArena() const { return GetGeometryArena(layout); }
+
+    // Binds the arena VAO and draws just this range
+    void draw(GLenum mode = GL_TRIANGLES) const
+    {
+        GeometryArena& arena = getArena();
+        arena.bind();
+        arena.draw(range, mode);
+    }
+
+    void reset()
+    {
+        if (owned)
+            GetGeometryArena(layout).free(range);
+        owned = false;
+    }
+
+private:
+    VertexLayout layout = VertexLayout_Mesh;
+    GeometryRange range;
+    bool owned = false;
+};
+
+// Collects ranges of one arena and draws them with a single call
+class GeometryBatch
+{
+public:
+    void add(const GeometryRange& range)
+    {
+        counts.push_back(static_cast<GLsizei>(range.indexCount));
+        offsets.push_back((const void*)((size_t)range.firstIndex * sizeof(unsigned int)));
+        baseVertices.push_back(range.baseVertex);
+    }
+
+    void clear()
+    {
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+    }
+
+    bool empty() const
+    {
+        return counts.empty();
+    }
+
+    void submit(const GeometryArena& arena, GLenum mode = GL_TRIANGLES) const
+    {
+        if (counts.empty())
+            return;
+
+        arena.bind();
+        glMultiDrawElementsBaseVertex(mode, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                      static_cast<GLsizei>(counts.size()), baseVertices.data());
+    }
+
+private:
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+};
+
+#endif
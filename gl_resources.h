@@ -0,0 +1,263 @@
+// Move-only owners for GL objects and an estimate of the GPU memory they use
+//
+// Memory is tracked per (object type, id), so objects created through raw
+// glGen* calls can be registered too (GPUMemoryTrack) and are removed from
+// the registry when their handle deletes them.
+
+#ifndef GL_RESOURCES_H
+#define GL_RESOURCES_H
+
+#include <iostream>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+
+#include <glad/glad.h>
+
+
+enum GLResourceKind {
+    GLResource_Texture,
+    GLResource_Buffer,
+    GLResource_VertexArray,
+    GLResource_Framebuffer,
+    GLResource_Renderbuffer,
+    GLResource_Program,
+};
+
+enum GPUMemoryCategory {
+    GPUMemory_Textures,       // loaded from files
+    GPUMemory_RenderTargets,  // framebuffer attachments
+    GPUMemory_Environment,    // IBL cubemaps and lookup textures
+    GPUMemory_Geometry,       // vertex and index buffers
+    GPUMemory_Buffers,        // uniform, storage, streaming...
+    GPUMemory_Text,           // glyphs
+    GPUMemory_CategoryCount
+};
+
+const char* const GPU_MEMORY_CATEGORY_NAMES[GPUMemory_CategoryCount] = {
+    "Textures", "Render targets", "Environment", "Geometry", "Buffers", "Text"
+};
+
+struct GPUMemoryEntry {
+    GPUMemoryCategory category;
+    size_t bytes;
+};
+
+struct GPUMemoryTotals {
+    size_t bytes[GPUMemory_CategoryCount];
+    unsigned int objects[GPUMemory_CategoryCount];
+};
+
+static std::unordered_map<uint64_t, GPUMemoryEntry> gpuMemoryEntries;
+static GPUMemoryTotals gpuMemoryTotals = {};
+
+// Set once the context is destroyed, handles outliving it won't call GL anymore
+static bool glContextDestroyed = false;
+
+inline uint64_t GPUMemoryKey(GLResourceKind kind, unsigned int id)
+{
+    return ((uint64_t)kind << 32) | id;
+}
+
+void GPUMemoryUntrack(GLResourceKind kind, unsigned int id)
+{
+    auto entry = gpuMemoryEntries.find(GPUMemoryKey(kind, id));
+    if (entry == gpuMemoryEntries.end())
+        return;
+
+    gpuMemoryTotals.bytes[entry->second.category] -= entry->second.bytes;
+    gpuMemoryTotals.objects[entry->second.category]--;
+    gpuMemoryEntries.erase(entry);
+}
+
+// Registers (or updates) the estimated size of an object
+void GPUMemoryTrack(GLResourceKind kind, unsigned int id, GPUMemoryCategory category, size_t bytes)
+{
+    if (id == 0)
+        return;
+
+    // replacing an older estimate
+    GPUMemoryUntrack(kind, id);
+
+    GPUMemoryEntry& entry = gpuMemoryEntries[GPUMemoryKey(kind, id)];
+    entry.category = category;
+    entry.bytes = bytes;
+    gpuMemoryTotals.bytes[category] += bytes;
+    gpuMemoryTotals.objects[category]++;
+}
+
+const GPUMemoryTotals& GPUMemoryGetTotals()
+{
+    return gpuMemoryTotals;
+}
+
+size_t GPUMemoryTotalBytes()
+{
+    size_t total = 0;
+    for (unsigned int i = 0; i < GPUMemory_CategoryCount; i++)
+        total += gpuMemoryTotals.bytes[i];
+    return total;
+}
+
+void GPUMemoryReport()
+{
+    std::cout << "GPU memory (estimated):" << '\n';
+    for (unsigned int i = 0; i < GPUMemory_CategoryCount; i++)
+    {
+        std::printf("  %-16s %4u objects %10.2f MB\n", GPU_MEMORY_CATEGORY_NAMES[i],
+                    gpuMemoryTotals.objects[i], gpuMemoryTotals.bytes[i] / (1024.0 * 1024.0));
+    }
+    std::printf("  %-16s %22.2f MB\n", "Total", GPUMemoryTotalBytes() / (1024.0 * 1024.0));
+}
+
+// Driver side size of one texel, unsized formats are counted as the format drivers pick for them
+size_t GPUTexelBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_RED: case GL_R8:                                   return 1;
+        case GL_RG: case GL_RG8: case GL_R16F:                     return 2;
+        case GL_RGB: case GL_RGB8: case GL_SRGB: case GL_SRGB8:    return 4; // padded to RGBA8
+        case GL_RGBA: case GL_RGBA8: case GL_SRGB_ALPHA: case GL_SRGB8_ALPHA8:
+        case GL_RG16F: case GL_R32F: case GL_RGB9_E5: case GL_R11F_G11F_B10F:
+        case GL_RGB10_A2: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F:
+        case GL_DEPTH24_STENCIL8: case GL_DEPTH_COMPONENT:         return 4;
+        case GL_DEPTH_COMPONENT16:                                 return 2;
+        case GL_RGB16F: case GL_RGBA16F: case GL_RG32F:            return 8; // RGB16F padded to RGBA16F
+        case GL_RGB32F: case GL_RGBA32F:                           return 16;
+        default:                                                   return 4;
+    }
+}
+
+// Size of a texture with all its layers (6 for cubemaps), mipmaps add a third
+size_t GPUTextureBytes(GLenum internalFormat, int width, int height, int layers = 1, bool mipmapped = false)
+{
+    const size_t base = GPUTexelBytes(internalFormat) * (size_t)width * height * layers;
+    return mipmapped ? base + base / 3 : base;
+}
+
+inline void GPUMemoryTrackTexture(unsigned int id, GPUMemoryCategory category, GLenum internalFormat,
+                                  int width, int height, int layers = 1, bool mipmapped = false)
+{
+    GPUMemoryTrack(GLResource_Texture, id, category, GPUTextureBytes(internalFormat, width, height, layers, mipmapped));
+}
+
+// Handles
+// -------
+
+template <GLResourceKind Kind>
+struct GLResourceTraits;
+
+template <>
+struct GLResourceTraits<GLResource_Texture> {
+    static unsigned int create() { unsigned int id; glGenTextures(1, &id); return id; }
+    static void destroy(unsigned int id) { glDeleteTextures(1, &id); }
+};
+
+template <>
+struct GLResourceTraits<GLResource_Buffer> {
+    static unsigned int create() { unsigned int id; glGenBuffers(1, &id); return id; }
+    static void destroy(unsigned int id) { glDeleteBuffers(1, &id); }
+};
+
+template <>
+struct GLResourceTraits<GLResource_VertexArray> {
+    static unsigned int create() { unsigned int id; glGenVertexArrays(1, &id); return id; }
+    static void destroy(unsigned int id) { glDeleteVertexArrays(1, &id); }
+};
+
+template <>
+struct GLResourceTraits<GLResource_Framebuffer> {
+    static unsigned int create() { unsigned int id; glGenFramebuffers(1, &id); return id; }
+    static void destroy(unsigned int id) { glDeleteFramebuffers(1, &id); }
+};
+
+template <>
+struct GLResourceTraits<GLResource_Renderbuffer> {
+    static unsigned int create() { unsigned int id; glGenRenderbuffers(1, &id); return id; }
+    static void destroy(unsigned int id) { glDeleteRenderbuffers(1, &id); }
+};
+
+template <>
+struct GLResourceTraits<GLResource_Program> {
+    static unsigned int create() { return glCreateProgram(); }
+    static void destroy(unsigned int id) { glDeleteProgram(id); }
+};
+
+// Owns one GL object, converts to the raw id so it can go straight into gl* calls
+template <GLResourceKind Kind>
+class GLHandle
+{
+public:
+    GLHandle() = default;
+    explicit GLHandle(unsigned int id) : id(id) {} // takes ownership of an existing object
+
+    ~GLHandle() { reset(); }
+
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+
+    GLHandle(GLHandle&& other) noexcept : id(other.id) { other.id = 0; }
+    GLHandle& operator=(GLHandle&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            id = other.id;
+            other.id = 0;
+        }
+        return *this;
+    }
+
+    static GLHandle create()
+    {
+        return GLHandle(GLResourceTraits<Kind>::create());
+    }
+
+    operator unsigned int() const { return id; }
+    unsigned int get() const { return id; }
+
+    // Sets the memory estimate of the owned object
+    void track(GPUMemoryCategory category, size_t bytes) const
+    {
+        GPUMemoryTrack(Kind, id, category, bytes);
+    }
+
+    // Gives up ownership without deleting
+    unsigned int release()
+    {
+        const unsigned int released = id;
+        id = 0;
+        return released;
+    }
+
+    void reset()
+    {
+        if (id == 0)
+            return;
+
+        GPUMemoryUntrack(Kind, id);
+        if (!glContextDestroyed)
+            GLResourceTraits<Kind>::destroy(id);
+        id = 0;
+    }
+
+private:
+    unsigned int id = 0;
+};
+
+typedef GLHandle<GLResource_Texture>      GLTexture;
+typedef GLHandle<GLResource_Buffer>       GLBuffer;
+typedef GLHandle<GLResource_VertexArray>  GLVertexArray;
+typedef GLHandle<GLResource_Framebuffer>  GLFramebuffer;
+typedef GLHandle<GLResource_Renderbuffer> GLRenderbuffer;
+typedef GLHandle<GLResource_Program>      GLProgram;
+
+// Call right before the context is destroyed (glfwTerminate), handles destroyed
+// afterwards (globals, statics) only drop their registry entries
+void GLResourcesShutdown()
+{
+    glContextDestroyed = true;
+}
+
+#endif
@@ -0,0 +1,541 @@
+// Per-frame GL driver call statistics
+// GLStatsInstall swaps the glad function pointers for counting wrappers,
+// GLStatsUninstall puts the original pointers back, so while disabled
+// there is no cost at all. Must be installed/uninstalled on the GL thread
+// after gladLoadGLLoader.
+
+#ifndef GL_STATS_H
+#define GL_STATS_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "text_rendering.h"
+
+
+// Every intercepted entry point
+#define GL_STATS_ENTRY_POINTS(X) \
+    X(glDrawArrays) X(glDrawElements) X(glDrawArraysInstanced) X(glDrawElementsInstanced) \
+    X(glDrawElementsBaseVertex) X(glDrawElementsInstancedBaseVertex) X(glMultiDrawArrays) X(glMultiDrawElementsBaseVertex) \
+    X(glDrawElementsIndirect) X(glMultiDrawElementsIndirect) X(glMultiDrawElementsIndirectCount) \
+    X(glMultiDrawElementsIndirectCountARB) X(glDispatchCompute) \
+    X(glActiveTexture) X(glBindTexture) X(glUseProgram) X(glBindVertexArray) X(glBindBuffer) \
+    X(glBindBufferBase) X(glBindBufferRange) X(glBindFramebuffer) X(glBindRenderbuffer) \
+    X(glEnable) X(glDisable) X(glBlendFunc) X(glDepthFunc) X(glViewport) X(glClear) X(glClearColor) \
+    X(glBufferData) X(glBufferSubData) X(glMapBufferRange) X(glUnmapBuffer) \
+    X(glTexImage2D) X(glTexSubImage2D) X(glTexImage3D) X(glTexSubImage3D) X(glGenerateMipmap) \
+    X(glTexParameteri) X(glPixelStorei) \
+    X(glGetUniformLocation) X(glGetUniformBlockIndex) X(glUniform1i) X(glUniform1f) X(glUniform2f) \
+    X(glUniform3f) X(glUniform4f) X(glUniformMatrix3fv) X(glUniformMatrix4fv) \
+    X(glFramebufferTexture2D) X(glFramebufferTextureLayer) X(glRenderbufferStorage) X(glDrawBuffers) \
+    X(glBlitFramebuffer) X(glReadPixels) X(glGetTexImage) X(glGetError) X(glGetIntegerv) \
+    X(glFenceSync) X(glClientWaitSync) X(glQueryCounter) X(glGetQueryObjectiv) X(glGetQueryObjectui64v) \
+    X(glDeleteTextures) X(glDeleteBuffers) X(glDeleteVertexArrays) X(glDeleteProgram) X(glDeleteFramebuffers)
+
+enum GLStatsEntry {
+#define GL_STATS_ENUM(name) GLStats_##name,
+    GL_STATS_ENTRY_POINTS(GL_STATS_ENUM)
+#undef GL_STATS_ENUM
+    GLStats_Count
+};
+
+const char* const GL_STATS_NAMES[GLStats_Count] = {
+#define GL_STATS_NAME(name) #name,
+    GL_STATS_ENTRY_POINTS(GL_STATS_NAME)
+#undef GL_STATS_NAME
+};
+
+struct GLStatsCounters {
+    unsigned int calls[GLStats_Count];
+    unsigned int redundant[GLStats_Count];  // state sets that didn't change anything
+    unsigned long long bytes[GLStats_Count];
+};
+
+// Shadow copy of the bindings we check for redundancy
+// (0xFFFFFFFF = unknown, the first set after installing never counts as redundant)
+const unsigned int GL_STATS_UNKNOWN = 0xFFFFFFFF;
+const unsigned int GL_STATS_TEXTURE_UNITS = 32;
+const unsigned int GL_STATS_TEXTURE_TARGETS = 5;  // 2D, cubemap, 2D array, cubemap array, other
+const unsigned int GL_STATS_BUFFER_TARGETS = 6;   // array, uniform, shader storage, indirect, pixel unpack, other
+const unsigned int GL_STATS_CAPABILITIES = 8;
+
+struct GLStatsShadowState {
+    unsigned int activeUnit;
+    unsigned int textures[GL_STATS_TEXTURE_UNITS][GL_STATS_TEXTURE_TARGETS];
+    unsigned int program;
+    unsigned int vertexArray;
+    unsigned int buffers[GL_STATS_BUFFER_TARGETS];
+    unsigned int drawFramebuffer;
+    unsigned int readFramebuffer;
+    unsigned int capabilities[GL_STATS_CAPABILITIES];
+};
+
+thread_local GLStatsCounters glStatsCurrent = {};
+GLStatsCounters glStatsLastFrame = {};
+GLStatsShadowState glStatsShadow;
+bool glStatsInstalled = false;
+
+inline void GLStatsResetShadow()
+{
+    std::memset(&glStatsShadow, 0xFF, sizeof(glStatsShadow));
+}
+
+inline unsigned int GLStatsTextureTarget(GLenum target)
+{
+    switch (target)
+    {
+        case GL_TEXTURE_2D:             return 0;
+        case GL_TEXTURE_CUBE_MAP:       return 1;
+        case GL_TEXTURE_2D_ARRAY:       return 2;
+        case GL_TEXTURE_CUBE_MAP_ARRAY: return 3;
+        default:                        return 4;
+    }
+}
+
+inline unsigned int GLStatsBufferTarget(GLenum target)
+{
+    switch (target)
+    {
+        case GL_ARRAY_BUFFER:          return 0;
+        case GL_UNIFORM_BUFFER:        return 1;
+        case GL_SHADER_STORAGE_BUFFER: return 2;
+        case GL_DRAW_INDIRECT_BUFFER:  return 3;
+        case GL_PIXEL_UNPACK_BUFFER:   return 4;
+        default:                       return 5; // element array binding is VAO state, never tracked
+    }
+}
+
+inline int GLStatsCapability(GLenum cap)
+{
+    switch (cap)
+    {
+        case GL_DEPTH_TEST:                  return 0;
+        case GL_BLEND:                       return 1;
+        case GL_CULL_FACE:                   return 2;
+        case GL_STENCIL_TEST:                return 3;
+        case GL_SCISSOR_TEST:                return 4;
+        case GL_MULTISAMPLE:                 return 5;
+        case GL_FRAMEBUFFER_SRGB:            return 6;
+        case GL_TEXTURE_CUBE_MAP_SEAMLESS:   return 7;
+        default:                             return -1;
+    }
+}
+
+// Bytes of a client pixel upload/readback
+inline unsigned long long GLStatsPixelBytes(GLenum format, GLenum type, long long texels)
+{
+    unsigned int components;
+    switch (format)
+    {
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX: components = 1; break;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL:                            components = 2; break;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER:                                    components = 3; break;
+        default:                                                                          components = 4; break;
+    }
+
+    unsigned int componentSize;
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE: case GL_BYTE:                   componentSize = 1; break;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: componentSize = 2; break;
+        case GL_UNSIGNED_INT_24_8: case GL_UNSIGNED_INT_5_9_9_9_REV:
+        case GL_UNSIGNED_INT_10F_11F_11F_REV: case GL_UNSIGNED_INT_2_10_10_10_REV:
+            return texels * 4; // packed, one 32 bit value per texel
+        default:                                               componentSize = 4; break;
+    }
+
+    return texels * components * componentSize;
+}
+
+// Extra bookkeeping per entry point, nothing for most of them
+template <int Id>
+struct GLStatsInspect {
+    template <typename... Args>
+    static void before(Args...) {}
+};
+
+#define GL_STATS_REDUNDANT(name) glStatsCurrent.redundant[GLStats_##name]++
+#define GL_STATS_BYTES(name, count) glStatsCurrent.bytes[GLStats_##name] += (count)
+
+template <>
+struct GLStatsInspect<GLStats_glActiveTexture> {
+    static void before(GLenum texture)
+    {
+        const unsigned int unit = texture - GL_TEXTURE0;
+        if (glStatsShadow.activeUnit == unit)
+            GL_STATS_REDUNDANT(glActiveTexture);
+        glStatsShadow.activeUnit = unit;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBindTexture> {
+    static void before(GLenum target, GLuint texture)
+    {
+        const unsigned int unit = glStatsShadow.activeUnit;
+        if (unit >= GL_STATS_TEXTURE_UNITS)
+            return;
+
+        unsigned int& bound = glStatsShadow.textures[unit][GLStatsTextureTarget(target)];
+        if (bound == texture)
+            GL_STATS_REDUNDANT(glBindTexture);
+        bound = texture;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glUseProgram> {
+    static void before(GLuint program)
+    {
+        if (glStatsShadow.program == program)
+            GL_STATS_REDUNDANT(glUseProgram);
+        glStatsShadow.program = program;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBindVertexArray> {
+    static void before(GLuint array)
+    {
+        if (glStatsShadow.vertexArray == array)
+            GL_STATS_REDUNDANT(glBindVertexArray);
+        glStatsShadow.vertexArray = array;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBindBuffer> {
+    static void before(GLenum target, GLuint buffer)
+    {
+        const unsigned int index = GLStatsBufferTarget(target);
+        if (index == GL_STATS_BUFFER_TARGETS - 1)
+            return;
+
+        if (glStatsShadow.buffers[index] == buffer)
+            GL_STATS_REDUNDANT(glBindBuffer);
+        glStatsShadow.buffers[index] = buffer;
+    }
+};
+
+// Indexed binds also replace the generic binding of their target
+inline void GLStatsIndexedBufferBind(GLenum target, GLuint buffer)
+{
+    const unsigned int index = GLStatsBufferTarget(target);
+    if (index != GL_STATS_BUFFER_TARGETS - 1)
+        glStatsShadow.buffers[index] = buffer;
+}
+
+template <>
+struct GLStatsInspect<GLStats_glBindBufferBase> {
+    static void before(GLenum target, GLuint, GLuint buffer)
+    {
+        GLStatsIndexedBufferBind(target, buffer);
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBindBufferRange> {
+    static void before(GLenum target, GLuint, GLuint buffer, GLintptr, GLsizeiptr)
+    {
+        GLStatsIndexedBufferBind(target, buffer);
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBindFramebuffer> {
+    static void before(GLenum target, GLuint framebuffer)
+    {
+        const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+        const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+        if ((!draw || glStatsShadow.drawFramebuffer == framebuffer) &&
+            (!read || glStatsShadow.readFramebuffer == framebuffer))
+            GL_STATS_REDUNDANT(glBindFramebuffer);
+
+        if (draw)
+            glStatsShadow.drawFramebuffer = framebuffer;
+        if (read)
+            glStatsShadow.readFramebuffer = framebuffer;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glEnable> {
+    static void before(GLenum cap)
+    {
+        const int index = GLStatsCapability(cap);
+        if (index < 0)
+            return;
+        if (glStatsShadow.capabilities[index] == 1)
+            GL_STATS_REDUNDANT(glEnable);
+        glStatsShadow.capabilities[index] = 1;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glDisable> {
+    static void before(GLenum cap)
+    {
+        const int index = GLStatsCapability(cap);
+        if (index < 0)
+            return;
+        if (glStatsShadow.capabilities[index] == 0)
+            GL_STATS_REDUNDANT(glDisable);
+        glStatsShadow.capabilities[index] = 0;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBufferData> {
+    static void before(GLenum, GLsizeiptr size, const void*, GLenum)
+    {
+        GL_STATS_BYTES(glBufferData, size);
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glBufferSubData> {
+    static void before(GLenum, GLintptr, GLsizeiptr size, const void*)
+    {
+        GL_STATS_BYTES(glBufferSubData, size);
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glMapBufferRange> {
+    static void before(GLenum, GLintptr, GLsizeiptr length, GLbitfield)
+    {
+        GL_STATS_BYTES(glMapBufferRange, length);
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glTexImage2D> {
+    static void before(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLint, GLenum format, GLenum type, const void* pixels)
+    {
+        if (pixels)
+            GL_STATS_BYTES(glTexImage2D, GLStatsPixelBytes(format, type, (long long)width * height));
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glTexSubImage2D> {
+    static void before(GLenum, GLint, GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type, const void*)
+    {
+        GL_STATS_BYTES(glTexSubImage2D, GLStatsPixelBytes(format, type, (long long)width * height));
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glTexImage3D> {
+    static void before(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLsizei depth, GLint, GLenum format, GLenum type, const void* pixels)
+    {
+        if (pixels)
+            GL_STATS_BYTES(glTexImage3D, GLStatsPixelBytes(format, type, (long long)width * height * depth));
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glTexSubImage3D> {
+    static void before(GLenum, GLint, GLint, GLint, GLint, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void*)
+    {
+        GL_STATS_BYTES(glTexSubImage3D, GLStatsPixelBytes(format, type, (long long)width * height * depth));
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glReadPixels> {
+    static void before(GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type, void*)
+    {
+        GL_STATS_BYTES(glReadPixels, GLStatsPixelBytes(format, type, (long long)width * height));
+    }
+};
+
+// Deleting bound objects resets the binding to 0
+template <>
+struct GLStatsInspect<GLStats_glDeleteTextures> {
+    static void before(GLsizei n, const GLuint* textures)
+    {
+        for (GLsizei i = 0; i < n; i++)
+            for (unsigned int unit = 0; unit < GL_STATS_TEXTURE_UNITS; unit++)
+                for (unsigned int target = 0; target < GL_STATS_TEXTURE_TARGETS; target++)
+                    if (glStatsShadow.textures[unit][target] == textures[i])
+                        glStatsShadow.textures[unit][target] = 0;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glDeleteBuffers> {
+    static void before(GLsizei n, const GLuint* buffers)
+    {
+        for (GLsizei i = 0; i < n; i++)
+            for (unsigned int target = 0; target < GL_STATS_BUFFER_TARGETS; target++)
+                if (glStatsShadow.buffers[target] == buffers[i])
+                    glStatsShadow.buffers[target] = 0;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glDeleteVertexArrays> {
+    static void before(GLsizei n, const GLuint* arrays)
+    {
+        for (GLsizei i = 0; i < n; i++)
+            if (glStatsShadow.vertexArray == arrays[i])
+                glStatsShadow.vertexArray = 0;
+    }
+};
+
+template <>
+struct GLStatsInspect<GLStats_glDeleteFramebuffers> {
+    static void before(GLsizei n, const GLuint* framebuffers)
+    {
+        for (GLsizei i = 0; i < n; i++)
+        {
+            if (glStatsShadow.drawFramebuffer == framebuffers[i])
+                glStatsShadow.drawFramebuffer = 0;
+            if (glStatsShadow.readFramebuffer == framebuffers[i])
+                glStatsShadow.readFramebuffer = 0;
+        }
+    }
+};
+
+// The deleted program stays in use until another one is bound, nothing to reset
+
+#undef GL_STATS_REDUNDANT
+#undef GL_STATS_BYTES
+
+// Wrapper with the exact signature of the glad function pointer
+template <int Id, typename Fn>
+struct GLStatsHook;
+
+template <int Id, typename R, typename... Args>
+struct GLStatsHook<Id, R (APIENTRYP)(Args...)> {
+    static inline R (APIENTRYP real)(Args...) = nullptr;
+
+    static R APIENTRY call(Args... args)
+    {
+        glStatsCurrent.calls[Id]++;
+        GLStatsInspect<Id>::before(args...);
+        return real(args...);
+    }
+};
+
+void GLStatsInstall()
+{
+    if (glStatsInstalled)
+        return;
+
+    GLStatsResetShadow();
+    glStatsCurrent = {};
+
+    // entry points missing from the context (e.g. GL 4.3 functions) stay null
+#define GL_STATS_INSTALL(name) \
+    if (glad_##name) \
+    { \
+        GLStatsHook<GLStats_##name, decltype(glad_##name)>::real = glad_##name; \
+        glad_##name = &GLStatsHook<GLStats_##name, decltype(glad_##name)>::call; \
+    }
+    GL_STATS_ENTRY_POINTS(GL_STATS_INSTALL)
+#undef GL_STATS_INSTALL
+
+    glStatsInstalled = true;
+}
+
+void GLStatsUninstall()
+{
+    if (!glStatsInstalled)
+        return;
+
+#define GL_STATS_UNINSTALL(name) \
+    if (GLStatsHook<GLStats_##name, decltype(glad_##name)>::real) \
+        glad_##name = GLStatsHook<GLStats_##name, decltype(glad_##name)>::real;
+    GL_STATS_ENTRY_POINTS(GL_STATS_UNINSTALL)
+#undef GL_STATS_UNINSTALL
+
+    glStatsInstalled = false;
+    glStatsLastFrame = {};
+}
+
+// Call once per frame (GL thread), makes the finished frame available to the overlay
+void GLStatsEndFrame()
+{
+    if (!glStatsInstalled)
+        return;
+
+    glStatsLastFrame = glStatsCurrent;
+    glStatsCurrent = {};
+}
+
+const GLStatsCounters& GLStatsGetLastFrame()
+{
+    return glStatsLastFrame;
+}
+
+unsigned int GLStatsDrawCalls(const GLStatsCounters& counters)
+{
+    return counters.calls[GLStats_glDrawArrays] + counters.calls[GLStats_glDrawElements] +
+           counters.calls[GLStats_glDrawArraysInstanced] + counters.calls[GLStats_glDrawElementsInstanced] +
+           counters.calls[GLStats_glDrawElementsBaseVertex] + counters.calls[GLStats_glDrawElementsInstancedBaseVertex] +
+           counters.calls[GLStats_glMultiDrawArrays] +
+           counters.calls[GLStats_glMultiDrawElementsBaseVertex] + counters.calls[GLStats_glDrawElementsIndirect] +
+           counters.calls[GLStats_glMultiDrawElementsIndirect] + counters.calls[GLStats_glMultiDrawElementsIndirectCount] +
+           counters.calls[GLStats_glMultiDrawElementsIndirectCountARB];
+}
+
+// Summary line plus the most called entry points of the last frame,
+// same render state requirements as RenderText.
+// The overlay's own text is counted in the next frame.
+void RenderGLStatsOverlay(Shader &textShader, float x, float y, float scale, unsigned int maxEntries = 12)
+{
+    if (!glStatsInstalled)
+        return;
+
+    const GLStatsCounters& frame = glStatsLastFrame;
+    const float lineHeight = 48.0f * scale * 1.2f; // font is loaded with 48px height
+
+    unsigned long long uploadBytes = 0;
+    unsigned int totalCalls = 0, totalRedundant = 0;
+    for (unsigned int i = 0; i < GLStats_Count; i++)
+    {
+        uploadBytes += frame.bytes[i];
+        totalCalls += frame.calls[i];
+        totalRedundant += frame.redundant[i];
+    }
+
+    char line[128];
+    std::snprintf(line, sizeof(line), "GL calls %u  draws %u  redundant %u  uploads %.1f KB",
+                  totalCalls, GLStatsDrawCalls(frame), totalRedundant, uploadBytes / 1024.0);
+    RenderText(textShader, line, x, y, scale, glm::vec3(0.0f, 1.0f, 1.0f));
+    y -= lineHeight;
+
+    int order[GLStats_Count];
+    for (int i = 0; i < GLStats_Count; i++)
+        order[i] = i;
+    std::sort(order, order + GLStats_Count, [&frame](int a, int b) { return frame.calls[a] > frame.calls[b]; });
+
+    for (unsigned int i = 0; i < maxEntries && i < GLStats_Count; i++)
+    {
+        const int entry = order[i];
+        if (frame.calls[entry] == 0)
+            break;
+
+        int length = std::snprintf(line, sizeof(line), "%-28s %6u", GL_STATS_NAMES[entry], frame.calls[entry]);
+        if (frame.redundant[entry])
+            length += std::snprintf(line + length, sizeof(line) - length, "  %u redundant", frame.redundant[entry]);
+        if (frame.bytes[entry])
+            std::snprintf(line + length, sizeof(line) - length, "  %.1f KB", frame.bytes[entry] / 1024.0);
+
+        RenderText(textShader, line, x, y, scale, glm::vec3(1.0f, 1.0f, 1.0f));
+        y -= lineHeight;
+    }
+}
+
+#endif
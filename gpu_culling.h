@@ -0,0 +1,307 @@
+// GPU driven culling for meshes in the shared mesh arena (GL 4.3+)
+//
+// Transforms and bounds of every object live in a storage buffer. A compute
+// pass culls them against the frustum and against a depth pyramid built from
+// the previous frame, and writes the draw commands the GPU then consumes
+// directly, so the whole object list is a handful of API calls.
+// With GL 4.6 / ARB_indirect_parameters the visible commands are packed and
+// counted on the GPU, otherwise every object keeps its command and culled
+// ones draw 0 instances.
+//
+// The object index reaches the vertex shader through an instanced attribute
+// (location 4) offset by baseInstance, see 3d_PBR_indirect.glsl.
+
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "model.h"
+#include "geometry_arena.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+// std430 layout, matches Object in the shaders
+struct GPUCullObject {
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+    unsigned int indexCount;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int unused;
+};
+
+struct DrawElementsIndirectCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+const unsigned int GPU_CULLING_GROUP_SIZE = 64;  // local_size_x of cull_objects.glsl
+const unsigned int GPU_CULLING_OBJECT_ID_ATTRIBUTE = 4;
+
+inline bool GPUCullingSupported()
+{
+    return GLAD_GL_VERSION_4_3;
+}
+
+inline bool GPUCullingHasDrawCount()
+{
+    return GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_indirect_parameters;
+}
+
+// Adds one object per mesh of the model
+void GPUCullAppendModel(std::vector<GPUCullObject>& objects, Model& model, const glm::mat4& transform)
+{
+    const glm::mat4 normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(transform))));
+
+    for (size_t i = 0; i < model.getNumMeshes(); i++)
+    {
+        const GeometryRange& range = model.getMeshRange(i);
+        glm::vec3 boundsMin, boundsMax;
+        model.getMeshBounds(i, boundsMin, boundsMax);
+
+        GPUCullObject object;
+        object.model = transform;
+        object.normalMatrix = normalMatrix;
+        object.boundsMin = glm::vec4(boundsMin, 1.0f);
+        object.boundsMax = glm::vec4(boundsMax, 1.0f);
+        object.indexCount = range.indexCount;
+        object.firstIndex = range.firstIndex;
+        object.baseVertex = range.baseVertex;
+        object.unused = 0;
+        objects.push_back(object);
+    }
+}
+
+class GPUCuller
+{
+public:
+    bool occlusionCulling = true;
+
+    // Needs a GL 4.3 context, check GPUCullingSupported first
+    void init(int width, int height)
+    {
+        cullShader = std::make_unique<Shader>("shaders/compute/cull_objects.glsl");
+        hizCopyShader = std::make_unique<Shader>("shaders/compute/hiz_copy.glsl");
+        hizDownsampleShader = std::make_unique<Shader>("shaders/compute/hiz_downsample.glsl");
+
+        countBuffer = GLBuffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), nullptr, GL_DYNAMIC_DRAW);
+        countBuffer.track(GPUMemory_Buffers, sizeof(unsigned int));
+
+        resize(width, height);
+    }
+
+    // Matches the pyramid to the depth buffer it's built from, cheap when the size didn't change
+    void resize(int width, int height)
+    {
+        if (pyramid && width == pyramidWidth && height == pyramidHeight)
+            return;
+        if (width <= 0 || height <= 0)
+            return; // minimized
+
+        pyramidWidth = width;
+        pyramidHeight = height;
+        pyramidLevels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+
+        pyramid = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(pyramid, GPUMemory_RenderTargets, GL_R32F, width, height, 1, true);
+
+        pyramidValid = false;
+    }
+
+    // Uploads the object list, call again whenever it changes
+    void setObjects(const std::vector<GPUCullObject>& objects)
+    {
+        objectCount = static_cast<unsigned int>(objects.size());
+        if (objectCount == 0)
+            return;
+
+        objectBuffer = GLBuffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(GPUCullObject), objects.data(), GL_STATIC_DRAW);
+        objectBuffer.track(GPUMemory_Buffers, objects.size() * sizeof(GPUCullObject));
+
+        commandBuffer = GLBuffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+        commandBuffer.track(GPUMemory_Buffers, objects.size() * sizeof(DrawElementsIndirectCommand));
+
+        // object index per instance, baseInstance selects the element
+        std::vector<unsigned int> ids(objectCount);
+        for (unsigned int i = 0; i < objectCount; i++)
+            ids[i] = i;
+
+        idBuffer = GLBuffer::create();
+        glBindBuffer(GL_ARRAY_BUFFER, idBuffer);
+        glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(unsigned int), ids.data(), GL_STATIC_DRAW);
+        idBuffer.track(GPUMemory_Buffers, ids.size() * sizeof(unsigned int));
+
+        // other draws from the arena read element 0 and ignore it
+        GetGeometryArena(VertexLayout_Mesh).bind();
+        glEnableVertexAttribArray(GPU_CULLING_OBJECT_ID_ATTRIBUTE);
+        glVertexAttribIPointer(GPU_CULLING_OBJECT_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+        glVertexAttribDivisor(GPU_CULLING_OBJECT_ID_ATTRIBUTE, 1);
+        glBindVertexArray(0);
+    }
+
+    // Writes this frame's draw commands, uses texture unit 0
+    void cull(const glm::mat4& viewProjection)
+    {
+        if (objectCount == 0)
+            return;
+
+        TRACE_GPU_SCOPE("GPU culling");
+
+        const bool compact = GPUCullingHasDrawCount();
+        if (compact)
+        {
+            const unsigned int zero = 0;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(unsigned int), &zero);
+        }
+
+        glm::vec4 planes[6];
+        extractFrustumPlanes(viewProjection, planes);
+
+        cullShader->use();
+        cullShader->setInt("objectCount", static_cast<int>(objectCount));
+        for (int i = 0; i < 6; i++)
+            cullShader->setVec4("frustumPlanes[" + std::to_string(i) + "]", planes[i]);
+        cullShader->setBool("occlusionCulling", occlusionCulling && pyramidValid);
+        cullShader->setMat4("pyramidViewProjection", pyramidViewProjection);
+        cullShader->setInt("pyramidLevels", pyramidLevels);
+        cullShader->setBool("compact", compact);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, countBuffer);
+
+        glDispatchCompute((objectCount + GPU_CULLING_GROUP_SIZE - 1) / GPU_CULLING_GROUP_SIZE, 1, 1);
+
+        // the commands and the count are read by the indirect draw
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // Draws the visible objects, the caller binds a shader reading the object buffer
+    void draw()
+    {
+        if (objectCount == 0)
+            return;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer);
+        GetGeometryArena(VertexLayout_Mesh).bind();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+        if (GPUCullingHasDrawCount())
+        {
+            glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+            if (GLAD_GL_VERSION_4_6)
+                glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, 0, objectCount, 0);
+            else
+                glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, 0, objectCount, 0);
+        }
+        else
+        {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, objectCount, 0);
+        }
+    }
+
+    // Rebuilds the depth pyramid from the finished depth buffer, used by the next cull
+    void buildDepthPyramid(unsigned int depthTexture, const glm::mat4& viewProjection)
+    {
+        TRACE_GPU_SCOPE("Depth pyramid");
+
+        glActiveTexture(GL_TEXTURE0);
+
+        hizCopyShader->use();
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glBindImageTexture(0, pyramid, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((pyramidWidth + 7) / 8, (pyramidHeight + 7) / 8, 1);
+
+        hizDownsampleShader->use();
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        int width = pyramidWidth, height = pyramidHeight;
+        for (int level = 1; level < pyramidLevels; level++)
+        {
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+            hizDownsampleShader->setInt("srcLevel", level - 1);
+            glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        pyramidViewProjection = viewProjection;
+        pyramidValid = true;
+    }
+
+    unsigned int getObjectCount() const
+    {
+        return objectCount;
+    }
+
+private:
+    std::unique_ptr<Shader> cullShader;
+    std::unique_ptr<Shader> hizCopyShader;
+    std::unique_ptr<Shader> hizDownsampleShader;
+
+    GLBuffer objectBuffer;
+    GLBuffer commandBuffer;
+    GLBuffer countBuffer;
+    GLBuffer idBuffer;
+    unsigned int objectCount = 0;
+
+    GLTexture pyramid;
+    int pyramidWidth = 0;
+    int pyramidHeight = 0;
+    int pyramidLevels = 0;
+    glm::mat4 pyramidViewProjection = glm::mat4(1.0f);
+    bool pyramidValid = false;
+
+    // Gribb/Hartmann, normals point inside the frustum
+    static void extractFrustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+    {
+        const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[0] = row3 + row0; // left
+        planes[1] = row3 - row0; // right
+        planes[2] = row3 + row1; // bottom
+        planes[3] = row3 - row1; // top
+        planes[4] = row3 + row2; // near
+        planes[5] = row3 - row2; // far
+
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+};
+
+#endif
@@ -0,0 +1,659 @@
+// Radiance HDR and OpenEXR images read one row at a time, no GL context needed
+//
+// HDRImageReader decodes .hdr (RGBE, flat or RLE scanlines) and scanline
+// .exr files (half or float channels, uncompressed, RLE, ZIPS or ZIP) a row
+// or an EXR chunk at a time, so a caller can pack and upload every row
+// without the whole float image ever being in memory. Other files go
+// through stb_image, which loads them whole.
+// Rows come in file order, each with its row index counted from the bottom
+// like the engine's flipped images (row 0 is the last row of the file).
+//
+// PackRGB9E5 and PackR11G11B10F convert to the packed 32 bit HDR formats,
+// following the rounding of EXT_texture_shared_exponent and
+// EXT_packed_float. Both cover the range of half floats.
+
+#ifndef HDR_IMAGE_H
+#define HDR_IMAGE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <cmath>
+
+#include <stb/image_load.cpp>
+
+
+const float HDR_PACKED_MAX = 65408.0f; // largest RGB9_E5 value, R11G11B10F goes to 65024
+
+// Non negative float to an unsigned float with 5 exponent bits and mantissaBits
+// of mantissa, rounded to nearest and clamped to the largest finite value
+inline uint32_t PackUnsignedFloat(float value, int mantissaBits)
+{
+    if (!(value > 0.0f)) // negative and NaN
+        return 0;
+
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    const uint32_t maxEncoded = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+    if (exponent >= 31)
+        return maxEncoded; // too large and infinity
+
+    // denormal, in units of 2^-14 / 2^mantissaBits; rounding up to the smallest normal encodes right
+    if (exponent <= 0)
+        return (uint32_t)std::floor(std::ldexp(value, 14 + mantissaBits) + 0.5f);
+
+    const int shift = 23 - mantissaBits;
+    uint32_t mantissa = ((bits & 0x7FFFFF) + (1u << (shift - 1))) >> shift;
+    if (mantissa == (1u << mantissaBits))
+    {
+        mantissa = 0;
+        exponent++;
+        if (exponent >= 31)
+            return maxEncoded;
+    }
+    return ((uint32_t)exponent << mantissaBits) | mantissa;
+}
+
+// GL_R11F_G11F_B10F texel, GL_UNSIGNED_INT_10F_11F_11F_REV layout
+inline uint32_t PackR11G11B10F(float r, float g, float b)
+{
+    return PackUnsignedFloat(r, 6) | (PackUnsignedFloat(g, 6) << 11) | (PackUnsignedFloat(b, 5) << 22);
+}
+
+// GL_RGB9_E5 texel, GL_UNSIGNED_INT_5_9_9_9_REV layout
+inline uint32_t PackRGB9E5(float r, float g, float b)
+{
+    const int N = 9, B = 15;
+    r = r > 0.0f ? std::min(r, HDR_PACKED_MAX) : 0.0f; // also flushes NaN
+    g = g > 0.0f ? std::min(g, HDR_PACKED_MAX) : 0.0f;
+    b = b > 0.0f ? std::min(b, HDR_PACKED_MAX) : 0.0f;
+    const float maxComponent = std::max(r, std::max(g, b));
+    if (maxComponent < std::ldexp(1.0f, -B - N))
+        return 0;
+
+    int exponent;
+    std::frexp(maxComponent, &exponent); // maxComponent = [0.5, 1) * 2^exponent
+    int shared = std::max(-B - 1, exponent - 1) + 1 + B;
+    if ((int)std::floor(std::ldexp(maxComponent, -(shared - B - N)) + 0.5f) == (1 << N))
+        shared++;
+
+    const uint32_t rs = (uint32_t)std::floor(std::ldexp(r, -(shared - B - N)) + 0.5f);
+    const uint32_t gs = (uint32_t)std::floor(std::ldexp(g, -(shared - B - N)) + 0.5f);
+    const uint32_t bs = (uint32_t)std::floor(std::ldexp(b, -(shared - B - N)) + 0.5f);
+    return rs | (gs << 9) | (bs << 18) | ((uint32_t)shared << 27);
+}
+
+inline float HalfToFloat(uint16_t half)
+{
+    const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    const int exponent = (half >> 10) & 0x1F;
+    const uint32_t mantissa = half & 0x3FF;
+
+    float value;
+    if (exponent == 0)
+        value = std::ldexp((float)mantissa, -24);
+    else if (exponent == 31)
+        value = mantissa ? NAN : INFINITY;
+    else
+        value = std::ldexp((float)(mantissa | 0x400), exponent - 25);
+
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+    std::memcpy(&value, &bits, sizeof(bits));
+    return value;
+}
+
+
+class HDRImageReader
+{
+public:
+    // By extension: .hdr, .exr, anything else through stb_image
+    bool open(const std::string& path)
+    {
+        close();
+        filePath = path;
+
+        std::string extension = path.substr(std::min(path.find_last_of('.'), path.size()));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        bool opened;
+        if (extension == ".hdr" || extension == ".pic")
+            opened = openRadiance();
+        else if (extension == ".exr")
+            opened = openEXR();
+        else
+            opened = openSTB();
+
+        if (!opened)
+            close();
+        return opened;
+    }
+
+    void close()
+    {
+        file.close();
+        file.clear();
+        format = Format_None;
+        width = height = 0;
+        rowsRead = 0;
+        stbData.clear();
+        chunkRows.clear();
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // Next row of width * 3 floats, y is its row counted from the bottom
+    bool readRow(float* rgb, int& y)
+    {
+        if (rowsRead >= height)
+            return false;
+
+        bool read = false;
+        if (format == Format_Radiance)
+            read = readRadianceRow(rgb, y);
+        else if (format == Format_EXR)
+            read = readEXRRow(rgb, y);
+        else if (format == Format_STB)
+        {
+            y = rowsRead; // stb already flipped it
+            std::memcpy(rgb, &stbData[(size_t)y * width * 3], (size_t)width * 3 * sizeof(float));
+            read = true;
+        }
+
+        if (!read)
+        {
+            std::cout << "ERROR::HDR_IMAGE::CORRUPT_ROW " << rowsRead << ": " << filePath << std::endl;
+            close();
+            return false;
+        }
+        rowsRead++;
+        return true;
+    }
+
+private:
+    enum Format { Format_None, Format_Radiance, Format_EXR, Format_STB };
+
+    struct EXRChannel {
+        std::string name;
+        int pixelType;      // 0 uint, 1 half, 2 float
+        int target;         // 0-2 rgb, 3 every one (luminance), -1 skipped
+    };
+
+    Format format = Format_None;
+    std::string filePath;
+    std::ifstream file;
+    int width = 0;
+    int height = 0;
+    int rowsRead = 0;
+
+    // buffered input, the decoders read byte by byte
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(1 << 16);
+    size_t bufferPos = 0;
+    size_t bufferEnd = 0;
+
+    // Radiance
+    bool radianceBottomUp = false;
+    std::vector<uint8_t> rgbe;
+
+    // OpenEXR
+    std::vector<EXRChannel> channels;
+    int compression = 0;
+    int linesPerChunk = 1;
+    int minY = 0;
+    std::vector<uint64_t> chunkOffsets;
+    std::vector<uint8_t> chunkData;
+    std::vector<uint8_t> chunkRows;   // decompressed chunk
+    int chunkFirstRow = 0;
+    int chunkRowCount = 0;
+    size_t rowBytes = 0;
+
+    // stb_image
+    std::vector<float> stbData;
+
+    int get()
+    {
+        if (bufferPos == bufferEnd)
+        {
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            bufferEnd = (size_t)file.gcount();
+            bufferPos = 0;
+            if (bufferEnd == 0)
+                return -1;
+        }
+        return buffer[bufferPos++];
+    }
+
+    bool read(void* data, size_t size)
+    {
+        uint8_t* out = static_cast<uint8_t*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            const int c = get();
+            if (c < 0)
+                return false;
+            out[i] = (uint8_t)c;
+        }
+        return true;
+    }
+
+    bool readLine(std::string& line)
+    {
+        line.clear();
+        for (int c = get(); c != '\n'; c = get())
+        {
+            if (c < 0)
+                return !line.empty();
+            line += (char)c;
+        }
+        return true;
+    }
+
+    bool openFile()
+    {
+        file.open(filePath, std::ios::binary);
+        bufferPos = bufferEnd = 0;
+        if (!file)
+        {
+            std::cout << "ERROR::HDR_IMAGE::FILE_NOT_FOUND: " << filePath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Radiance RGBE
+    // -------------
+    bool openRadiance()
+    {
+        if (!openFile())
+            return false;
+
+        std::string line;
+        if (!readLine(line) || (line.rfind("#?RADIANCE", 0) != 0 && line.rfind("#?RGBE", 0) != 0))
+        {
+            std::cout << "ERROR::HDR_IMAGE::NOT_A_RADIANCE_FILE: " << filePath << std::endl;
+            return false;
+        }
+        while (readLine(line) && !line.empty())
+        {
+            if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            {
+                std::cout << "ERROR::HDR_IMAGE::UNSUPPORTED_FORMAT " << line << ": " << filePath << std::endl;
+                return false;
+            }
+        }
+
+        // only the unrotated orientations, rows of +X pixels
+        char ySign, yAxis, xSign, xAxis;
+        if (!readLine(line) || std::sscanf(line.c_str(), "%c%c %d %c%c %d", &ySign, &yAxis, &height, &xSign, &xAxis, &width) != 6
+            || yAxis != 'Y' || xAxis != 'X' || xSign != '+' || width <= 0 || height <= 0)
+        {
+            std::cout << "ERROR::HDR_IMAGE::UNSUPPORTED_ORIENTATION " << line << ": " << filePath << std::endl;
+            return false;
+        }
+        radianceBottomUp = ySign == '+';
+
+        rgbe.resize((size_t)width * 4);
+        format = Format_Radiance;
+        return true;
+    }
+
+    bool readRadianceRow(float* rgb, int& y)
+    {
+        y = radianceBottomUp ? rowsRead : height - 1 - rowsRead;
+
+        uint8_t start[4];
+        if (!read(start, 4))
+            return false;
+
+        if (width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 && !(start[2] & 0x80))
+        {
+            // new RLE: the 4 components one after the other, each in runs
+            if (((int)start[2] << 8 | start[3]) != width)
+                return false;
+            for (int component = 0; component < 4; component++)
+            {
+                int x = 0;
+                while (x < width)
+                {
+                    int count = get();
+                    if (count < 0)
+                        return false;
+                    if (count > 128)
+                    {
+                        count -= 128;
+                        const int value = get();
+                        if (value < 0 || x + count > width)
+                            return false;
+                        for (; count > 0; count--)
+                            rgbe[(size_t)x++ * 4 + component] = (uint8_t)value;
+                    }
+                    else
+                    {
+                        if (count == 0 || x + count > width)
+                            return false;
+                        for (; count > 0; count--)
+                        {
+                            const int value = get();
+                            if (value < 0)
+                                return false;
+                            rgbe[(size_t)x++ * 4 + component] = (uint8_t)value;
+                        }
+                    }
+                }
+            }
+        }
+        else
+        {
+            // flat pixels, where 1,1,1,n repeats the previous pixel (n shifted by 8 per repeat marker)
+            int x = 0, shift = 0;
+            uint8_t pixel[4] = { start[0], start[1], start[2], start[3] };
+            while (true)
+            {
+                if (pixel[0] == 1 && pixel[1] == 1 && pixel[2] == 1 && x > 0)
+                {
+                    const int count = pixel[3] << shift;
+                    if (x + count > width)
+                        return false;
+                    for (int i = 0; i < count; i++, x++)
+                        std::memcpy(&rgbe[(size_t)x * 4], &rgbe[(size_t)(x - 1) * 4], 4);
+                    shift += 8;
+                }
+                else
+                {
+                    std::memcpy(&rgbe[(size_t)x++ * 4], pixel, 4);
+                    shift = 0;
+                }
+                if (x >= width)
+                    break;
+                if (!read(pixel, 4))
+                    return false;
+            }
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            const uint8_t* texel = &rgbe[(size_t)x * 4];
+            const float scale = texel[3] ? std::ldexp(1.0f, (int)texel[3] - 136) : 0.0f;
+            rgb[x * 3 + 0] = texel[0] * scale;
+            rgb[x * 3 + 1] = texel[1] * scale;
+            rgb[x * 3 + 2] = texel[2] * scale;
+        }
+        return true;
+    }
+
+    // OpenEXR
+    // -------
+    bool openEXR()
+    {
+        if (!openFile())
+            return false;
+
+        uint32_t magic = 0, version = 0;
+        if (!read(&magic, 4) || !read(&version, 4) || magic != 20000630)
+        {
+            std::cout << "ERROR::HDR_IMAGE::NOT_AN_EXR_FILE: " << filePath << std::endl;
+            return false;
+        }
+        if (version & (0x200 | 0x800 | 0x1000))
+        {
+            std::cout << "ERROR::HDR_IMAGE::UNSUPPORTED_EXR (tiled, multipart or deep): " << filePath << std::endl;
+            return false;
+        }
+
+        int32_t window[4] = { 0, 0, -1, -1 };
+        channels.clear();
+        compression = -1;
+        while (true)
+        {
+            std::string name, type;
+            if (!readString(name))
+                return false;
+            if (name.empty())
+                break; // end of the header
+            int32_t size = 0;
+            if (!readString(type) || !read(&size, 4) || size < 0)
+                return false;
+
+            std::vector<uint8_t> value((size_t)size);
+            if (!read(value.data(), value.size()))
+                return false;
+
+            if (name == "channels" && type == "chlist")
+            {
+                if (!parseChannels(value))
+                    return false;
+            }
+            else if (name == "compression" && size == 1)
+                compression = value[0];
+            else if (name == "dataWindow" && size == 16)
+                std::memcpy(window, value.data(), 16);
+        }
+
+        width = window[2] - window[0] + 1;
+        height = window[3] - window[1] + 1;
+        minY = window[1];
+        if (width <= 0 || height <= 0 || channels.empty())
+        {
+            std::cout << "ERROR::HDR_IMAGE::EXR_HEADER_INCOMPLETE: " << filePath << std::endl;
+            return false;
+        }
+
+        // 0 none, 1 RLE, 2 ZIPS, 3 ZIP; PIZ, PXR24, B44 and DWA aren't supported
+        if (compression < 0 || compression > 3)
+        {
+            std::cout << "ERROR::HDR_IMAGE::UNSUPPORTED_EXR_COMPRESSION " << compression << ": " << filePath << std::endl;
+            return false;
+        }
+        linesPerChunk = compression == 3 ? 16 : 1;
+
+        rowBytes = 0;
+        for (const EXRChannel& channel : channels)
+            rowBytes += (size_t)width * (channel.pixelType == 1 ? 2 : 4);
+
+        chunkOffsets.resize((height + linesPerChunk - 1) / linesPerChunk);
+        if (!read(chunkOffsets.data(), chunkOffsets.size() * sizeof(uint64_t)))
+            return false;
+
+        chunkRowCount = 0;
+        format = Format_EXR;
+        return true;
+    }
+
+    bool readString(std::string& value)
+    {
+        value.clear();
+        for (int c = get(); c != 0; c = get())
+        {
+            if (c < 0 || value.size() > 255)
+                return false;
+            value += (char)c;
+        }
+        return true;
+    }
+
+    // sorted by name in the file, which is also the order of the pixel data
+    bool parseChannels(const std::vector<uint8_t>& list)
+    {
+        bool hasRGB = false;
+        size_t pos = 0;
+        while (pos < list.size() && list[pos] != 0)
+        {
+            EXRChannel channel;
+            while (pos < list.size() && list[pos] != 0)
+                channel.name += (char)list[pos++];
+            pos++;
+            if (pos + 16 > list.size())
+                return false;
+
+            int32_t sampling[2];
+            std::memcpy(&channel.pixelType, &list[pos], 4);
+            std::memcpy(sampling, &list[pos + 8], 8);
+            pos += 16;
+            if (sampling[0] != 1 || sampling[1] != 1 || channel.pixelType < 0 || channel.pixelType > 2)
+            {
+                std::cout << "ERROR::HDR_IMAGE::UNSUPPORTED_EXR_CHANNEL " << channel.name << ": " << filePath << std::endl;
+                return false;
+            }
+
+            channel.target = channel.name == "R" ? 0 : channel.name == "G" ? 1 : channel.name == "B" ? 2 : channel.name == "Y" ? 3 : -1;
+            hasRGB = hasRGB || (channel.target >= 0 && channel.target < 3);
+            channels.push_back(channel);
+        }
+
+        // luminance only images are grey, with colour the Y channel isn't used
+        for (EXRChannel& channel : channels)
+        {
+            if (hasRGB && channel.target == 3)
+                channel.target = -1;
+        }
+        return true;
+    }
+
+    bool readEXRRow(float* rgb, int& y)
+    {
+        // rows come top to bottom, one chunk at a time
+        const int row = rowsRead;
+        if (row >= chunkFirstRow + chunkRowCount || row < chunkFirstRow)
+        {
+            if (!readChunk(row / linesPerChunk))
+                return false;
+        }
+        y = height - 1 - row;
+
+        std::fill(rgb, rgb + (size_t)width * 3, 0.0f);
+        const uint8_t* data = &chunkRows[(size_t)(row - chunkFirstRow) * rowBytes];
+        for (const EXRChannel& channel : channels)
+        {
+            const size_t texelBytes = channel.pixelType == 1 ? 2 : 4;
+            if (channel.target >= 0)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    float value;
+                    if (channel.pixelType == 1)
+                    {
+                        uint16_t half;
+                        std::memcpy(&half, data + x * texelBytes, 2);
+                        value = HalfToFloat(half);
+                    }
+                    else if (channel.pixelType == 2)
+                        std::memcpy(&value, data + x * texelBytes, 4);
+                    else
+                    {
+                        uint32_t integer;
+                        std::memcpy(&integer, data + x * texelBytes, 4);
+                        value = (float)integer;
+                    }
+
+                    if (channel.target == 3)
+                        rgb[x * 3 + 0] = rgb[x * 3 + 1] = rgb[x * 3 + 2] = value;
+                    else
+                        rgb[x * 3 + channel.target] = value;
+                }
+            }
+            data += width * texelBytes;
+        }
+        return true;
+    }
+
+    bool readChunk(int chunk)
+    {
+        file.clear();
+        file.seekg((std::streamoff)chunkOffsets[chunk]);
+        bufferPos = bufferEnd = 0;
+
+        int32_t chunkY = 0, packedSize = 0;
+        if (!read(&chunkY, 4) || !read(&packedSize, 4) || packedSize < 0 || chunkY != minY + chunk * linesPerChunk)
+            return false;
+
+        chunkFirstRow = chunk * linesPerChunk;
+        chunkRowCount = std::min(linesPerChunk, height - chunkFirstRow);
+        const size_t unpackedSize = rowBytes * chunkRowCount;
+        chunkRows.resize(unpackedSize);
+
+        // chunks that didn't get smaller are stored as they are
+        if ((size_t)packedSize == unpackedSize || compression == 0)
+            return (size_t)packedSize == unpackedSize && read(chunkRows.data(), unpackedSize);
+
+        chunkData.resize((size_t)packedSize);
+        if (!read(chunkData.data(), chunkData.size()))
+            return false;
+
+        std::vector<uint8_t> predicted(unpackedSize);
+        if (compression == 1)
+        {
+            if (!decodeEXRRLE(chunkData, predicted))
+                return false;
+        }
+        else
+        {
+            const int decoded = stbi_zlib_decode_buffer(reinterpret_cast<char*>(predicted.data()), (int)unpackedSize,
+                                                        reinterpret_cast<const char*>(chunkData.data()), packedSize);
+            if (decoded != (int)unpackedSize)
+                return false;
+        }
+
+        // undo the byte delta, then interleave the two halves back
+        for (size_t i = 1; i < unpackedSize; i++)
+            predicted[i] = (uint8_t)(predicted[i - 1] + predicted[i] - 128);
+        const size_t half = (unpackedSize + 1) / 2;
+        for (size_t i = 0; i < unpackedSize; i++)
+            chunkRows[i] = (i & 1) ? predicted[half + i / 2] : predicted[i / 2];
+        return true;
+    }
+
+    static bool decodeEXRRLE(const std::vector<uint8_t>& in, std::vector<uint8_t>& out)
+    {
+        size_t inPos = 0, outPos = 0;
+        while (inPos < in.size())
+        {
+            const int count = (int8_t)in[inPos++];
+            if (count < 0)
+            {
+                if (inPos + -count > in.size() || outPos + -count > out.size())
+                    return false;
+                std::memcpy(&out[outPos], &in[inPos], -count);
+                inPos += -count;
+                outPos += -count;
+            }
+            else
+            {
+                if (inPos >= in.size() || outPos + count + 1 > out.size())
+                    return false;
+                std::memset(&out[outPos], in[inPos++], count + 1);
+                outPos += count + 1;
+            }
+        }
+        return outPos == out.size();
+    }
+
+    // Everything else
+    // ---------------
+    bool openSTB()
+    {
+        stbi_set_flip_vertically_on_load(true); // like the engine, row 0 is the bottom
+        int components;
+        float* data = stbi_loadf(filePath.c_str(), &width, &height, &components, 3);
+        if (!data)
+        {
+            std::cout << "ERROR::HDR_IMAGE::IMAGE_NOT_LOADED: " << filePath << std::endl;
+            return false;
+        }
+        stbData.assign(data, data + (size_t)width * height * 3);
+        stbi_image_free(data);
+        format = Format_STB;
+        return true;
+    }
+};
+
+#endif
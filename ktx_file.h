@@ -0,0 +1,181 @@
+// KTX 1.1 container reading and writing, no GL context needed
+//
+// KTX stores exactly what glTexImage2D takes: the GL type, format and
+// internal format in the header, then every mip level with its faces, rows
+// padded to 4 bytes (GL_UNPACK_ALIGNMENT's default). Images are kept in that
+// layout in memory, so a loader hands them to GL as they are. Only little
+// endian files without array layers or depth are supported, which is what
+// the offline bakers write.
+
+#ifndef KTX_FILE_H
+#define KTX_FILE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+
+// GL enums used by the bakers, same values as in glad
+const uint32_t KTX_GL_HALF_FLOAT = 0x140B;
+const uint32_t KTX_GL_FLOAT = 0x1406;
+const uint32_t KTX_GL_RG = 0x8227;
+const uint32_t KTX_GL_RGB = 0x1907;
+const uint32_t KTX_GL_RGBA = 0x1908;
+const uint32_t KTX_GL_RG16F = 0x822F;
+const uint32_t KTX_GL_RGB16F = 0x881B;
+const uint32_t KTX_GL_RGBA16F = 0x881A;
+
+const uint8_t KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct KTXImage {
+    uint32_t glType = 0;
+    uint32_t glTypeSize = 0;        // 1 for compressed or packed formats
+    uint32_t glFormat = 0;
+    uint32_t glInternalFormat = 0;
+    uint32_t glBaseInternalFormat = 0;
+    uint32_t bytesPerPixel = 0;     // not stored, derived from type and format
+    int width = 0;
+    int height = 0;
+    int faces = 1;                  // 6 for cubemaps
+    int levels = 1;
+    std::vector<std::vector<uint8_t>> images; // levels * faces, face order of GL cubemaps
+
+    std::vector<uint8_t>& image(int level, int face) { return images[level * faces + face]; }
+    const std::vector<uint8_t>& image(int level, int face) const { return images[level * faces + face]; }
+
+    int levelWidth(int level) const { return width >> level > 0 ? width >> level : 1; }
+    int levelHeight(int level) const { return height >> level > 0 ? height >> level : 1; }
+};
+
+// Bytes of one row in the file and in memory
+inline size_t KTXRowPitch(int width, uint32_t bytesPerPixel)
+{
+    return ((size_t)width * bytesPerPixel + 3) & ~(size_t)3;
+}
+
+inline uint32_t KTXBytesPerPixel(uint32_t glType, uint32_t glFormat)
+{
+    const uint32_t component = glType == KTX_GL_FLOAT ? 4 : glType == KTX_GL_HALF_FLOAT ? 2 : 1;
+    const uint32_t components = glFormat == KTX_GL_RGBA ? 4 : glFormat == KTX_GL_RGB ? 3 : glFormat == KTX_GL_RG ? 2 : 1;
+    return component * components;
+}
+
+// Sets the header up and allocates every image, levels = 0 for a full chain
+inline void KTXAllocate(KTXImage& ktx, uint32_t glType, uint32_t glFormat, uint32_t glInternalFormat,
+                        int width, int height, int faces, int levels)
+{
+    ktx.glType = glType;
+    ktx.glTypeSize = glType == KTX_GL_FLOAT ? 4 : glType == KTX_GL_HALF_FLOAT ? 2 : 1;
+    ktx.glFormat = glFormat;
+    ktx.glInternalFormat = glInternalFormat;
+    ktx.glBaseInternalFormat = glFormat;
+    ktx.bytesPerPixel = KTXBytesPerPixel(glType, glFormat);
+    ktx.width = width;
+    ktx.height = height;
+    ktx.faces = faces;
+
+    if (levels <= 0)
+    {
+        levels = 1;
+        while ((width >> levels) > 0 || (height >> levels) > 0)
+            levels++;
+    }
+    ktx.levels = levels;
+
+    ktx.images.assign((size_t)levels * faces, std::vector<uint8_t>());
+    for (int level = 0; level < levels; level++)
+        for (int face = 0; face < faces; face++)
+            ktx.image(level, face).assign(KTXRowPitch(ktx.levelWidth(level), ktx.bytesPerPixel) * ktx.levelHeight(level), 0);
+}
+
+inline bool WriteKTX(const std::string& path, const KTXImage& ktx)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "ERROR::KTX::FILE_NOT_WRITTEN: " << path << std::endl;
+        return false;
+    }
+
+    const uint32_t header[13] = {
+        0x04030201, ktx.glType, ktx.glTypeSize, ktx.glFormat, ktx.glInternalFormat, ktx.glBaseInternalFormat,
+        (uint32_t)ktx.width, (uint32_t)ktx.height, 0, 0, (uint32_t)ktx.faces, (uint32_t)ktx.levels, 0
+    };
+    file.write(reinterpret_cast<const char*>(KTX_IDENTIFIER), sizeof(KTX_IDENTIFIER));
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    // image sizes are multiples of 4, so no cube or mip padding is needed
+    for (int level = 0; level < ktx.levels; level++)
+    {
+        const uint32_t imageSize = (uint32_t)ktx.image(level, 0).size();
+        file.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+        for (int face = 0; face < ktx.faces; face++)
+            file.write(reinterpret_cast<const char*>(ktx.image(level, face).data()), imageSize);
+    }
+
+    if (!file)
+    {
+        std::cout << "ERROR::KTX::FILE_NOT_WRITTEN: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool ReadKTX(const std::string& path, KTXImage& ktx)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "ERROR::KTX::FILE_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+
+    uint8_t identifier[12];
+    uint32_t header[13];
+    file.read(reinterpret_cast<char*>(identifier), sizeof(identifier));
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file || std::memcmp(identifier, KTX_IDENTIFIER, sizeof(identifier)) != 0 || header[0] != 0x04030201)
+    {
+        std::cout << "ERROR::KTX::UNSUPPORTED_FILE: " << path << std::endl;
+        return false;
+    }
+    if (header[8] > 1 || header[9] != 0 || header[1] == 0)
+    {
+        std::cout << "ERROR::KTX::UNSUPPORTED_LAYOUT (arrays, 3D or compressed): " << path << std::endl;
+        return false;
+    }
+
+    KTXAllocate(ktx, header[1], header[3], header[4], (int)header[6], (int)header[7],
+                header[10] ? (int)header[10] : 1, header[11] ? (int)header[11] : 1);
+    ktx.glTypeSize = header[2];
+    ktx.glBaseInternalFormat = header[5];
+    file.seekg(header[12], std::ios::cur); // key/value data
+
+    for (int level = 0; level < ktx.levels; level++)
+    {
+        uint32_t imageSize = 0;
+        file.read(reinterpret_cast<char*>(&imageSize), sizeof(imageSize));
+        for (int face = 0; face < ktx.faces; face++)
+        {
+            std::vector<uint8_t>& image = ktx.image(level, face);
+            if (imageSize != image.size())
+            {
+                std::cout << "ERROR::KTX::IMAGE_SIZE_MISMATCH: " << path << std::endl;
+                return false;
+            }
+            file.read(reinterpret_cast<char*>(image.data()), imageSize);
+        }
+    }
+
+    if (!file)
+    {
+        std::cout << "ERROR::KTX::FILE_TRUNCATED: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
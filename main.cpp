@@ -1,6 +1,7 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <limits>
 
 #include <glad/glad.h> // Glad sa importuje pred glfw
 #include <GLFW/glfw3.h>
@@ -18,11 +19,25 @@
 #include "PBR_setup.h"
 #include "debugging.h"
 #include "text_rendering.h"
+#include "profiler.h"
+#include "gl_stats.h"
+#include "gpu_culling.h"
+#include "material_system.h"
+#include "texture_streaming.h"
+#include "cascaded_shadows.h"
+#include "shadow_atlas.h"
+#include "ssao.h"
+#include "bloom.h"
+#include "reflection_probe.h"
+#include "probe_grid.h"
+#include "render_graph.h"
+#include "thread_pool.h"
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height); // Update viewportu
 void mouse_callback(GLFWwindow* window, double xpos, double ypos); // cursor movement tracking
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset); // scrolling tracking
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods); // single key presses
 void processInput(GLFWwindow* window);
 
 
@@ -43,17 +58,20 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
+bool showGPUMemory = false;
+bool useGPUCulling = true; // only when the context supports it
+
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
 
 
 int main()
 {
+    TraceSetThreadName("Main");
+
     // Inicializacia glfw
     // ------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     // Give buffer pixels more sample points for MSAA
@@ -61,7 +79,17 @@ int main()
 
     // Vytvorenie okna
     // ---------------
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Serus", NULL, NULL);
+    // newest context available, 4.3+ enables the compute paths, 3.3 is the minimum
+    const int CONTEXT_VERSIONS[][2] = { {4, 6}, {4, 5}, {4, 3}, {3, 3} };
+    GLFWwindow* window = NULL;
+    for (const auto& version : CONTEXT_VERSIONS)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Serus", NULL, NULL);
+        if (window != NULL)
+            break;
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -79,6 +107,9 @@ int main()
     // setting the function for scrolling tracking
     glfwSetScrollCallback(window, scroll_callback);
 
+    // setting the function for toggle keys
+    glfwSetKeyCallback(window, key_callback);
+
     // Enable cursor capturing + hide it
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -90,9 +121,15 @@ int main()
         return -1;
     }
 
+    // per frame data (text quads...) is streamed through one ring buffer
+    FrameStream.init();
+
     // just testing
     loadFont("fonts/arial.ttf");
 
+    // GPU timer queries for the profiler overlay (F1 to toggle)
+    Profiler.init();
+
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
 
@@ -120,14 +157,18 @@ int main()
     // Load shader porgrams
     // --------------------
     Shader gPassPBRShader("shaders/vertex/lighting/3d_PBR.glsl", "shaders/fragment/deferred/PBR/g_passPBR.glsl");
+    Shader gPassPBRArrayShader("shaders/vertex/lighting/3d_PBR_instanced.glsl", "shaders/fragment/deferred/PBR/g_passPBR_array.glsl");
     Shader lPassPBRShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/PBR/l_passtex_IBL.glsl");
 
     Shader skyboxShader("shaders/vertex/cubemap.glsl", "shaders/fragment/cubemap/skyboxhrd.glsl");
 
     Shader equirectangularShader("shaders/vertex/equirectangular.glsl", "shaders/fragment/equirectangular.glsl");
-    Shader irradianceShader("shaders/vertex/equirectangular.glsl", "shaders/fragment/cubemap/cubemap_convolute.glsl");
     Shader prefilterShader("shaders/vertex/equirectangular.glsl", "shaders/fragment/cubemap/cubemap_prefilterconv.glsl");
 
+    Shader probeMarkerShader("shaders/vertex/3d.glsl", "shaders/fragment/ucol.glsl");
+
+    Shader shadowDepthShader("shaders/vertex/lighting/simple_depth.glsl", "shaders/fragment/lighting/empty.glsl");
+
     Shader textShader("shaders/text/vertex/text.glsl", "shaders/text/fragment/text.glsl");
 
     // Set up uniforms and buffer data
@@ -145,56 +186,150 @@ int main()
         glm::vec3(300.0f, 300.0f, 300.0f)
     };
 
+    // sun with cascaded shadows
+    const glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.3f, -1.0f, -0.4f));
+    const glm::vec3 sunColor = glm::vec3(3.0f, 2.9f, 2.7f);
+    const float SHADOW_DISTANCE = 60.0f;
+
     // Load textures
     // -------------
     const unsigned int MATERIAL_COUNT = 3;
-    const PBRMaterial materials[MATERIAL_COUNT] = {
-        PBRMaterial("resources/textures/PBR_materials/carbon-fiber"),
-        PBRMaterial("resources/textures/PBR_materials/gold-scuffed"),
-        PBRMaterial("resources/textures/PBR_materials/rusted_iron"),
+    MaterialSystem materialSystem;
+    const unsigned int materials[MATERIAL_COUNT] = {
+        materialSystem.add("resources/textures/PBR_materials/carbon-fiber"),
+        materialSystem.add("resources/textures/PBR_materials/gold-scuffed"),
+        materialSystem.add("resources/textures/PBR_materials/rusted_iron"),
     };
+    materialSystem.build();
 
     // Load models
     // -----------
-    const PBRMaterial gunMaterial = PBRMaterial("resources/textures/PBR_materials/gun");
-    Model gun("resources/models/Cerberus_gun/Cerberus_LP.FBX", ModelLoad_CustomTex);
+    // the gun maps start at their low mips and stream in on demand
+    TextureStreamer textureStreaming;
+    textureStreaming.init();
+    const StreamedPBRMaterial gunMaterial(textureStreaming, "resources/textures/PBR_materials/gun");
+    Model gun("resources/models/Cerberus_gun/Cerberus_LP.FBX", ModelLoad_CustomTex | ModelLoad_ReleaseCPU);
 
     // PBR framebuffers and textures
     // -----------------------------
-    const auto [gBuffer,
-                gPositionMetallic,
-                gNormalRoughness,
-                gAlbedoAo,
-                brdfLUTTexture]
-    = PBR_deferredFramebuffersSetup3x4f(SCR_WIDTH, SCR_HEIGHT);
-
-    const auto [irradianceMap,
+    // baked offline by tools/ibl_baker when the folder exists, rendered here otherwise
+    const std::string bakedIBLFolder = "resources/textures/equirectangular/baked";
+
+    // the G-buffer and the HDR targets are render graph transients
+    const GLTexture brdfLUTTexture = PBR_brdfLUTSetup((bakedIBLFolder + "/brdf_lut.ktx").c_str());
+
+    IBLmaps_env iblMaps = loadIBLCubemaps_env(bakedIBLFolder);
+    if (!iblMaps.envCubemap)
+    {
+        iblMaps = generateIBLCubemaps_env("resources/textures/equirectangular/ibl_hdr_radiance.png",
+                                          equirectangularShader, prefilterShader);
+    }
+    const auto [irradianceSH,
                 prefilterMap,
                 envCubemap]
-    = generateIBLCubemaps_env("resources/textures/equirectangular/ibl_hdr_radiance.png",
-                              equirectangularShader, irradianceShader, prefilterShader);
+    = std::move(iblMaps);
+    PBR_releaseCaptureBuffers();
+
+    // GPU culling of the gun meshes (GL 4.3+, F5 to toggle)
+    // ------------------------------------------------------
+    glm::mat4 gunTransform = glm::mat4(1.0f);
+    gunTransform = glm::translate(gunTransform, glm::vec3(0.0f, 10.0f, 0.0f));
+    gunTransform = glm::rotate(gunTransform, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    gunTransform = glm::scale(gunTransform, glm::vec3(0.1f, 0.1f, 0.1f));
+
+    // bounding sphere of the gun for its screen coverage
+    glm::vec3 gunBoundsMin(std::numeric_limits<float>::max());
+    glm::vec3 gunBoundsMax(-std::numeric_limits<float>::max());
+    for (int i = 0; i < (int)gun.getNumMeshes(); i++)
+    {
+        glm::vec3 meshMin, meshMax;
+        gun.getMeshBounds(i, meshMin, meshMax);
+        gunBoundsMin = glm::min(gunBoundsMin, meshMin);
+        gunBoundsMax = glm::max(gunBoundsMax, meshMax);
+    }
+    const glm::vec3 gunCenter = glm::vec3(gunTransform * glm::vec4(0.5f * (gunBoundsMin + gunBoundsMax), 1.0f));
+    const float gunRadius = 0.5f * glm::length(gunBoundsMax - gunBoundsMin) * glm::length(glm::vec3(gunTransform[0]));
+
+    const bool gpuCullingSupported = GPUCullingSupported();
+    GPUCuller gpuCuller;
+    std::unique_ptr<Shader> gPassPBRIndirectShader;
+    if (gpuCullingSupported)
+    {
+        gpuCuller.init(SCR_WIDTH, SCR_HEIGHT);
+
+        std::vector<GPUCullObject> cullObjects;
+        GPUCullAppendModel(cullObjects, gun, gunTransform);
+        gpuCuller.setObjects(cullObjects);
+
+        gPassPBRIndirectShader = std::make_unique<Shader>("shaders/vertex/lighting/3d_PBR_indirect.glsl",
+                                                          "shaders/fragment/deferred/PBR/g_passPBR.glsl");
+        gPassPBRIndirectShader->use();
+        gPassPBRIndirectShader->setInt("albedoMap", 0);
+        gPassPBRIndirectShader->setInt("normalMap", 1);
+        gPassPBRIndirectShader->setInt("ormMap", 2);
+    }
 
     // Configure shaders
     // -----------------
     gPassPBRShader.use();
     gPassPBRShader.setInt("albedoMap", 0);
     gPassPBRShader.setInt("normalMap", 1);
-    gPassPBRShader.setInt("metallicMap", 2);
-    gPassPBRShader.setInt("roughnessMap", 3);
-    gPassPBRShader.setInt("aoMap", 4);
+    gPassPBRShader.setInt("ormMap", 2);
+
+    gPassPBRArrayShader.use();
+    gPassPBRArrayShader.setInt("albedoArray", 0);
+    gPassPBRArrayShader.setInt("normalArray", 1);
+    gPassPBRArrayShader.setInt("ormArray", 2);
+    MaterialSystem::configureShader(gPassPBRArrayShader);
 
     lPassPBRShader.use();
     lPassPBRShader.setInt("PositionMetallicMap", 0);
     lPassPBRShader.setInt("normalRoughnessMap", 1);
     lPassPBRShader.setInt("AlbedoAoMap", 2);
-    lPassPBRShader.setInt("irradianceMap", 3);
+    ConfigureSH9Shader(lPassPBRShader);
     lPassPBRShader.setInt("prefilterMap", 4);
     lPassPBRShader.setInt("brdfLUT", 5);
+    lPassPBRShader.setVec3("sunDirection", sunDirection);
+    lPassPBRShader.setVec3("sunColor", sunColor);
+
+    CascadedShadowMap sunShadows;
+    sunShadows.init(2048, 4);
+
+    SSAO ssao;
+    ssao.init(SCR_WIDTH, SCR_HEIGHT, 2);
+    lPassPBRShader.use();
+    lPassPBRShader.setInt("sunShadowMask", 6);
+    lPassPBRShader.setInt("ssaoMap", 8);
+
+    // the lighting pass and the skybox render HDR, tonemapped after the bloom
+    Bloom bloom;
+    bloom.init(6);
+
+    // point light shadows, cached until a light or caster moves
+    ShadowAtlas pointShadows;
+    pointShadows.init(4096, 12);
+    for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); ++i)
+        pointShadows.addLight(lightPositions[i], 50.0f);
+
+    for (unsigned int i = 0; i < MATERIAL_COUNT; ++i)
+    {
+        const glm::vec3 position(3.0f * (i - (MATERIAL_COUNT - 1) / 2.0f), 0.0f, 0.0f);
+        pointShadows.addCaster(position, 1.0f, [position](Shader& depthShader)
+        {
+            depthShader.setMat4("model", glm::translate(glm::mat4(1.0f), position));
+            sphereGeometry().draw(GL_TRIANGLE_STRIP);
+        });
+    }
+    pointShadows.addCaster(gunCenter, gunRadius, [&gun, gunTransform](Shader& depthShader)
+    {
+        depthShader.setMat4("model", gunTransform);
+        gun.Draw(depthShader);
+    });
 
     glActiveTexture(GL_TEXTURE5);
     glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
 
-    for (int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); i++)
+    for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); i++)
     {
         lPassPBRShader.setVec3("lightPositions[" + std::to_string(i) + "]", lightPositions[i]);
         lPassPBRShader.setVec3("lightColors[" + std::to_string(i) + "]", lightColors[i]);
@@ -203,6 +338,75 @@ int main()
     skyboxShader.use();
     skyboxShader.setInt("environmentMap", 0);
 
+    // what the reflection probes see. The deferred scene can't be shaded into
+    // their faces, so they get the sky, the lights as emissive markers and the
+    // spheres as dim occluders
+    const unsigned int skyCubemap = envCubemap;
+    const ProbeCaptureDraw drawProbeScene = [&](const glm::mat4& probeView, const glm::mat4& probeProjection)
+    {
+        probeMarkerShader.use();
+        probeMarkerShader.setMat4("view", probeView);
+        probeMarkerShader.setMat4("projection", probeProjection);
+        for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); i++)
+        {
+            probeMarkerShader.setMat4("model", glm::scale(glm::translate(glm::mat4(1.0f), lightPositions[i]), glm::vec3(0.5f)));
+            probeMarkerShader.setVec3("color", lightColors[i]);
+            renderSphere();
+        }
+        probeMarkerShader.setVec3("color", glm::vec3(0.05f));
+        for (unsigned int i = 0; i < MATERIAL_COUNT; ++i)
+        {
+            probeMarkerShader.setMat4("model", glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * (i - (MATERIAL_COUNT - 1) / 2.0f), 0.0f, 0.0f)));
+            renderSphere();
+        }
+
+        skyboxShader.use();
+        skyboxShader.setMat4("view", probeView);
+        skyboxShader.setMat4("projection", probeProjection);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, skyCubemap);
+        renderCube();
+    };
+
+    // per frame CPU work (transforms, culling, LOD, draw lists, the probe's SH
+    // projection) runs on these workers while the main thread drives GL, which
+    // then only submits. It's the shared pool, so nothing else spawns threads
+    JobSystem& frameJobs = SharedJobs();
+
+    // global probe the lighting falls back to, re-captured a few steps per frame
+    ReflectionProbe reflectionProbe;
+    reflectionProbe.init(glm::vec3(0.0f, 2.0f, 0.0f), drawProbeScene, 128, 64, frameJobs);
+    reflectionProbe.setContinuous(true);
+    const float PROBE_BUDGET_MS = 0.5f;
+
+    // baked local probes around the spheres and the gun (GL 4.0+, cubemap arrays)
+    const bool probeGridSupported = ProbeGridSupported();
+    ProbeGrid probeGrid;
+    lPassPBRShader.use();
+    lPassPBRShader.setInt("probeCount", 0);
+    if (probeGridSupported)
+    {
+        probeGrid.init(128, 256, 32);
+        probeGrid.addProbe(glm::vec3(0.0f, 0.0f, 2.5f), glm::vec3(-6.0f, -3.0f, -3.0f), glm::vec3(6.0f, 4.0f, 6.0f), 1.5f);
+        probeGrid.addProbe(gunCenter + glm::vec3(0.0f, 0.0f, 2.0f), gunCenter - glm::vec3(4.0f, 3.0f, 4.0f),
+                           gunCenter + glm::vec3(4.0f, 3.0f, 4.0f), 1.0f);
+        probeGrid.bake(drawProbeScene);
+        probeGrid.configureShader(lPassPBRShader, 3, 9);
+    }
+
+    // passes are declared again every frame, their targets come from its pool
+    RenderGraph renderGraph;
+
+    std::vector<MaterialInstance> sphereInstances(MATERIAL_COUNT);
+    MaterialDrawList sphereDrawList;
+    struct CascadeCasters {
+        std::vector<unsigned int> spheres;
+        bool gun = false;
+    };
+    std::vector<CascadeCasters> cascadeCasters(sunShadows.getCascadeCount());
+    glm::mat3 gunNormalMatrix = glm::transpose(glm::inverse(glm::mat3(gunTransform)));
+    float gunCoverage = 0.0f;
+
     // Rendering loop
     // --------------
     glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
@@ -213,6 +417,8 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        Profiler.beginFrame();
+
         // Input
         // -----
         processInput(window);
@@ -220,119 +426,303 @@ int main()
         // Rendering
         // ---------
 
-        // Geometry Pass
-        // -------------
-        glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // glEnable(GL_DEPTH_TEST);
-
+        // window size for the whole frame, the jobs read it too
+        const int width = (int)SCR_WIDTH, height = (int)SCR_HEIGHT;
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
         const glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 model = glm::mat4(1.0f);
 
-        gPassPBRShader.use();
-        gPassPBRShader.setMat4("projection", projection);
-        gPassPBRShader.setMat4("view", view);
-
-        for (int i = 0; i < MATERIAL_COUNT; ++i)
+        // Frame jobs
+        // ----------
+        // transforms first, culling and the draw lists once they're done
+        JobCounter transformsDone, frameDataDone;
+        frameJobs.submit([&]()
         {
-            // render material spheres
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, materials[i].albedoTexture);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, materials[i].normalTexture);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, materials[i].metallicTexture);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, materials[i].roughnessTexture);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, materials[i].aoTexture);
+            TRACE_SCOPE("Transforms");
+            for (unsigned int i = 0; i < MATERIAL_COUNT; ++i)
+            {
+                const glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * (i - (MATERIAL_COUNT - 1) / 2.0f), 0.0f, 0.0f));
+                sphereInstances[i] = { model, materials[i] };
+            }
+            gunNormalMatrix = glm::transpose(glm::inverse(glm::mat3(gunTransform)));
+        }, &transformsDone);
+
+        frameJobs.submitAfter(transformsDone, [&]()
+        {
+            materialSystem.buildDrawList(sphereInstances, sphereDrawList);
+        }, &frameDataDone);
 
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(3.0f * (i - (MATERIAL_COUNT - 1) / 2.0f), 0.0f, 0.0f));
+        // casters outside a cascade's light volume are skipped, one job per cascade
+        frameJobs.submitAfter(transformsDone, [&]()
+        {
+            TRACE_SCOPE("Shadow caster culling");
+            sunShadows.update(view, glm::radians(camera.Zoom), SCR_WIDTH / SCR_HEIGHT, 0.1f, SHADOW_DISTANCE, sunDirection);
+            frameJobs.parallelFor(cascadeCasters.size(), [&](size_t cascade)
+            {
+                CascadeCasters& casters = cascadeCasters[cascade];
+                casters.spheres.clear();
+                for (unsigned int i = 0; i < sphereInstances.size(); i++)
+                {
+                    if (sunShadows.isVisible((int)cascade, glm::vec3(sphereInstances[i].model[3]), 1.0f))
+                        casters.spheres.push_back(i);
+                }
+                casters.gun = sunShadows.isVisible((int)cascade, gunCenter, gunRadius);
+            });
+        }, &frameDataDone);
+
+        // texture LOD of the gun, requested by the G-pass
+        frameJobs.submit([&]()
+        {
+            gunCoverage = ScreenCoverage(gunCenter, gunRadius, view, glm::radians(camera.Zoom), (float)height);
+        }, &frameDataDone);
+
+        // Reflection probe
+        // ----------------
+        // GL only, overlaps the frame jobs
+        const int probeScope = Profiler.beginScope("Reflection probe");
+        reflectionProbe.update(PROBE_BUDGET_MS);
+        Profiler.endScope(probeScope);
+
+        frameJobs.wait(frameDataDone);
+
+        // Render graph
+        // ------------
+
+        // owned by their modules, the temporal ones swap their output every frame
+        const RGTexture sunShadowMap = renderGraph.importTexture("Sun shadow map", sunShadows.getTexture());
+        const RGTexture pointShadowAtlas = renderGraph.importTexture("Point shadow atlas", pointShadows.getTexture());
+        const RGTexture ssaoTexture = renderGraph.importTexture("SSAO", [&ssao]() { return ssao.getTexture(); });
+        const RGTexture shadowMask = renderGraph.importTexture("Shadow mask", [&sunShadows]() { return sunShadows.getMaskTexture(); });
+
+        // Shadow Pass
+        // -----------
+        renderGraph.addPass("Shadows", [&](RGPassBuilder& builder)
+        {
+            builder.write(sunShadowMap);
+            builder.write(pointShadowAtlas);
+        },
+        [&](const RGResources&)
+        {
+            for (int cascade = 0; cascade < sunShadows.getCascadeCount(); ++cascade)
+            {
+                sunShadows.beginCascade(cascade, shadowDepthShader);
+
+                for (unsigned int sphere : cascadeCasters[cascade].spheres)
+                {
+                    shadowDepthShader.setMat4("model", sphereInstances[sphere].model);
+                    sphereGeometry().draw(GL_TRIANGLE_STRIP);
+                }
+
+                if (cascadeCasters[cascade].gun)
+                {
+                    shadowDepthShader.setMat4("model", gunTransform);
+                    gun.Draw(shadowDepthShader);
+                }
+            }
+            sunShadows.end(SCR_WIDTH, SCR_HEIGHT);
+
+            pointShadows.update(shadowDepthShader, view, glm::radians(camera.Zoom), SCR_WIDTH, SCR_HEIGHT);
+        });
 
-            gPassPBRShader.setMat4("model", model);
-            gPassPBRShader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model))));
-            renderSphere();
-        }
+        // Geometry Pass
+        // -------------
+        RGTexture gPositionMetallic, gNormalRoughness, gAlbedoAo, gDepth;
+        renderGraph.addPass("G-pass", [&](RGPassBuilder& builder)
+        {
+            gPositionMetallic = builder.colorAttachment(builder.create("gPositionMetallic", { width, height, GL_RGBA16F }));
+            gNormalRoughness = builder.colorAttachment(builder.create("gNormalRoughness", { width, height, GL_RGBA16F }));
+            gAlbedoAo = builder.colorAttachment(builder.create("gAlbedoAo", { width, height, GL_RGBA8 }));
+            gDepth = builder.depthAttachment(builder.create("gDepth", { width, height, GL_DEPTH_COMPONENT24 }));
+        },
+        [&](const RGResources& resources)
+        {
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // before any material texture is bound, culling samples unit 0
+            const bool gpuCulling = gpuCullingSupported && useGPUCulling;
+            if (gpuCulling)
+            {
+                gpuCuller.resize(width, height);
+                gpuCuller.cull(projection * view);
+            }
+
+            // render material spheres, one instanced draw per texture array group
+            gPassPBRArrayShader.use();
+            gPassPBRArrayShader.setMat4("projection", projection);
+            gPassPBRArrayShader.setMat4("view", view);
+            materialSystem.draw(sphereGeometry(), GL_TRIANGLE_STRIP, sphereDrawList);
+
+            // render gun
+            gPassPBRShader.use();
+            gPassPBRShader.setMat4("projection", projection);
+            gPassPBRShader.setMat4("view", view);
+
+            gunMaterial.request(textureStreaming, gunCoverage);
+            textureStreaming.update();
+            gunMaterial.bind(textureStreaming);
+
+            if (gpuCulling)
+            {
+                gPassPBRIndirectShader->use();
+                gPassPBRIndirectShader->setMat4("projection", projection);
+                gPassPBRIndirectShader->setMat4("view", view);
+                gpuCuller.draw();
+
+                // occluders for the next frame, none while minimized
+                if (width > 0 && height > 0)
+                    gpuCuller.buildDepthPyramid(resources.texture(gDepth), projection * view);
+            }
+            else
+            {
+                gPassPBRShader.setMat4("model", gunTransform);
+                gPassPBRShader.setMat3("normalMatrix", gunNormalMatrix);
+                gun.Draw(gPassPBRShader);
+            }
+        });
+
+        // SSAO at half resolution
+        // -----------------------
+        renderGraph.addPass("SSAO", [&](RGPassBuilder& builder)
+        {
+            builder.read(gPositionMetallic);
+            builder.read(gNormalRoughness);
+            builder.write(ssaoTexture);
+        },
+        [&](const RGResources& resources)
+        {
+            ssao.resize(SCR_WIDTH, SCR_HEIGHT);
+            ssao.render(resources.texture(gPositionMetallic), resources.texture(gNormalRoughness), view, projection);
+        });
 
-        // render gun
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, gunMaterial.albedoTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, gunMaterial.normalTexture);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, gunMaterial.metallicTexture);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, gunMaterial.roughnessTexture);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, gunMaterial.aoTexture);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 10.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-
-        gPassPBRShader.setMat4("model", model);
-        gPassPBRShader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model))));
-        gun.Draw(gPassPBRShader);
+        // Sun shadow mask, accumulated over frames
+        // ----------------------------------------
+        renderGraph.addPass("Shadow mask", [&](RGPassBuilder& builder)
+        {
+            builder.read(gPositionMetallic);
+            builder.read(gNormalRoughness);
+            builder.read(sunShadowMap);
+            builder.write(shadowMask);
+        },
+        [&](const RGResources& resources)
+        {
+            sunShadows.renderMask(resources.texture(gPositionMetallic), resources.texture(gNormalRoughness),
+                                  view, projection, SCR_WIDTH, SCR_HEIGHT);
+        });
 
         // Lighting Pass
         // -------------
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDisable(GL_DEPTH_TEST);
+        // HDR, tonemapped after the bloom. It keeps the G-pass depth for the skybox
+        RGTexture scene;
+        renderGraph.addPass("L-pass", [&](RGPassBuilder& builder)
+        {
+            scene = builder.colorAttachment(builder.create("HDR scene", { width, height, GL_RGBA16F, GL_LINEAR }));
+            builder.depthAttachment(gDepth);
+            builder.read(gPositionMetallic);
+            builder.read(gNormalRoughness);
+            builder.read(gAlbedoAo);
+            builder.read(ssaoTexture);
+            builder.read(shadowMask);
+            builder.read(pointShadowAtlas);
+        },
+        [&](const RGResources& resources)
+        {
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDisable(GL_DEPTH_TEST);
+
+            lPassPBRShader.use();
+            lPassPBRShader.setVec3("camPos", camera.Position);
+            pointShadows.setUniforms(lPassPBRShader, 7);
+            glBindBufferBase(GL_UNIFORM_BUFFER, SH_IRRADIANCE_BINDING, reflectionProbe.getIrradianceSH());
+            glActiveTexture(GL_TEXTURE6);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(shadowMask));
+            glActiveTexture(GL_TEXTURE8);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(ssaoTexture));
 
-        lPassPBRShader.use();
-        lPassPBRShader.setVec3("camPos", camera.Position);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(gPositionMetallic));
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(gNormalRoughness));
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, resources.texture(gAlbedoAo));
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, reflectionProbe.getPrefiltered());
+            if (probeGridSupported)
+            {
+                probeGrid.assign(view, projection, SCR_WIDTH, SCR_HEIGHT);
+                probeGrid.bind(lPassPBRShader, 3, 9);
+            }
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, gPositionMetallic);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, gNormalRoughness);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, gAlbedoAo);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-
-        renderQuad();
+            renderQuad();
+        });
 
         // Additional rendering
         // --------------------
+        renderGraph.addPass("Skybox", [&](RGPassBuilder& builder)
+        {
+            builder.colorAttachment(scene);
+            builder.depthAttachment(gDepth);
+        },
+        [&](const RGResources&)
+        {
+            glEnable(GL_DEPTH_TEST);
 
-        // Copy depth from gBuffer to default framebuffer
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glEnable(GL_DEPTH_TEST);
+            skyboxShader.use();
+            skyboxShader.setMat4("projection", projection);
+            skyboxShader.setMat4("view", view);
 
-        // Skybox
-        skyboxShader.use();
-        skyboxShader.setMat4("projection", projection);
-        skyboxShader.setMat4("view", view);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, skyCubemap);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+            renderCube();
+        });
 
-        renderCube();
+        // Bloom and tonemapping
+        // ---------------------
+        const RGTexture bloomTexture = bloom.addPass(renderGraph, scene, width, height);
+        bloom.addCompositePass(renderGraph, scene, bloomTexture, width, height);
 
         // Render text
-        projection = glm::ortho(0.0f, SCR_WIDTH, 0.0f, SCR_HEIGHT);
-
-        textShader.use();
-        textShader.setMat4("projection", projection);
-        textShader.setInt("text", 0);
+        renderGraph.addPass("Text", [&](RGPassBuilder& builder)
+        {
+            builder.windowOutput(width, height);
+        },
+        [&](const RGResources&)
+        {
+            // nothing clears the window's depth anymore, overlays aren't depth tested
+            glDisable(GL_DEPTH_TEST);
+            const glm::mat4 textProjection = glm::ortho(0.0f, SCR_WIDTH, 0.0f, SCR_HEIGHT);
+
+            textShader.use();
+            textShader.setMat4("projection", textProjection);
+            textShader.setInt("text", 0);
+
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            RenderText(textShader, "SERUS", 20.0f, 20.0f, 1.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+            RenderProfilerOverlay(textShader, 20.0f, SCR_HEIGHT - 30.0f, 0.3f);
+            RenderGLStatsOverlay(textShader, SCR_WIDTH * 0.5f, SCR_HEIGHT - 30.0f, 0.3f);
+            if (showGPUMemory)
+                RenderGPUMemoryOverlay(textShader, SCR_WIDTH * 0.5f, 150.0f, 0.3f);
+            glDisable(GL_BLEND);
+        });
+
+        renderGraph.addPass("FBO view", [&](RGPassBuilder& builder)
+        {
+            builder.read(gNormalRoughness);
+            builder.windowOutput(width, height);
+        },
+        [&](const RGResources& resources)
+        {
+            DisplayFramebufferTexture(resources.texture(gNormalRoughness));
+        });
 
-        glEnable(GL_BLEND);
-        RenderText(textShader, "SERUS", 20.0f, 20.0f, 1.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-        glDisable(GL_BLEND);
+        renderGraph.execute();
+        glEnable(GL_DEPTH_TEST);
 
-        DisplayFramebufferTexture(gNormalRoughness);
+        Profiler.endFrame();
+        GLStatsEndFrame();
+        FrameStream.endFrame();
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -342,6 +732,15 @@ int main()
 
     // Ukoncenie programu
     // ------------------
+    TraceExport("trace.json");
+    GPUMemoryReport();
+    Textures.report();
+    textureStreaming.report();
+    textureStreaming.shutdown();
+    Profiler.shutdown();
+    unloadFont();
+    FrameStream.shutdown();
+    GLResourcesShutdown(); // objects still alive past this point are freed with the context
     glfwTerminate();
     return 0;
 }
@@ -396,6 +795,39 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
+// glfw: called once per key press/release, used for toggles so they don't repeat every frame
+// ---------------------------------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    // profiler overlay
+    if (key == GLFW_KEY_F1)
+        Profiler.enabled = !Profiler.enabled;
+
+    // write the timeline recorded so far
+    if (key == GLFW_KEY_F2)
+        TraceExport("trace.json");
+
+    // GL call statistics, the wrappers are only installed while shown
+    if (key == GLFW_KEY_F3)
+    {
+        if (glStatsInstalled)
+            GLStatsUninstall();
+        else
+            GLStatsInstall();
+    }
+
+    // estimated GPU memory per category
+    if (key == GLFW_KEY_F4)
+        showGPUMemory = !showGPUMemory;
+
+    // GPU culling and indirect draws vs. the plain draw loop
+    if (key == GLFW_KEY_F5)
+        useGPUCulling = !useGPUCulling;
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -0,0 +1,385 @@
+// PBR materials stored as layers of texture arrays plus one uniform table
+//
+// Materials whose albedo maps have the same size share a group of three
+// GL_TEXTURE_2D_ARRAYs (albedo, normal, ORM), the maps of a material are
+// resampled to its albedo size. The table maps a material id to its layers,
+// so objects with different materials of one group draw in one instanced
+// call, each instance picks its material by id.
+
+#ifndef MATERIAL_SYSTEM_H
+#define MATERIAL_SYSTEM_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <cstring>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "texture_loader.h"
+#include "geometry_arena.h"
+#include "stream_buffer.h"
+#include "thread_pool.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+// Limits and uniform block bindings, keep in sync with the shaders
+const unsigned int MATERIAL_MAX_COUNT = 256;
+const unsigned int MATERIAL_MAX_INSTANCES = 64;     // per draw, 64 * 144 bytes fits the minimal UBO size
+const unsigned int MATERIAL_TABLE_BINDING = 1;
+const unsigned int MATERIAL_INSTANCE_BINDING = 2;
+
+struct MaterialInstance {
+    glm::mat4 model;
+    unsigned int material;
+};
+
+// std140, matches the Instances block
+struct MaterialInstanceEntry {
+    glm::mat4 model;
+    glm::mat4 normalMatrix; // mat3 padded to columns of vec4 anyway
+    int material[4];
+};
+
+// Instances sorted into instanced draws, normal matrices included. Built
+// without any GL call, so it can be prepared on a job while the GL thread
+// does something else
+struct MaterialDrawList {
+    struct Draw {
+        unsigned int group;
+        size_t first;
+        size_t count;
+    };
+
+    std::vector<MaterialInstanceEntry> entries;
+    std::vector<Draw> draws;
+};
+
+class MaterialSystem
+{
+public:
+    // Registers a material folder (albedo, normal, ao, roughness, metallic maps),
+    // nothing is loaded before build()
+    unsigned int add(const std::string& folder)
+    {
+        if (materials.size() >= MATERIAL_MAX_COUNT)
+        {
+            std::cout << "ERROR::MATERIAL_SYSTEM::TOO_MANY_MATERIALS " << folder << std::endl;
+            return 0;
+        }
+
+        Material material;
+        material.folder = folder;
+        materials.push_back(material);
+        return static_cast<unsigned int>(materials.size() - 1);
+    }
+
+    // Decodes every map on all cores, then builds the arrays and the table
+    void build()
+    {
+        TRACE_SCOPE("MaterialSystem::build");
+
+        std::vector<MaterialImages> images(materials.size());
+        parallelFor(materials.size(), [&](size_t i)
+        {
+            loadImages(materials[i].folder, images[i]);
+        });
+
+        // one group per albedo size
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            const int width = images[i].albedo.width;
+            const int height = images[i].albedo.height;
+
+            unsigned int group = 0;
+            while (group < groups.size() && (groups[group].width != width || groups[group].height != height))
+                group++;
+            if (group == groups.size())
+            {
+                groups.emplace_back();
+                groups.back().width = width;
+                groups.back().height = height;
+            }
+
+            materials[i].group = group;
+            materials[i].layer = groups[group].layerCount++;
+        }
+
+        for (Group& group : groups)
+            allocateGroup(group);
+
+        // upload the layers
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            const Group& group = groups[materials[i].group];
+            const MaterialImages& material = images[i];
+            uploadLayer(group.albedo, materials[i].layer, material.albedo, GL_RGBA);
+            uploadLayer(group.normal, materials[i].layer, material.normal, GL_RGB);
+            uploadLayer(group.orm, materials[i].layer, material.orm, GL_RGB);
+        }
+
+        for (const Group& group : groups)
+        {
+            for (unsigned int texture : {group.albedo.get(), group.normal.get(), group.orm.get()})
+            {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        for (MaterialImages& material : images)
+        {
+            FreeImageData(material.albedo);
+            FreeImageData(material.normal);
+            FreeImageData(material.orm);
+        }
+
+        buildTable();
+    }
+
+    // Binding points of the two uniform blocks, once per shader
+    static void configureShader(const Shader& shader)
+    {
+        const unsigned int materials = glGetUniformBlockIndex(shader.ID, "Materials");
+        const unsigned int instances = glGetUniformBlockIndex(shader.ID, "Instances");
+        if (materials == GL_INVALID_INDEX || instances == GL_INVALID_INDEX)
+        {
+            std::cout << "ERROR::MATERIAL_SYSTEM::SHADER_BLOCKS_NOT_FOUND" << std::endl;
+            return;
+        }
+        glUniformBlockBinding(shader.ID, materials, MATERIAL_TABLE_BINDING);
+        glUniformBlockBinding(shader.ID, instances, MATERIAL_INSTANCE_BINDING);
+    }
+
+    // One instanced draw per group and per MATERIAL_MAX_INSTANCES, safe to
+    // call from any thread while the materials aren't changing
+    void buildDrawList(const std::vector<MaterialInstance>& instances, MaterialDrawList& list) const
+    {
+        TRACE_SCOPE("MaterialSystem::buildDrawList");
+
+        list.entries.clear();
+        list.draws.clear();
+        for (unsigned int group = 0; group < groups.size(); group++)
+        {
+            for (const MaterialInstance& instance : instances)
+            {
+                if (instance.material >= materials.size() || materials[instance.material].group != group)
+                    continue;
+
+                if (list.draws.empty() || list.draws.back().group != group
+                    || list.draws.back().count == MATERIAL_MAX_INSTANCES)
+                    list.draws.push_back({ group, list.entries.size(), 0 });
+
+                MaterialInstanceEntry entry;
+                entry.model = instance.model;
+                entry.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(instance.model))));
+                entry.material[0] = static_cast<int>(instance.material);
+                entry.material[1] = entry.material[2] = entry.material[3] = 0;
+                list.entries.push_back(entry);
+                list.draws.back().count++;
+            }
+        }
+    }
+
+    // Submits a list from buildDrawList. The shader (configured above) has
+    // to be in use, its samplers on units firstUnit..firstUnit+2
+    void draw(const GeometryAllocation& geometry, GLenum mode, const MaterialDrawList& list,
+              unsigned int firstUnit = 0)
+    {
+        if (list.draws.empty())
+            return;
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_TABLE_BINDING, table);
+
+        GeometryArena& arena = geometry.getArena();
+        arena.bind();
+
+        unsigned int boundGroup = ~0u;
+        for (const MaterialDrawList::Draw& draw : list.draws)
+        {
+            if (draw.group != boundGroup)
+            {
+                bindGroup(draw.group, firstUnit);
+                boundGroup = draw.group;
+            }
+            drawBatch(arena, geometry.getRange(), mode, list.entries.data() + draw.first, draw.count);
+        }
+    }
+
+    // Draws one instance per entry, building the draw list on the spot
+    void draw(const GeometryAllocation& geometry, GLenum mode, const std::vector<MaterialInstance>& instances,
+              unsigned int firstUnit = 0)
+    {
+        MaterialDrawList list;
+        buildDrawList(instances, list);
+        draw(geometry, mode, list, firstUnit);
+    }
+
+    void bindGroup(unsigned int group, unsigned int firstUnit = 0) const
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, groups[group].albedo);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, groups[group].normal);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, groups[group].orm);
+    }
+
+    size_t getMaterialCount() const
+    {
+        return materials.size();
+    }
+
+    size_t getGroupCount() const
+    {
+        return groups.size();
+    }
+
+private:
+    struct Material {
+        std::string folder;
+        unsigned int group = 0;
+        unsigned int layer = 0;
+    };
+
+    struct MaterialImages {
+        ImageData albedo;  // RGBA
+        ImageData normal;  // RGB, same size as albedo
+        ImageData orm;     // RGB, same size as albedo
+    };
+
+    struct Group {
+        int width = 0;
+        int height = 0;
+        unsigned int layerCount = 0;
+        GLTexture albedo, normal, orm;
+    };
+
+    // std140, matches the shader blocks
+    struct MaterialEntry {
+        int albedoLayer, normalLayer, ormLayer, unused;
+    };
+
+    std::vector<Material> materials;
+    std::vector<Group> groups;
+    GLBuffer table;
+
+    static std::string findMap(const std::string& folder, const char* name)
+    {
+        for (const char* extension : {".png", ".tga"})
+        {
+            std::filesystem::path file = folder + "/" + name + extension;
+            if (std::filesystem::exists(file))
+                return file.string();
+        }
+        return std::string();
+    }
+
+    static ImageData loadMap(const std::string& folder, const char* name)
+    {
+        const std::string file = findMap(folder, name);
+        return file.empty() ? ImageData() : LoadImageData(file.c_str());
+    }
+
+    // Worker thread, no GL
+    static void loadImages(const std::string& folder, MaterialImages& out)
+    {
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        const unsigned char flatNormal[4] = { 128, 128, 255, 255 };
+        const unsigned char defaultORM[4] = { 255, 255, 0, 255 };    // same defaults as PackORMImage
+
+        ImageData albedo = loadMap(folder, "albedo");
+        ImageData normal = loadMap(folder, "normal");
+        ImageData ao = loadMap(folder, "ao");
+        ImageData roughness = loadMap(folder, "roughness");
+        ImageData metallic = loadMap(folder, "metallic");
+        ImageData orm = PackORMImage(ao, roughness, metallic);
+
+        // the albedo decides the size, 1x1 if the material has none
+        const int width = albedo.data ? albedo.width : (orm.data ? orm.width : 1);
+        const int height = albedo.data ? albedo.height : (orm.data ? orm.height : 1);
+
+        out.albedo = ConvertImage(albedo, width, height, 4, white);
+        out.normal = ConvertImage(normal, width, height, 3, flatNormal);
+        out.orm = ConvertImage(orm, width, height, 3, defaultORM);
+
+        for (ImageData* image : {&albedo, &normal, &ao, &roughness, &metallic, &orm})
+            FreeImageData(*image);
+    }
+
+    static void allocateArray(GLTexture& texture, GLenum internalFormat, GLenum format, int width, int height,
+                              unsigned int layers)
+    {
+        texture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        GPUMemoryTrackTexture(texture, GPUMemory_Textures, internalFormat, width, height, layers, true);
+    }
+
+    static void allocateGroup(Group& group)
+    {
+        allocateArray(group.albedo, GL_RGBA8, GL_RGBA, group.width, group.height, group.layerCount);
+        allocateArray(group.normal, GL_RGB8, GL_RGB, group.width, group.height, group.layerCount);
+        allocateArray(group.orm, GL_RGB8, GL_RGB, group.width, group.height, group.layerCount);
+    }
+
+    static void uploadLayer(const GLTexture& texture, unsigned int layer, const ImageData& image, GLenum format)
+    {
+        if (!image.data)
+            return;
+
+        GLint previousAlignment = 1;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows aren't 4 byte aligned
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, image.width, image.height, 1,
+                        format, GL_UNSIGNED_BYTE, image.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+    }
+
+    void buildTable()
+    {
+        std::vector<MaterialEntry> entries(MATERIAL_MAX_COUNT);
+        std::memset(entries.data(), 0, entries.size() * sizeof(MaterialEntry));
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            const int layer = static_cast<int>(materials[i].layer);
+            entries[i] = { layer, layer, layer, 0 };
+        }
+
+        table = GLBuffer::create();
+        glBindBuffer(GL_UNIFORM_BUFFER, table);
+        glBufferData(GL_UNIFORM_BUFFER, entries.size() * sizeof(MaterialEntry), entries.data(), GL_STATIC_DRAW);
+        table.track(GPUMemory_Buffers, entries.size() * sizeof(MaterialEntry));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void drawBatch(const GeometryArena& arena, const GeometryRange& range, GLenum mode,
+                   const MaterialInstanceEntry* entries, size_t count)
+    {
+        // the bound range has to cover the whole declared block, only count entries are written
+        StreamAllocation allocation = FrameStream.allocate(MATERIAL_MAX_INSTANCES * sizeof(MaterialInstanceEntry),
+                                                           FrameStream.getUniformAlignment());
+        if (!allocation.data)
+            return;
+
+        std::memcpy(allocation.data, entries, count * sizeof(MaterialInstanceEntry));
+        FrameStream.commit(allocation);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_INSTANCE_BINDING, allocation.buffer,
+                          allocation.offset, allocation.size);
+        arena.drawInstanced(range, static_cast<unsigned int>(count), mode);
+    }
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <utility>
+#include <cfloat>
 
 #include <glm/glm.hpp>
 
@@ -10,6 +12,8 @@
 
 #include "shader.h"
 #include "model_flags.h"
+#include "gl_resources.h"
+#include "geometry_arena.h"
 
 
 struct Vertex {
@@ -19,29 +23,57 @@ struct Vertex {
     glm::vec3 Tangent;
 };
 
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex has to match VertexLayout_Mesh");
+
+// id is not owned, the Model keeps the texture alive
 struct Texture {
     unsigned int id;
     std::string type;
     std::string path;
 };
 
+// CPU side result of converting one imported mesh, built off the GL thread
+struct MeshData {
+    std::vector<Vertex>       vertices;
+    std::vector<unsigned int> indices;
+    std::vector<Texture>      textures;
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+};
+
 class Mesh
 {
 public:
-    // mesh data
+    // mesh data, vertices and indices are empty if released after upload
     std::vector<Vertex>       vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture>      textures;
 
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, bool hasTangents)
+    // kept even when the CPU side data is released
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    // pass the vectors with std::move to avoid copying them
+    // (vertices without tangents have to leave Tangent zeroed)
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures,
+         bool releaseCPUData = false)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        computeBounds();
+        upload(releaseCPUData);
+    }
 
-        setupMesh(hasTangents);
+    // bounds already computed by the converter
+    Mesh(MeshData&& data, bool releaseCPUData = false)
+        : vertices(std::move(data.vertices)), indices(std::move(data.indices)), textures(std::move(data.textures)),
+          boundsMin(data.boundsMin), boundsMax(data.boundsMax)
+    {
+        upload(releaseCPUData);
     }
 
+    // Binds the textures and draws, the shared VAO is bound by Model::Draw
     void Draw(Shader &shader, unsigned int flags)
     {
         if (flags & ModelLoad_CustomTex)
@@ -83,53 +115,47 @@ public:
         }
 
         // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        geometry.getArena().draw(geometry.getRange());
     }
 
-    unsigned int getVAO()
+    unsigned int getVAO() const
     {
-        return VAO;
+        return geometry.getArena().getVAO();
+    }
+
+    const GeometryRange& getRange() const
+    {
+        return geometry.getRange();
     }
 
 private:
-    //  render data
-    unsigned int VAO, VBO, EBO;
+    //  render data, a range of the shared mesh arena
+    GeometryAllocation geometry;
 
-    void setupMesh(bool hasTangents)
+    void upload(bool releaseCPUData)
     {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-    
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), 
-                    &indices[0], GL_STATIC_DRAW);
-
-        // vertex positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
-        if (hasTangents)
+        vertexCount = static_cast<unsigned int>(vertices.size());
+        indexCount = static_cast<unsigned int>(indices.size());
+
+        geometry = GeometryAllocation(VertexLayout_Mesh, vertices.data(), vertexCount, indices.data(), indexCount);
+
+        if (releaseCPUData)
         {
-            // vertex Tangent vectors
-            glEnableVertexAttribArray(3);	
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+            // swap with empty vectors, clear() would keep the capacity
+            std::vector<Vertex>().swap(vertices);
+            std::vector<unsigned int>().swap(indices);
         }
+    }
 
-        glBindVertexArray(0);
+    void computeBounds()
+    {
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        for (const Vertex& vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
     }
 };
 
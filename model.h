@@ -8,7 +8,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <cstring>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
@@ -18,7 +18,9 @@
 
 #include "mesh.h"
 #include "texture_loader.h"
+#include "texture_cache.h"
 #include "model_flags.h"
+#include "thread_pool.h"
 
 
 class Model 
@@ -31,6 +33,16 @@ public:
     }
     void Draw(Shader& shader)
     {
+        GeometryArena& arena = GetGeometryArena(VertexLayout_Mesh);
+
+        // no per mesh state to set, the whole model is one draw call
+        if (flags & ModelLoad_CustomTex)
+        {
+            drawBatch.submit(arena);
+            return;
+        }
+
+        arena.bind();
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader, flags);
     }
@@ -42,7 +54,7 @@ public:
     
     size_t getMeshIndicesSize(int index)
     {
-        return meshes[index].indices.size();
+        return meshes[index].indexCount;
     }
 
     unsigned int getMeshVAO(int index)
@@ -50,15 +62,30 @@ public:
         return meshes[index].getVAO();
     }
 
+    const GeometryRange& getMeshRange(int index)
+    {
+        return meshes[index].getRange();
+    }
+
+    void getMeshBounds(int index, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        boundsMin = meshes[index].boundsMin;
+        boundsMax = meshes[index].boundsMax;
+    }
+
 private:
     unsigned int flags;
     // model data
     std::vector<Mesh> meshes;
+    GeometryBatch drawBatch; // every mesh, for drawing without textures
     std::vector<Texture> textures_loaded;
+    std::vector<CachedTexture> textureHandles; // keeps the ids in textures_loaded alive
     std::string directory;
 
     void loadModel(std::string path)
     {
+        TRACE_SCOPE_DETAIL("Model::loadModel", path.c_str());
+
         unsigned int assimpFlags = aiProcess_Triangulate;
 
         if (flags & ModelLoad_FlipUVs)
@@ -67,7 +94,11 @@ private:
             assimpFlags |= aiProcess_CalcTangentSpace;
 
         Assimp::Importer import;
-        const aiScene *scene = import.ReadFile(path, assimpFlags);
+        const aiScene *scene;
+        {
+            TRACE_SCOPE("Assimp::ReadFile");
+            scene = import.ReadFile(path, assimpFlags);
+        }
 
         // Check textures detected by Assimp
         // for (unsigned int m = 0; m < scene->mNumMaterials; m++) 
@@ -100,163 +131,199 @@ private:
         }
         directory = path.substr(0, path.find_last_of('/'));
 
-        processNode(scene->mRootNode, scene);
+        // same mesh order as a recursive walk of the node tree
+        std::vector<const aiMesh*> sceneMeshes;
+        sceneMeshes.reserve(scene->mNumMeshes); // nodes can reference a mesh more than once, but usually don't
+        collectMeshes(scene->mRootNode, scene, sceneMeshes);
+
+        // every file referenced by the used materials, each one loaded once
+        std::vector<TextureRequest> requests;
+        std::vector<std::vector<MaterialTexture>> materialTextures(scene->mNumMaterials);
+        if (!(flags & ModelLoad_CustomTex))
+            gatherTextures(scene, sceneMeshes, requests, materialTextures);
+
+        // files another model or material already loaded skip the decode
+        const Input_format format = flags & ModelLoad_GAMMA_CRCT ? GAMMA_CORRECTED : RGB;
+        for (TextureRequest& request : requests)
+            request.cached = Textures.find(directory + "/" + request.path, format);
+
+        // Decode the images and convert the meshes on all cores, textures come first
+        // in the index range as they are the slowest items
+        std::vector<MeshData> meshData(sceneMeshes.size());
+        {
+            TRACE_SCOPE("Model::convert");
+            parallelFor(requests.size() + sceneMeshes.size(), [&](size_t i)
+            {
+                if (i < requests.size())
+                {
+                    TextureRequest& request = requests[i];
+                    if (request.cached)
+                        return;
+
+                    request.image = LoadImageData((directory + "/" + request.path).c_str());
+                    if (request.image.data)
+                        request.hash = TextureCache::contentHash(request.image, format);
+                }
+                else
+                    convertMesh(sceneMeshes[i - requests.size()], meshData[i - requests.size()]);
+            });
+        }
+
+        // GL work stays on this thread
+        TRACE_SCOPE("Model::upload");
+        uploadTextures(requests, format);
+
+        const bool releaseCPUData = flags & ModelLoad_ReleaseCPU;
+
+        meshes.reserve(sceneMeshes.size());
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            for (const MaterialTexture& material : materialTextures[sceneMeshes[i]->mMaterialIndex])
+            {
+                const Texture& loaded = textures_loaded[material.request];
+                meshData[i].textures.push_back({loaded.id, material.typeName, loaded.path});
+            }
+            meshes.emplace_back(std::move(meshData[i]), releaseCPUData);
+            drawBatch.add(meshes.back().getRange());
+        }
 
         std::cout << "Finished loading model: " << path << '\n';
     }
 
-    void processNode(aiNode *node, const aiScene *scene)
+    // one image file shared by every mesh using it
+    struct TextureRequest {
+        std::string path; // relative to the model directory, as stored in the material
+        CachedTexture cached;
+        ImageData image;
+        TextureContentHash hash;
+    };
+
+    struct MaterialTexture {
+        unsigned int request;
+        std::string typeName;
+    };
+
+    void collectMeshes(const aiNode *node, const aiScene *scene, std::vector<const aiMesh*>& out)
     {
         // process all the node's meshes (if any)
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
-        {
-            aiMesh *mesh = scene->mMeshes[node->mMeshes[i]]; 
-            meshes.push_back(processMesh(mesh, scene));			
-        }
+            out.push_back(scene->mMeshes[node->mMeshes[i]]);
         // then do the same for each of its children
         for (unsigned int i = 0; i < node->mNumChildren; i++)
-        {
-            processNode(node->mChildren[i], scene);
-        }
-    }  
+            collectMeshes(node->mChildren[i], scene, out);
+    }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    void gatherTextures(const aiScene *scene, const std::vector<const aiMesh*>& sceneMeshes,
+                        std::vector<TextureRequest>& requests, std::vector<std::vector<MaterialTexture>>& materialTextures)
     {
-        std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
-        std::vector<Texture> textures;
+        std::vector<bool> used(scene->mNumMaterials, false);
+        for (const aiMesh *mesh : sceneMeshes)
+            used[mesh->mMaterialIndex] = true;
 
-        const bool hasTangents = flags & ModelLoad_Tangents;
-
-        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        std::unordered_map<std::string, unsigned int> requestIndex;
+        auto gather = [&](const aiMaterial *material, aiTextureType type, const char *typeName,
+                          std::vector<MaterialTexture>& out)
         {
-            Vertex vertex;
+            for (unsigned int i = 0; i < material->GetTextureCount(type); i++)
+            {
+                aiString str;
+                material->GetTexture(type, i, &str);
 
-            // process vertex positions, normals, texture coordinates and if included, tangent vectors
-            glm::vec3 vector;
+                auto found = requestIndex.find(str.C_Str());
+                if (found == requestIndex.end())
+                {
+                    found = requestIndex.emplace(str.C_Str(), static_cast<unsigned int>(requests.size())).first;
+                    requests.emplace_back();
+                    requests.back().path = str.C_Str();
+                }
+                out.push_back({found->second, typeName});
+            }
+        };
 
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z; 
-            vertex.Position = vector;
+        for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+        {
+            if (!used[m])
+                continue;
 
-            vector.x = mesh->mNormals[i].x;
-            vector.y = mesh->mNormals[i].y;
-            vector.z = mesh->mNormals[i].z;
-            vertex.Normal = vector;
+            const aiMaterial *material = scene->mMaterials[m];
+            std::vector<MaterialTexture>& textures = materialTextures[m];
 
-            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            if (flags & ModelLoad_PBR)
             {
-                glm::vec2 vec;
-                vec.x = mesh->mTextureCoords[0][i].x; 
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
+                gather(material, aiTextureType_BASE_COLOR, "albedoMap", textures);
+                gather(material, aiTextureType_NORMALS, "normalMap", textures);
+                gather(material, aiTextureType_METALNESS, "metallicMap", textures);
+                gather(material, aiTextureType_DIFFUSE_ROUGHNESS, "roughnessMap", textures);
+                gather(material, aiTextureType_AMBIENT_OCCLUSION, "aoMap", textures);
             }
             else
             {
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                gather(material, aiTextureType_DIFFUSE, "diffuse", textures);
+                gather(material, aiTextureType_SPECULAR, "specular", textures);
+
+                if (ModelLoad_Tangents & flags)
+                    gather(material, aiTextureType_HEIGHT, "normal", textures);
             }
+        }
+    }
+
+    // Runs on worker threads, only touches its own output slot
+    void convertMesh(const aiMesh *mesh, MeshData& out)
+    {
+        const bool hasTangents = (flags & ModelLoad_Tangents) && mesh->mTangents;
+        const aiVector3D *texCoords = mesh->mTextureCoords[0]; // does the mesh contain texture coordinates?
+
+        out.vertices.resize(mesh->mNumVertices);
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            Vertex &vertex = out.vertices[i];
+
+            // process vertex positions, normals, texture coordinates and if included, tangent vectors
+            const aiVector3D &position = mesh->mVertices[i];
+            vertex.Position = glm::vec3(position.x, position.y, position.z);
+
+            const aiVector3D &normal = mesh->mNormals[i];
+            vertex.Normal = glm::vec3(normal.x, normal.y, normal.z);
+
+            vertex.TexCoords = texCoords ? glm::vec2(texCoords[i].x, texCoords[i].y) : glm::vec2(0.0f);
 
             if (hasTangents)
             {
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
+                const aiVector3D &tangent = mesh->mTangents[i];
+                vertex.Tangent = glm::vec3(tangent.x, tangent.y, tangent.z);
             }
+            else
+                vertex.Tangent = glm::vec3(0.0f);
 
-            vertices.push_back(vertex);
+            out.boundsMin = glm::min(out.boundsMin, vertex.Position);
+            out.boundsMax = glm::max(out.boundsMax, vertex.Position);
         }
 
         // process indices
+        out.indices.reserve(mesh->mNumFaces * 3); // triangulated
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
-            for (unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+            const aiFace &face = mesh->mFaces[i];
+            out.indices.insert(out.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
         }
-
-        // Skip materials if using custom textures
-        if (flags & ModelLoad_CustomTex)
-            return Mesh(vertices, indices, textures, hasTangents);
-            
-        // process material
-        if (mesh->mMaterialIndex >= 0)
-        {            
-            aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-            
-            if (flags & ModelLoad_PBR)
-            {
-                std::vector<Texture> albedoMaps = loadMaterialTextures(material,
-                                                    aiTextureType_BASE_COLOR, "albedoMap");
-                textures.insert(textures.end(), albedoMaps.begin(), albedoMaps.end());
-                std::vector<Texture> normalMaps = loadMaterialTextures(material,
-                                                    aiTextureType_NORMALS, "normalMap");
-                textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-                std::vector<Texture> metallicMaps = loadMaterialTextures(material,
-                                                    aiTextureType_METALNESS, "metallicMap");
-                textures.insert(textures.end(), metallicMaps.begin(), metallicMaps.end());
-                std::vector<Texture> roughnessMaps = loadMaterialTextures(material,
-                                                    aiTextureType_DIFFUSE_ROUGHNESS, "roughnessMap");
-                textures.insert(textures.end(), roughnessMaps.begin(), roughnessMaps.end());
-                std::vector<Texture> aoMaps = loadMaterialTextures(material,
-                                                    aiTextureType_AMBIENT_OCCLUSION, "aoMap");
-                textures.insert(textures.end(), aoMaps.begin(), aoMaps.end());
-            }
-            else
-            {
-                std::vector<Texture> diffuseMaps = loadMaterialTextures(material,
-                                                    aiTextureType_DIFFUSE, "diffuse");
-                textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-                std::vector<Texture> specularMaps = loadMaterialTextures(material,
-                                                    aiTextureType_SPECULAR, "specular");
-                textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-
-                if (ModelLoad_Tangents & flags)
-                {
-                    std::vector<Texture> normalMaps = loadMaterialTextures(material,
-                                                        aiTextureType_HEIGHT, "normal");
-                    textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-                }
-            }
-        }
-        return Mesh(vertices, indices, textures, hasTangents);
     }
 
-    std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
-                            std::string typeName)
+    void uploadTextures(std::vector<TextureRequest>& requests, Input_format format)
     {
-        std::vector<Texture> textures;
-        for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        textures_loaded.reserve(requests.size());
+        textureHandles.reserve(requests.size());
+        for (TextureRequest& request : requests)
         {
-            aiString str;
-            mat->GetTexture(type, i, &str);
-
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
+            CachedTexture texture = request.cached;
+            if (!texture)
             {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true;
-                    break;
-                }
+                texture = Textures.fromImage(directory + "/" + request.path, request.image, format, LINEAR, &request.hash);
+                FreeImageData(request.image);
             }
-            if (!skip)
-            {
-                Texture texture;
-                texture.type = typeName;
 
-                const std::string fullPath = directory + "/" + str.C_Str();
-                const Input_format format = flags & ModelLoad_GAMMA_CRCT ? GAMMA_CORRECTED : RGB;
-                texture.id = TextureFromFile(fullPath.c_str(), format);
-
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture); // add to loaded textures
-            }
+            textures_loaded.push_back({texture.get(), std::string(), request.path});
+            textureHandles.push_back(std::move(texture));
         }
-        return textures;
     }
 };
 
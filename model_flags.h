@@ -8,6 +8,7 @@ enum ModelFlags {
     ModelLoad_GAMMA_CRCT  = 1 << 2, //      0100
     ModelLoad_PBR         = 1 << 3, //      1000
     ModelLoad_CustomTex   = 1 << 4, // 0001 0000
+    ModelLoad_ReleaseCPU  = 1 << 5, // 0010 0000 - free vertex/index arrays after upload
     // add more as needed
 };
 
@@ -0,0 +1,377 @@
+// Local reflection probes in a cubemap array, box projected (GL 4.0+)
+//
+// Every probe is baked once into a layer of a prefiltered cubemap array
+// and owns a box influence volume. Each frame the probes are assigned to
+// screen tiles on the CPU: a tile keeps the (up to) 4 probes whose boxes
+// cover it on screen, smallest box first. The lighting pass reads its
+// tile's list and blends at most two probes whose box contains the pixel,
+// with the reflection ray intersected against the box so it hits the right
+// spot of the capture; the global maps take whatever weight is left. The
+// cost per pixel doesn't grow with the number of probes in the scene.
+// Diffuse irradiance is kept per probe as SH, blended the same way.
+
+#ifndef PROBE_GRID_H
+#define PROBE_GRID_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "spherical_harmonics.h"
+#include "reflection_probe.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const int MAX_REFLECTION_PROBES = 16;       // keep in sync with the lighting shader
+const int PROBE_TILE_CANDIDATES = 4;        // probes listed per tile, one RGBA8UI texel
+const unsigned int REFLECTION_PROBES_BINDING = 4; // uniform block binding, keep in sync with the shaders
+
+inline bool ProbeGridSupported()
+{
+    return GLAD_GL_VERSION_4_0 || GLAD_GL_ARB_texture_cube_map_array;
+}
+
+// std140 layout, matches ProbeData in the lighting shader
+struct ProbeGridEntry {
+    glm::vec4 boxMin;       // w: blend distance inside the box
+    glm::vec4 boxMax;       // w: cubemap array layer
+    glm::vec4 position;     // capture point
+    SH9Irradiance irradiance;
+};
+
+class ProbeGrid
+{
+public:
+    ProbeGrid()
+        : prefilterShader("shaders/vertex/equirectangular.glsl", "shaders/fragment/cubemap/cubemap_prefilterconv.glsl")
+    {
+    }
+
+    ProbeGrid(const ProbeGrid&) = delete;
+    ProbeGrid& operator=(const ProbeGrid&) = delete;
+
+    // Needs ProbeGridSupported()
+    void init(int prefilterResolution = 128, int captureResolution = 256, int tilePixels = 32)
+    {
+        prefilterSize = prefilterResolution;
+        captureSize = captureResolution;
+        tileSize = tilePixels;
+
+        probeArray = GLTexture::create();
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probeArray);
+        for (int level = 0; level < PROBE_PREFILTER_LEVELS; level++)
+        {
+            const int size = std::max(prefilterSize >> level, 1);
+            glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, GL_RGB16F, size, size, 6 * MAX_REFLECTION_PROBES, 0,
+                         GL_RGB, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, PROBE_PREFILTER_LEVELS - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(probeArray, GPUMemory_Environment, GL_RGB16F, prefilterSize, prefilterSize,
+                              6 * MAX_REFLECTION_PROBES, true);
+
+        probeBuffer = GLBuffer::create();
+        glBindBuffer(GL_UNIFORM_BUFFER, probeBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ProbeGridEntry) * MAX_REFLECTION_PROBES, NULL, GL_STATIC_DRAW);
+        probeBuffer.track(GPUMemory_Environment, sizeof(ProbeGridEntry) * MAX_REFLECTION_PROBES);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        prefilterShader.use();
+        prefilterShader.setInt("environmentMap", 0);
+        prefilterShader.setFloat("environmentResolution", (float)captureSize);
+        prefilterShader.setMat4("projection", glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f));
+    }
+
+    // Box in world space, blendDistance is how far inside the box the probe fades in.
+    // Returns the probe index, -1 when the array is full
+    int addProbe(const glm::vec3& position, const glm::vec3& boxMin, const glm::vec3& boxMax, float blendDistance = 1.0f)
+    {
+        if ((int)probes.size() >= MAX_REFLECTION_PROBES)
+        {
+            std::cout << "ERROR::PROBE_GRID::TOO_MANY_PROBES" << std::endl;
+            return -1;
+        }
+
+        ProbeGridEntry probe = {};
+        probe.boxMin = glm::vec4(glm::min(boxMin, boxMax), std::max(blendDistance, 0.001f));
+        probe.boxMax = glm::vec4(glm::max(boxMin, boxMax), (float)probes.size());
+        probe.position = glm::vec4(position, 1.0f);
+        probes.push_back(probe);
+        baked.push_back(false);
+        return (int)probes.size() - 1;
+    }
+
+    // Renders and prefilters the probes not baked yet, the draw sees the scene from each capture point
+    void bake(ProbeCaptureDraw draw)
+    {
+        TRACE_GPU_SCOPE("Probe grid bake");
+
+        GLFramebuffer framebuffer = GLFramebuffer::create();
+        GLRenderbuffer depth = GLRenderbuffer::create();
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, captureSize, captureSize);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+        GLTexture capture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_CUBE_MAP, capture);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, captureSize, captureSize, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
+        for (int index = 0; index < (int)probes.size(); index++)
+        {
+            if (baked[index])
+                continue;
+            const glm::vec3 position = glm::vec3(probes[index].position);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glViewport(0, 0, captureSize, captureSize);
+            glEnable(GL_DEPTH_TEST);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            for (int face = 0; face < 6; face++)
+            {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, capture, 0);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                draw(captureView(position, face), projection);
+            }
+            glBindTexture(GL_TEXTURE_CUBE_MAP, capture);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+            // the layer's 6 faces, one roughness per mip
+            glDisable(GL_DEPTH_TEST);
+            prefilterShader.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, capture);
+            for (int level = 0; level < PROBE_PREFILTER_LEVELS; level++)
+            {
+                const int size = std::max(prefilterSize >> level, 1);
+                glViewport(0, 0, size, size);
+                prefilterShader.setFloat("roughness", (float)level / (PROBE_PREFILTER_LEVELS - 1));
+                for (int face = 0; face < 6; face++)
+                {
+                    prefilterShader.setMat4("view", captureView(glm::vec3(0.0f), face));
+                    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, probeArray, level, index * 6 + face);
+                    renderCube();
+                }
+            }
+            glEnable(GL_DEPTH_TEST);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+
+            int irradianceLevel = 0;
+            while ((captureSize >> irradianceLevel) > PROBE_IRRADIANCE_SIZE)
+                irradianceLevel++;
+            probes[index].irradiance = ComputeCubemapIrradianceSH9(capture, irradianceLevel);
+            baked[index] = true;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glBindBuffer(GL_UNIFORM_BUFFER, probeBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ProbeGridEntry) * probes.size(), probes.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Lists the probes covering each screen tile, call once per frame before the lighting pass
+    void assign(const glm::mat4& view, const glm::mat4& projection, int width, int height)
+    {
+        TRACE_SCOPE("Probe grid assign");
+
+        resizeTiles(width, height);
+        std::fill(tiles.begin(), tiles.end(), 0);
+
+        // smaller boxes are the more local ones, they win over the big ones around them
+        std::vector<int> order(probes.size());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [this](int a, int b)
+        {
+            return boxVolume(probes[a]) < boxVolume(probes[b]);
+        });
+
+        const glm::mat4 viewProjection = projection * view;
+        for (int index : order)
+        {
+            int x0, y0, x1, y1;
+            if (!screenTiles(probes[index], viewProjection, width, height, x0, y0, x1, y1))
+                continue;
+
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    unsigned char* tile = &tiles[((size_t)y * tilesX + x) * PROBE_TILE_CANDIDATES];
+                    for (int slot = 0; slot < PROBE_TILE_CANDIDATES; slot++)
+                    {
+                        if (tile[slot] == 0)
+                        {
+                            tile[slot] = (unsigned char)(index + 1);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        // RGBA8UI rows are 4 byte aligned, any unpack alignment reads them as is
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tilesX, tilesY, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, tiles.data());
+    }
+
+    // Sets the sampler units and block binding, once after linking
+    void configureShader(Shader& shader, int arrayUnit, int tileUnit) const
+    {
+        shader.use();
+        shader.setInt("probeArray", arrayUnit);
+        shader.setInt("probeTiles", tileUnit);
+        shader.setInt("probeTileSize", tileSize);
+
+        const unsigned int block = glGetUniformBlockIndex(shader.ID, "ReflectionProbes");
+        if (block == GL_INVALID_INDEX)
+        {
+            std::cout << "ERROR::PROBE_GRID::SHADER_BLOCK_NOT_FOUND" << std::endl;
+            return;
+        }
+        glUniformBlockBinding(shader.ID, block, REFLECTION_PROBES_BINDING);
+    }
+
+    // Binds the array, the tile lists and the probe block for the lighting pass
+    void bind(const Shader& shader, int arrayUnit, int tileUnit) const
+    {
+        shader.setInt("probeCount", (int)probes.size());
+        glActiveTexture(GL_TEXTURE0 + arrayUnit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probeArray);
+        glActiveTexture(GL_TEXTURE0 + tileUnit);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glBindBufferBase(GL_UNIFORM_BUFFER, REFLECTION_PROBES_BINDING, probeBuffer);
+    }
+
+    int getProbeCount() const
+    {
+        return (int)probes.size();
+    }
+
+private:
+    Shader prefilterShader;
+    int prefilterSize = 128;
+    int captureSize = 256;
+    int tileSize = 32;
+
+    std::vector<ProbeGridEntry> probes;
+    std::vector<bool> baked;
+    GLTexture probeArray;
+    GLBuffer probeBuffer;
+
+    // per tile: probe index + 1, 0 = none
+    GLTexture tileTexture;
+    std::vector<unsigned char> tiles;
+    int tilesX = 0;
+    int tilesY = 0;
+
+    static float boxVolume(const ProbeGridEntry& probe)
+    {
+        const glm::vec3 extent = glm::vec3(probe.boxMax) - glm::vec3(probe.boxMin);
+        return extent.x * extent.y * extent.z;
+    }
+
+    // same orientation as the IBL captures in PBR_setup.h
+    static glm::mat4 captureView(const glm::vec3& position, int face)
+    {
+        static const glm::vec3 directions[6] = {
+            glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3( 0.0f,  1.0f,  0.0f),
+            glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 0.0f,  0.0f, -1.0f)
+        };
+        static const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f),
+            glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)
+        };
+        return glm::lookAt(position, position + directions[face], ups[face]);
+    }
+
+    void resizeTiles(int width, int height)
+    {
+        const int x = (width + tileSize - 1) / tileSize;
+        const int y = (height + tileSize - 1) / tileSize;
+        if (tileTexture && x == tilesX && y == tilesY)
+            return;
+
+        tilesX = x;
+        tilesY = y;
+        tiles.assign((size_t)tilesX * tilesY * PROBE_TILE_CANDIDATES, 0);
+
+        tileTexture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, tilesX, tilesY, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GPUMemoryTrackTexture(tileTexture, GPUMemory_RenderTargets, GL_RGBA8UI, tilesX, tilesY);
+    }
+
+    // Tile rectangle of the box's screen bounds, false when it's off screen
+    bool screenTiles(const ProbeGridEntry& probe, const glm::mat4& viewProjection, int width, int height,
+                     int& x0, int& y0, int& x1, int& y1) const
+    {
+        glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+        bool behind = false;
+        bool allBeyondFar = true;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const glm::vec3 p((corner & 1) ? probe.boxMax.x : probe.boxMin.x,
+                              (corner & 2) ? probe.boxMax.y : probe.boxMin.y,
+                              (corner & 4) ? probe.boxMax.z : probe.boxMin.z);
+            const glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+            if (clip.w <= 0.0001f)
+            {
+                behind = true; // crosses the camera plane, the projection isn't bounded
+                continue;
+            }
+            const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, glm::vec2(ndc));
+            ndcMax = glm::max(ndcMax, glm::vec2(ndc));
+            allBeyondFar = allBeyondFar && ndc.z > 1.0f;
+        }
+        if (behind)
+        {
+            ndcMin = glm::vec2(-1.0f);
+            ndcMax = glm::vec2(1.0f);
+        }
+        else if (allBeyondFar)
+        {
+            return false;
+        }
+
+        ndcMin = glm::max(ndcMin, glm::vec2(-1.0f));
+        ndcMax = glm::min(ndcMax, glm::vec2(1.0f));
+        if (ndcMin.x > ndcMax.x || ndcMin.y > ndcMax.y)
+            return false;
+
+        // pixels over tile size like the shader, the last tile is partially on screen
+        const glm::vec2 tileScale((float)width / tileSize, (float)height / tileSize);
+        const glm::vec2 tileMin = (ndcMin * 0.5f + 0.5f) * tileScale;
+        const glm::vec2 tileMax = (ndcMax * 0.5f + 0.5f) * tileScale;
+        x0 = std::max((int)tileMin.x, 0);
+        y0 = std::max((int)tileMin.y, 0);
+        x1 = std::min((int)tileMax.x, tilesX - 1);
+        y1 = std::min((int)tileMax.y, tilesY - 1);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,340 @@
+// Scoped CPU/GPU frame profiler
+// GPU timestamps are read back PROFILER_FRAME_LATENCY frames late,
+// so collecting them never waits on the driver
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "text_rendering.h"
+#include "trace_events.h"
+
+
+const unsigned int PROFILER_FRAME_LATENCY = 4;  // frames in flight before GPU results are read
+const unsigned int PROFILER_MAX_SCOPES = 64;    // scopes recorded per frame
+const unsigned int PROFILER_HISTORY = 128;      // samples kept for the rolling statistics
+const unsigned int PROFILER_CALIBRATION_INTERVAL = 256; // frames between GPU clock calibrations
+
+struct ProfilerStats {
+    float min;
+    float avg;
+    float p99;
+};
+
+// Rolling history of one named scope
+struct ProfilerScopeHistory {
+    const char* name;
+    unsigned int depth;
+    float cpuMs[PROFILER_HISTORY];
+    float gpuMs[PROFILER_HISTORY];
+    unsigned int cpuCount, cpuHead;
+    unsigned int gpuCount, gpuHead;
+};
+
+// One scope instance recorded during a frame
+struct ProfilerScopeRecord {
+    unsigned int history;  // index into the history array
+    float cpuMs;
+    bool hasGpu;           // false if the frame ran out of query objects
+    unsigned int query;    // first of the begin/end timestamp query pair
+};
+
+struct ProfilerFrameSlot {
+    std::vector<ProfilerScopeRecord> records;
+    unsigned int queryCount;  // timestamp queries issued (two per record with GPU timing)
+    bool pending;             // has unresolved GPU results
+};
+
+class FrameProfiler
+{
+public:
+    bool enabled = true;
+
+    void init()
+    {
+        glGenQueries(PROFILER_FRAME_LATENCY * PROFILER_MAX_SCOPES * 2, &queries[0][0]);
+        for (unsigned int i = 0; i < PROFILER_FRAME_LATENCY; i++)
+        {
+            slots[i].records.reserve(PROFILER_MAX_SCOPES);
+            slots[i].queryCount = 0;
+            slots[i].pending = false;
+        }
+        TraceCalibrateGpuClock();
+        initialized = true;
+    }
+
+    void shutdown()
+    {
+        if (!initialized)
+            return;
+
+        glDeleteQueries(PROFILER_FRAME_LATENCY * PROFILER_MAX_SCOPES * 2, &queries[0][0]);
+        initialized = false;
+    }
+
+    void beginFrame()
+    {
+        if (!initialized)
+            return;
+
+        // the trace's GPU scopes are recorded whether the overlay is shown or not
+        TraceResolveGpuScopes();
+        if (!enabled)
+            return;
+
+        if (frameIndex % PROFILER_CALIBRATION_INTERVAL == 0)
+            TraceCalibrateGpuClock();
+
+        currentSlot = frameIndex % PROFILER_FRAME_LATENCY;
+        resolveSlot(slots[currentSlot]);
+
+        slots[currentSlot].records.clear();
+        slots[currentSlot].queryCount = 0;
+        depth = 0;
+        openScopes = 0;
+
+        inFrame = true;
+        frameScope = beginScope("Frame");
+    }
+
+    void endFrame()
+    {
+        if (!inFrame)
+            return;
+
+        endScope(frameScope);
+        slots[currentSlot].pending = true;
+        inFrame = false;
+        frameIndex++;
+    }
+
+    // Returns a handle to pass to endScope, or -1 when the scope isn't recorded
+    // (profiler disabled or called outside of beginFrame/endFrame)
+    int beginScope(const char* name)
+    {
+        if (!inFrame)
+            return -1;
+
+        ProfilerFrameSlot& slot = slots[currentSlot];
+        if (slot.records.size() >= PROFILER_MAX_SCOPES)
+            return -1;
+
+        ProfilerScopeRecord record;
+        record.history = findHistory(name);
+        record.cpuMs = 0.0f;
+        record.hasGpu = slot.queryCount + 2 <= PROFILER_MAX_SCOPES * 2;
+        record.query = slot.queryCount;
+
+        if (record.hasGpu)
+        {
+            glQueryCounter(queries[currentSlot][record.query], GL_TIMESTAMP);
+            slot.queryCount += 2; // the end query is issued in endScope
+        }
+
+        const int handle = static_cast<int>(slot.records.size());
+        slot.records.push_back(record);
+
+        cpuStart[openScopes++] = std::chrono::steady_clock::now();
+        depth++;
+
+        return handle;
+    }
+
+    void endScope(int handle)
+    {
+        if (handle < 0 || openScopes == 0)
+            return;
+
+        const auto cpuEnd = std::chrono::steady_clock::now();
+
+        ProfilerFrameSlot& slot = slots[currentSlot];
+        ProfilerScopeRecord& record = slot.records[handle];
+        const auto begin = cpuStart[--openScopes];
+        record.cpuMs = std::chrono::duration<float, std::milli>(cpuEnd - begin).count();
+        TraceCpuEvent(histories[record.history].name, TraceTimeNs(begin), TraceTimeNs(cpuEnd));
+
+        if (record.hasGpu)
+            glQueryCounter(queries[currentSlot][record.query + 1], GL_TIMESTAMP);
+
+        depth--;
+    }
+
+    size_t getScopeCount() const
+    {
+        return histories.size();
+    }
+
+    const ProfilerScopeHistory& getScope(size_t index) const
+    {
+        return histories[index];
+    }
+
+    ProfilerStats getCpuStats(size_t index) const
+    {
+        const ProfilerScopeHistory& h = histories[index];
+        return computeStats(h.cpuMs, h.cpuCount);
+    }
+
+    ProfilerStats getGpuStats(size_t index) const
+    {
+        const ProfilerScopeHistory& h = histories[index];
+        return computeStats(h.gpuMs, h.gpuCount);
+    }
+
+private:
+    bool initialized = false;
+    bool inFrame = false;
+    unsigned long long frameIndex = 0;
+    unsigned int currentSlot = 0;
+    unsigned int depth = 0;
+    int frameScope = -1;
+
+    unsigned int queries[PROFILER_FRAME_LATENCY][PROFILER_MAX_SCOPES * 2];
+    ProfilerFrameSlot slots[PROFILER_FRAME_LATENCY];
+
+    std::chrono::steady_clock::time_point cpuStart[PROFILER_MAX_SCOPES];
+    unsigned int openScopes = 0;
+
+    std::vector<ProfilerScopeHistory> histories;
+
+    unsigned int findHistory(const char* name)
+    {
+        // scope names are string literals, so the pointer compare almost always hits
+        for (unsigned int i = 0; i < histories.size(); i++)
+        {
+            if (histories[i].name == name || std::strcmp(histories[i].name, name) == 0)
+                return i;
+        }
+
+        ProfilerScopeHistory history = {};
+        history.name = name;
+        history.depth = depth;
+        histories.push_back(history);
+
+        return static_cast<unsigned int>(histories.size() - 1);
+    }
+
+    void resolveSlot(ProfilerFrameSlot& slot)
+    {
+        if (!slot.pending)
+            return;
+        slot.pending = false;
+
+        const unsigned int slotIndex = static_cast<unsigned int>(&slot - slots);
+
+        // the frame scope (first record) ends after every other query of the frame,
+        // if it is not ready we drop the GPU samples instead of stalling the pipeline
+        bool gpuReady = false;
+        if (!slot.records.empty() && slot.records[0].hasGpu)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[slotIndex][slot.records[0].query + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            gpuReady = available != 0;
+        }
+
+        for (const ProfilerScopeRecord& record : slot.records)
+        {
+            ProfilerScopeHistory& h = histories[record.history];
+            pushSample(h.cpuMs, h.cpuCount, h.cpuHead, record.cpuMs);
+
+            if (record.hasGpu && gpuReady)
+            {
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(queries[slotIndex][record.query],     GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(queries[slotIndex][record.query + 1], GL_QUERY_RESULT, &end);
+                pushSample(h.gpuMs, h.gpuCount, h.gpuHead, (end - begin) / 1000000.0f);
+                TraceGpuEvent(h.name, begin, end);
+            }
+        }
+    }
+
+    static void pushSample(float* samples, unsigned int& count, unsigned int& head, float value)
+    {
+        samples[head] = value;
+        head = (head + 1) % PROFILER_HISTORY;
+        if (count < PROFILER_HISTORY)
+            count++;
+    }
+
+    static ProfilerStats computeStats(const float* samples, unsigned int count)
+    {
+        if (count == 0)
+            return {0.0f, 0.0f, 0.0f};
+
+        float sorted[PROFILER_HISTORY];
+        std::copy(samples, samples + count, sorted);
+
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < count; i++)
+            sum += sorted[i];
+
+        const unsigned int p99Index = static_cast<unsigned int>(0.99f * (count - 1));
+        std::nth_element(sorted, sorted + p99Index, sorted + count);
+
+        return {*std::min_element(samples, samples + count), sum / count, sorted[p99Index]};
+    }
+};
+
+FrameProfiler Profiler;
+
+// RAII scope, use through PROFILE_SCOPE
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name) : handle(Profiler.beginScope(name)) {}
+    ~ProfileScope() { Profiler.endScope(handle); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    int handle;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+
+// Draws min/avg/p99 of every scope, text shader has to be in use with
+// a screen space projection and blending enabled (same as RenderText)
+void RenderProfilerOverlay(Shader &textShader, float x, float y, float scale)
+{
+    if (!Profiler.enabled)
+        return;
+
+    const float lineHeight = 48.0f * scale * 1.2f; // font is loaded with 48px height
+    const glm::vec3 headerColor(1.0f, 1.0f, 0.0f);
+    const glm::vec3 color(1.0f, 1.0f, 1.0f);
+
+    RenderText(textShader, "scope        cpu min/avg/p99    gpu min/avg/p99 (ms)", x, y, scale, headerColor);
+    y -= lineHeight;
+
+    char line[128];
+    for (size_t i = 0; i < Profiler.getScopeCount(); i++)
+    {
+        const ProfilerScopeHistory& scope = Profiler.getScope(i);
+        const ProfilerStats cpu = Profiler.getCpuStats(i);
+        const ProfilerStats gpu = Profiler.getGpuStats(i);
+
+        std::snprintf(line, sizeof(line), "%*s%-12s %5.2f/%5.2f/%5.2f   %5.2f/%5.2f/%5.2f",
+                      scope.depth * 2, "", scope.name,
+                      cpu.min, cpu.avg, cpu.p99, gpu.min, gpu.avg, gpu.p99);
+
+        RenderText(textShader, line, x, y, scale, color);
+        y -= lineHeight;
+    }
+}
+
+#endif
@@ -0,0 +1,491 @@
+// Reflection probe updated a few steps per frame under a time budget
+//
+// A refresh of the probe is split into small steps: capturing one cube
+// face, building the capture's mip chain, prefiltering one face of one
+// roughness mip, projecting the irradiance into SH. update() runs steps
+// until the next one would exceed the frame's budget, estimated from the
+// GPU time the same kind of step took before (timestamp queries, read back
+// a few frames later). The steps write into the back set of maps; once a
+// refresh is complete the sets are swapped, so shading always samples a
+// complete probe, at most one refresh behind.
+// The irradiance is read back through a pixel buffer with a fence and only
+// projected once the GPU is done with it, on a job of the given JobSystem:
+// neither the CPU nor the GPU stalls on it, the GL thread only copies the
+// readback and uploads the result.
+
+#ifndef REFLECTION_PROBE_H
+#define REFLECTION_PROBE_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "spherical_harmonics.h"
+#include "thread_pool.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const int PROBE_PREFILTER_LEVELS = 5;   // keep in sync with MAX_REFLECTION_LOD in the lighting shader
+const int PROBE_IRRADIANCE_SIZE = 32;   // face size projected into SH
+
+// Draws what the probe sees for one face, into the bound framebuffer
+typedef std::function<void(const glm::mat4& view, const glm::mat4& projection)> ProbeCaptureDraw;
+
+struct ReflectionProbeStats {
+    unsigned int stepsRun;          // this frame
+    float estimatedMs;              // GPU time of this frame's steps, estimated
+    unsigned int refreshes;         // completed since init
+};
+
+class ReflectionProbe
+{
+public:
+    ReflectionProbe()
+        : prefilterShader("shaders/vertex/equirectangular.glsl", "shaders/fragment/cubemap/cubemap_prefilterconv.glsl")
+    {
+    }
+
+    ~ReflectionProbe()
+    {
+        if (jobs)
+            jobs->wait(projection);
+        for (const PendingTiming& timing : timings)
+            glDeleteQueries(2, timing.queries);
+        if (readbackFence)
+            glDeleteSync(readbackFence);
+    }
+
+    ReflectionProbe(const ReflectionProbe&) = delete;
+    ReflectionProbe& operator=(const ReflectionProbe&) = delete;
+
+    // Allocates both sets of maps and renders the first refresh right away.
+    // jobSystem runs the SH projections, it has to outlive the probe
+    void init(const glm::vec3& probePosition, ProbeCaptureDraw captureDraw, int captureResolution = 128,
+              int prefilterResolution = 64, JobSystem& jobSystem = SharedJobs())
+    {
+        jobs = &jobSystem;
+        position = probePosition;
+        draw = captureDraw;
+        captureSize = captureResolution;
+        prefilterSize = prefilterResolution;
+
+        for (Maps& set : maps)
+        {
+            set.environment = createCubemap(captureSize, true);
+            set.prefiltered = createCubemap(prefilterSize, true);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, PROBE_PREFILTER_LEVELS - 1);
+            set.irradianceSH = CreateSH9UniformBuffer(SH9Irradiance{});
+        }
+
+        framebuffer = GLFramebuffer::create();
+        depth = GLRenderbuffer::create();
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, captureSize, captureSize);
+        depth.track(GPUMemory_RenderTargets, GPUTextureBytes(GL_DEPTH_COMPONENT24, captureSize, captureSize));
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        readback = GLBuffer::create();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+        glBufferData(GL_PIXEL_PACK_BUFFER, readbackBytes(), NULL, GL_STREAM_READ);
+        readback.track(GPUMemory_Buffers, readbackBytes());
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        prefilterShader.use();
+        prefilterShader.setInt("environmentMap", 0);
+        prefilterShader.setFloat("environmentResolution", (float)captureSize);
+        prefilterShader.setMat4("projection", captureProjection());
+
+        // nothing to show before the first refresh, so it isn't time sliced
+        refreshNow();
+    }
+
+    // Starts a new refresh from the new position, the current maps stay in use meanwhile
+    void setPosition(const glm::vec3& probePosition)
+    {
+        position = probePosition;
+        invalidate();
+    }
+
+    // Restarts the refresh in progress, for when what the probe sees changed
+    void invalidate()
+    {
+        // a projection in flight belongs to the old refresh
+        if (projecting)
+        {
+            jobs->wait(projection);
+            projecting = false;
+        }
+        step = 0;
+        dirty = true;
+    }
+
+    // Continuous probes start a new refresh as soon as one completes
+    void setContinuous(bool refreshContinuously)
+    {
+        continuous = refreshContinuously;
+    }
+
+    // Runs refresh steps for about budgetMs of GPU time, at least one while a refresh is pending.
+    // Leaves framebuffer 0 bound, the viewport is the caller's to restore
+    void update(float budgetMs)
+    {
+        TRACE_GPU_SCOPE("Reflection probe");
+        resolveTimings();
+
+        stats.stepsRun = 0;
+        stats.estimatedMs = 0.0f;
+        while (dirty || continuous)
+        {
+            const float cost = estimates[stepKind(step)];
+            if (stats.stepsRun > 0 && stats.estimatedMs + cost > budgetMs)
+                break;
+            if (!runStep(false))
+                break; // waiting for the irradiance readback or its projection
+
+            stats.stepsRun++;
+            stats.estimatedMs += cost;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Whole refresh in one go, stalls on the readback and the projection
+    void refreshNow()
+    {
+        TRACE_GPU_SCOPE("Reflection probe refresh");
+        invalidate();
+        const unsigned int completed = stats.refreshes;
+        while (stats.refreshes == completed)
+            runStep(true);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Complete maps of the last refresh
+    unsigned int getEnvironment() const
+    {
+        return maps[1 - write].environment;
+    }
+
+    unsigned int getPrefiltered() const
+    {
+        return maps[1 - write].prefiltered;
+    }
+
+    // SHIrradiance uniform block, bind it to SH_IRRADIANCE_BINDING
+    unsigned int getIrradianceSH() const
+    {
+        return maps[1 - write].irradianceSH;
+    }
+
+    const glm::vec3& getPosition() const
+    {
+        return position;
+    }
+
+    const ReflectionProbeStats& getStats() const
+    {
+        return stats;
+    }
+
+private:
+    enum StepKind {
+        Step_Capture,
+        Step_Mipmaps,
+        Step_Prefilter,     // + mip level
+        Step_Irradiance = Step_Prefilter + PROBE_PREFILTER_LEVELS,
+        Step_KindCount
+    };
+
+    struct Maps {
+        GLTexture environment;
+        GLTexture prefiltered;
+        GLBuffer irradianceSH;
+    };
+
+    struct PendingTiming {
+        unsigned int queries[2];
+        int kind;
+    };
+
+    Shader prefilterShader;
+    ProbeCaptureDraw draw;
+    glm::vec3 position = glm::vec3(0.0f);
+    int captureSize = 128;
+    int prefilterSize = 64;
+
+    Maps maps[2];
+    int write = 0;                  // set the steps render into, the other one is shaded with
+    GLFramebuffer framebuffer;
+    GLRenderbuffer depth;
+    GLBuffer readback;
+    GLsync readbackFence = 0;
+
+    // SH projection of the readback, on a job
+    JobSystem* jobs = nullptr;
+    JobCounter projection;
+    bool projecting = false;
+    std::vector<float> irradianceFaces[6];
+    SH9Irradiance projected = {};
+
+    // steps: 6 captures, mipmaps, 6 per prefilter level, irradiance
+    int step = 0;
+    bool dirty = false;
+    bool continuous = false;
+
+    // GPU milliseconds per step kind, a guess until measured
+    float estimates[Step_KindCount] = { 0.3f, 0.05f, 0.4f, 0.2f, 0.1f, 0.05f, 0.05f, 0.05f };
+    std::deque<PendingTiming> timings;
+    ReflectionProbeStats stats = {};
+
+    static int stepCount()
+    {
+        return 6 + 1 + 6 * PROBE_PREFILTER_LEVELS + 1;
+    }
+
+    static int stepKind(int index)
+    {
+        if (index < 6)
+            return Step_Capture;
+        if (index == 6)
+            return Step_Mipmaps;
+        if (index < 7 + 6 * PROBE_PREFILTER_LEVELS)
+            return Step_Prefilter + (index - 7) / 6;
+        return Step_Irradiance;
+    }
+
+    static glm::mat4 captureProjection()
+    {
+        return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
+    }
+
+    // same orientation as the IBL captures in PBR_setup.h
+    glm::mat4 captureView(int face) const
+    {
+        static const glm::vec3 directions[6] = {
+            glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3( 0.0f,  1.0f,  0.0f),
+            glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 0.0f,  0.0f, -1.0f)
+        };
+        static const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f),
+            glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)
+        };
+        return glm::lookAt(position, position + directions[face], ups[face]);
+    }
+
+    size_t readbackBytes() const
+    {
+        return 6 * (size_t)PROBE_IRRADIANCE_SIZE * PROBE_IRRADIANCE_SIZE * 3 * sizeof(float);
+    }
+
+    int irradianceLevel() const
+    {
+        int level = 0;
+        while ((captureSize >> level) > PROBE_IRRADIANCE_SIZE)
+            level++;
+        return level;
+    }
+
+    static GLTexture createCubemap(int size, bool mipmapped)
+    {
+        GLTexture cubemap = GLTexture::create();
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (mipmapped)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP); // allocates the chain
+        GPUMemoryTrackTexture(cubemap, GPUMemory_Environment, GL_RGB16F, size, size, 6, mipmapped);
+        return cubemap;
+    }
+
+    // false when the step has to wait, block waits instead
+    bool runStep(bool block)
+    {
+        const int kind = stepKind(step);
+        if (kind == Step_Irradiance)
+        {
+            if (!projectIrradiance(block))
+                return false;
+        }
+        else
+        {
+            PendingTiming timing;
+            timing.kind = kind;
+            glGenQueries(2, timing.queries);
+            glQueryCounter(timing.queries[0], GL_TIMESTAMP);
+
+            if (kind == Step_Capture)
+                captureFace(step);
+            else if (kind == Step_Mipmaps)
+                buildMipmaps();
+            else
+                prefilterFace(kind - Step_Prefilter, (step - 7) % 6);
+
+            glQueryCounter(timing.queries[1], GL_TIMESTAMP);
+            timings.push_back(timing);
+        }
+
+        if (++step == stepCount())
+        {
+            // complete, shading switches to it
+            write = 1 - write;
+            step = 0;
+            dirty = false;
+            stats.refreshes++;
+        }
+        return true;
+    }
+
+    void captureFace(int face)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                               maps[write].environment, 0);
+        glViewport(0, 0, captureSize, captureSize);
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        draw(captureView(face), captureProjection());
+    }
+
+    // mips for the prefilter's filtered sampling, and the irradiance readback
+    void buildMipmaps()
+    {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, maps[write].environment);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        const size_t faceBytes = readbackBytes() / 6;
+        for (int face = 0; face < 6; face++)
+        {
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, irradianceLevel(), GL_RGB, GL_FLOAT,
+                          reinterpret_cast<void*>(face * faceBytes));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (readbackFence)
+            glDeleteSync(readbackFence);
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void prefilterFace(int level, int face)
+    {
+        const int size = std::max(prefilterSize >> level, 1);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                               maps[write].prefiltered, level);
+        glViewport(0, 0, size, size);
+        glDisable(GL_DEPTH_TEST);
+
+        prefilterShader.use();
+        prefilterShader.setFloat("roughness", (float)level / (PROBE_PREFILTER_LEVELS - 1));
+        prefilterShader.setMat4("view", captureView(face) * glm::translate(glm::mat4(1.0f), position));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, maps[write].environment);
+        renderCube();
+
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // Copies the readback once the GPU wrote it and projects it on a job, then
+    // uploads the result once the job finished. false while either is pending
+    bool projectIrradiance(bool block)
+    {
+        if (!projecting)
+        {
+            if (readbackFence)
+            {
+                const GLuint64 timeout = block ? 1000000000ull : 0;
+                const GLenum result = glClientWaitSync(readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+                if (result == GL_TIMEOUT_EXPIRED)
+                    return false;
+                glDeleteSync(readbackFence);
+                readbackFence = 0;
+            }
+
+            const auto begin = std::chrono::steady_clock::now();
+            const size_t faceFloats = readbackBytes() / 6 / sizeof(float);
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+            const float* data = static_cast<const float*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readbackBytes(), GL_MAP_READ_BIT));
+            if (data)
+            {
+                for (int face = 0; face < 6; face++)
+                    irradianceFaces[face].assign(data + face * faceFloats, data + (face + 1) * faceFloats);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            // CPU time on the GL thread, it's what this step costs the frame
+            const float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            estimates[Step_Irradiance] = glm::mix(estimates[Step_Irradiance], elapsed, 0.25f);
+
+            if (!data)
+            {
+                std::cout << "ERROR::REFLECTION_PROBE::READBACK_NOT_MAPPED" << std::endl;
+                return true;
+            }
+
+            jobs->submit([this]()
+            {
+                projected = ProjectCubemapSH9(irradianceFaces, PROBE_IRRADIANCE_SIZE, *jobs);
+            }, &projection);
+            projecting = true;
+        }
+
+        if (block)
+            jobs->wait(projection);
+        else if (!projection.done())
+            return false;
+        projecting = false;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, maps[write].irradianceSH);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SH9Irradiance), &projected);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return true;
+    }
+
+    // moving averages of the timings the GPU finished
+    void resolveTimings()
+    {
+        while (!timings.empty())
+        {
+            PendingTiming& timing = timings.front();
+            int available = 0;
+            glGetQueryObjectiv(timing.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(timing.queries[0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(timing.queries[1], GL_QUERY_RESULT, &end);
+            const float ms = (float)(end - begin) / 1000000.0f;
+            estimates[timing.kind] = glm::mix(estimates[timing.kind], ms, 0.25f);
+
+            glDeleteQueries(2, timing.queries);
+            timings.pop_front();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,569 @@
+// Frame render graph with pooled transient render targets
+//
+// Passes are added every frame with a setup callback that declares what
+// they read and write, and an execute callback that records the GL work.
+// A pass can only use textures that exist when it's added, so the order
+// passes are added in is already a valid execution order. execute() then:
+//   - culls passes nothing needs: a pass runs when it has side effects (it
+//     draws to the window), writes an imported texture, or writes a texture
+//     a pass that runs reads;
+//   - gives every transient texture a lifetime from its first to its last
+//     use, and backs it with a pool texture only for that span. Transients
+//     whose lifetimes don't overlap share the same pool texture when their
+//     descriptions match (GL has no memory aliasing across formats), so
+//     render target memory follows the peak of the frame instead of the sum
+//     of every effect's targets;
+//   - binds a cached framebuffer with the pass's attachments and a viewport
+//     matching them before running it, inside a profiler scope.
+// Pool textures unused for a few frames are freed, which is also how
+// window resizes drop the old sizes.
+// Imported textures are owned outside the graph (shadow maps, histories).
+// Modules that ping-pong their output import a getter, resolved when the
+// reading pass runs.
+
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <initializer_list>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+#include "profiler.h"
+#include "trace_events.h"
+
+
+const int RG_MAX_COLOR_ATTACHMENTS = 4;
+const unsigned int RG_POOL_KEEP_FRAMES = 3;    // frames a pool texture survives unused
+
+typedef int RGTexture;
+const RGTexture RG_NONE = -1;
+
+struct RGTextureDesc {
+    int width = 0;
+    int height = 0;
+    GLenum internalFormat = GL_RGBA8;
+    GLenum filter = GL_NEAREST;
+
+    bool operator==(const RGTextureDesc& other) const
+    {
+        return width == other.width && height == other.height && internalFormat == other.internalFormat
+            && filter == other.filter;
+    }
+};
+
+struct RenderGraphStats {
+    unsigned int passes;            // added this frame
+    unsigned int culled;
+    unsigned int transients;        // transient textures used
+    unsigned int poolTextures;      // textures backing them, after aliasing
+    size_t poolBytes;
+};
+
+// Textures and framebuffers reused across passes and frames
+class RenderTargetPool
+{
+public:
+    // A free texture matching the description, created when there's none
+    unsigned int acquire(const RGTextureDesc& desc)
+    {
+        for (Entry& entry : entries)
+        {
+            if (!entry.busy && entry.desc == desc)
+            {
+                entry.busy = true;
+                entry.lastUsedFrame = frame;
+                return entry.texture;
+            }
+        }
+
+        Entry entry;
+        entry.desc = desc;
+        entry.texture = createTexture(desc);
+        entry.busy = true;
+        entry.lastUsedFrame = frame;
+        entries.push_back(std::move(entry));
+        return entries.back().texture;
+    }
+
+    // Free for the following passes, its content stays until they overwrite it
+    void release(unsigned int texture)
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.texture == texture)
+                entry.busy = false;
+        }
+    }
+
+    // Framebuffer with these attachments, made complete once and kept while they live
+    unsigned int getFramebuffer(const unsigned int* colors, int colorCount, unsigned int depth)
+    {
+        for (FramebufferEntry& entry : framebuffers)
+        {
+            if (entry.colorCount == colorCount && entry.depth == depth
+                && std::equal(colors, colors + colorCount, entry.colors))
+            {
+                entry.lastUsedFrame = frame;
+                return entry.framebuffer;
+            }
+        }
+
+        FramebufferEntry entry;
+        entry.framebuffer = GLFramebuffer::create();
+        entry.colorCount = colorCount;
+        entry.depth = depth;
+        entry.lastUsedFrame = frame;
+        std::copy(colors, colors + colorCount, entry.colors);
+
+        GLenum drawBuffers[RG_MAX_COLOR_ATTACHMENTS];
+        glBindFramebuffer(GL_FRAMEBUFFER, entry.framebuffer);
+        for (int i = 0; i < colorCount; i++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        if (depth)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        if (colorCount > 0)
+            glDrawBuffers(colorCount, drawBuffers);
+        else
+            glDrawBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+        framebuffers.push_back(std::move(entry));
+        return framebuffers.back().framebuffer;
+    }
+
+    // Frees what wasn't used for RG_POOL_KEEP_FRAMES frames, once per frame
+    void endFrame()
+    {
+        frame++;
+        const auto stale = [this](unsigned int lastUsedFrame) { return frame - lastUsedFrame > RG_POOL_KEEP_FRAMES; };
+
+        std::vector<unsigned int> freed;
+        for (const Entry& entry : entries)
+        {
+            if (!entry.busy && stale(entry.lastUsedFrame))
+                freed.push_back(entry.texture);
+        }
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry& entry)
+        {
+            return !entry.busy && stale(entry.lastUsedFrame);
+        }), entries.end());
+
+        // framebuffers go with their textures, or when unused themselves
+        framebuffers.erase(std::remove_if(framebuffers.begin(), framebuffers.end(), [&](const FramebufferEntry& entry)
+        {
+            if (stale(entry.lastUsedFrame))
+                return true;
+            for (unsigned int texture : freed)
+            {
+                if (entry.depth == texture || std::find(entry.colors, entry.colors + entry.colorCount, texture) != entry.colors + entry.colorCount)
+                    return true;
+            }
+            return false;
+        }), framebuffers.end());
+    }
+
+    unsigned int getTextureCount() const
+    {
+        return (unsigned int)entries.size();
+    }
+
+    size_t getBytes() const
+    {
+        size_t bytes = 0;
+        for (const Entry& entry : entries)
+            bytes += GPUTextureBytes(entry.desc.internalFormat, entry.desc.width, entry.desc.height);
+        return bytes;
+    }
+
+private:
+    struct Entry {
+        RGTextureDesc desc;
+        GLTexture texture;
+        bool busy = false;
+        unsigned int lastUsedFrame = 0;
+    };
+
+    struct FramebufferEntry {
+        GLFramebuffer framebuffer;
+        unsigned int colors[RG_MAX_COLOR_ATTACHMENTS] = {};
+        int colorCount = 0;
+        unsigned int depth = 0;
+        unsigned int lastUsedFrame = 0;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<FramebufferEntry> framebuffers;
+    unsigned int frame = 0;
+
+    static GLTexture createTexture(const RGTextureDesc& desc)
+    {
+        GLenum format = GL_RGBA, type = GL_FLOAT;
+        switch (desc.internalFormat)
+        {
+            case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F:
+                format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT; break;
+            case GL_DEPTH24_STENCIL8:
+                format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; break;
+            case GL_R8:                 format = GL_RED;  type = GL_UNSIGNED_BYTE; break;
+            case GL_RG8:                format = GL_RG;   type = GL_UNSIGNED_BYTE; break;
+            case GL_RGBA8:              format = GL_RGBA; type = GL_UNSIGNED_BYTE; break;
+            case GL_R16F: case GL_R32F: format = GL_RED;  break;
+            case GL_RG16F: case GL_RG32F: format = GL_RG; break;
+            case GL_RGB16F: case GL_R11F_G11F_B10F: format = GL_RGB; break;
+            default: break;
+        }
+
+        GLTexture texture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(texture, GPUMemory_RenderTargets, desc.internalFormat, desc.width, desc.height);
+        return texture;
+    }
+};
+
+class RenderGraph;
+
+// Handed to a pass's setup, declares its resources
+class RGPassBuilder
+{
+public:
+    // New transient texture, written by this pass
+    RGTexture create(const char* name, const RGTextureDesc& desc);
+
+    RGTexture read(RGTexture texture);
+
+    // Written by the pass's own framebuffers (or a module it calls)
+    RGTexture write(RGTexture texture);
+
+    // Written through the framebuffer the graph binds, in attachment order
+    RGTexture colorAttachment(RGTexture texture);
+    RGTexture depthAttachment(RGTexture texture);
+
+    // Draws into the window, the graph binds framebuffer 0 with this viewport
+    void windowOutput(int width, int height);
+
+    // Never culled
+    void sideEffect();
+
+private:
+    friend class RenderGraph;
+    RGPassBuilder(RenderGraph& owner, int passIndex) : graph(owner), pass(passIndex) {}
+
+    RenderGraph& graph;
+    int pass;
+};
+
+// Handed to a pass's execute, resolves its resources
+class RGResources
+{
+public:
+    unsigned int texture(RGTexture handle) const;
+    const RGTextureDesc& desc(RGTexture handle) const;
+
+    // For passes rendering into several targets in turn, binds a cached framebuffer and its viewport
+    void bindFramebuffer(std::initializer_list<RGTexture> colors, RGTexture depth = RG_NONE) const;
+
+private:
+    friend class RenderGraph;
+    explicit RGResources(RenderGraph& owner) : graph(owner) {}
+
+    RenderGraph& graph;
+};
+
+class RenderGraph
+{
+public:
+    typedef std::function<void(RGPassBuilder&)> Setup;
+    typedef std::function<void(const RGResources&)> Execute;
+
+    // name: a literal, it's kept for the profiler
+    void addPass(const char* name, const Setup& setup, const Execute& execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.execute = execute;
+        passes.push_back(std::move(pass));
+
+        RGPassBuilder builder(*this, (int)passes.size() - 1);
+        setup(builder);
+    }
+
+    // Texture owned outside the graph, desc only needed when it's attached
+    RGTexture importTexture(const char* name, unsigned int texture, const RGTextureDesc& desc = RGTextureDesc())
+    {
+        return importTexture(name, [texture]() { return texture; }, desc);
+    }
+
+    // For outputs that change between frames, resolved when a pass runs
+    RGTexture importTexture(const char* name, const std::function<unsigned int()>& texture, const RGTextureDesc& desc = RGTextureDesc())
+    {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resource.imported = texture;
+        resources.push_back(std::move(resource));
+        return (RGTexture)resources.size() - 1;
+    }
+
+    // Culls, allocates and runs the passes added this frame, then starts the next one
+    void execute()
+    {
+        TRACE_SCOPE("RenderGraph::execute");
+
+        cull();
+        computeLifetimes();
+
+        RGResources context(*this);
+        stats.passes = (unsigned int)passes.size();
+        stats.culled = 0;
+        stats.transients = 0;
+        for (int i = 0; i < (int)passes.size(); i++)
+        {
+            Pass& pass = passes[i];
+            if (!pass.alive)
+            {
+                stats.culled++;
+                continue;
+            }
+
+            for (int handle : pass.acquires)
+            {
+                resources[handle].texture = pool.acquire(resources[handle].desc);
+                stats.transients++;
+            }
+
+            const int scope = Profiler.beginScope(pass.name);
+            bindTargets(pass);
+            pass.execute(context);
+            Profiler.endScope(scope);
+
+            for (int handle : pass.releases)
+                pool.release(resources[handle].texture);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        stats.poolTextures = pool.getTextureCount();
+        stats.poolBytes = pool.getBytes();
+        pool.endFrame();
+        passes.clear();
+        resources.clear();
+    }
+
+    const RenderGraphStats& getStats() const
+    {
+        return stats;
+    }
+
+private:
+    friend class RGPassBuilder;
+    friend class RGResources;
+
+    struct Resource {
+        std::string name;
+        RGTextureDesc desc;
+        std::function<unsigned int()> imported;  // empty for transients
+        int producer = -1;                       // pass that created it
+        unsigned int texture = 0;                // pool texture while it's alive
+        bool needed = false;
+        int firstUse = -1, lastUse = -1;
+    };
+
+    struct Pass {
+        const char* name = "";
+        Execute execute;
+        std::vector<int> reads;
+        std::vector<int> writes;
+        int colors[RG_MAX_COLOR_ATTACHMENTS];
+        int colorCount = 0;
+        int depth = RG_NONE;
+        bool window = false;
+        int windowWidth = 0, windowHeight = 0;
+        bool sideEffect = false;
+        bool alive = false;
+        std::vector<int> acquires;   // transients first used here
+        std::vector<int> releases;   // transients last used here
+    };
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    RenderTargetPool pool;
+    RenderGraphStats stats = {};
+
+    bool valid(RGTexture handle) const
+    {
+        return handle >= 0 && handle < (int)resources.size();
+    }
+
+    // Backwards: a pass runs if it has side effects or produces something a running pass needs
+    void cull()
+    {
+        for (int i = (int)passes.size() - 1; i >= 0; i--)
+        {
+            Pass& pass = passes[i];
+            pass.alive = pass.sideEffect || pass.window;
+            for (int handle : pass.writes)
+                pass.alive = pass.alive || resources[handle].needed || resources[handle].imported;
+
+            if (pass.alive)
+            {
+                for (int handle : pass.reads)
+                    resources[handle].needed = true;
+            }
+        }
+    }
+
+    void computeLifetimes()
+    {
+        for (int i = 0; i < (int)passes.size(); i++)
+        {
+            if (!passes[i].alive)
+                continue;
+
+            const auto use = [&](int handle)
+            {
+                Resource& resource = resources[handle];
+                if (resource.imported)
+                    return;
+                if (resource.firstUse < 0)
+                    resource.firstUse = i;
+                resource.lastUse = i;
+            };
+            for (int handle : passes[i].reads)
+                use(handle);
+            for (int handle : passes[i].writes)
+                use(handle);
+        }
+
+        for (int handle = 0; handle < (int)resources.size(); handle++)
+        {
+            const Resource& resource = resources[handle];
+            if (resource.firstUse < 0)
+                continue;
+            if (resource.producer < 0 || !passes[resource.producer].alive || resource.producer > resource.firstUse)
+                std::cout << "ERROR::RENDER_GRAPH::READ_BEFORE_WRITE: " << resource.name << std::endl;
+            passes[resource.firstUse].acquires.push_back(handle);
+            passes[resource.lastUse].releases.push_back(handle);
+        }
+    }
+
+    void bindTargets(const Pass& pass)
+    {
+        if (pass.window)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, pass.windowWidth, pass.windowHeight);
+        }
+        else if (pass.colorCount > 0 || pass.depth != RG_NONE)
+        {
+            bindFramebuffer(pass.colors, pass.colorCount, pass.depth);
+        }
+    }
+
+    void bindFramebuffer(const int* colors, int colorCount, int depth)
+    {
+        unsigned int textures[RG_MAX_COLOR_ATTACHMENTS];
+        for (int i = 0; i < colorCount; i++)
+            textures[i] = resolve(colors[i]);
+        const unsigned int depthTexture = depth != RG_NONE ? resolve(depth) : 0;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, pool.getFramebuffer(textures, colorCount, depthTexture));
+        const RGTextureDesc& size = resources[colorCount > 0 ? colors[0] : depth].desc;
+        glViewport(0, 0, size.width, size.height);
+    }
+
+    unsigned int resolve(RGTexture handle) const
+    {
+        if (!valid(handle))
+            return 0;
+        const Resource& resource = resources[handle];
+        return resource.imported ? resource.imported() : resource.texture;
+    }
+};
+
+
+inline RGTexture RGPassBuilder::create(const char* name, const RGTextureDesc& desc)
+{
+    RenderGraph::Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resource.producer = pass;
+    graph.resources.push_back(std::move(resource));
+    return write((RGTexture)graph.resources.size() - 1);
+}
+
+inline RGTexture RGPassBuilder::read(RGTexture texture)
+{
+    if (graph.valid(texture))
+        graph.passes[pass].reads.push_back(texture);
+    return texture;
+}
+
+inline RGTexture RGPassBuilder::write(RGTexture texture)
+{
+    if (graph.valid(texture))
+        graph.passes[pass].writes.push_back(texture);
+    return texture;
+}
+
+inline RGTexture RGPassBuilder::colorAttachment(RGTexture texture)
+{
+    RenderGraph::Pass& target = graph.passes[pass];
+    if (target.colorCount >= RG_MAX_COLOR_ATTACHMENTS)
+    {
+        std::cout << "ERROR::RENDER_GRAPH::TOO_MANY_ATTACHMENTS: " << target.name << std::endl;
+        return texture;
+    }
+    target.colors[target.colorCount++] = texture;
+    return write(texture);
+}
+
+inline RGTexture RGPassBuilder::depthAttachment(RGTexture texture)
+{
+    graph.passes[pass].depth = texture;
+    return write(texture);
+}
+
+inline void RGPassBuilder::windowOutput(int width, int height)
+{
+    RenderGraph::Pass& target = graph.passes[pass];
+    target.window = true;
+    target.windowWidth = width;
+    target.windowHeight = height;
+}
+
+inline void RGPassBuilder::sideEffect()
+{
+    graph.passes[pass].sideEffect = true;
+}
+
+inline unsigned int RGResources::texture(RGTexture handle) const
+{
+    return graph.resolve(handle);
+}
+
+inline const RGTextureDesc& RGResources::desc(RGTexture handle) const
+{
+    return graph.resources[handle].desc;
+}
+
+inline void RGResources::bindFramebuffer(std::initializer_list<RGTexture> colors, RGTexture depth) const
+{
+    const int colorCount = std::min((int)colors.size(), RG_MAX_COLOR_ATTACHMENTS);
+    graph.bindFramebuffer(colors.begin(), colorCount, depth);
+}
+
+#endif
@@ -2,27 +2,23 @@
 #define RENDER_SHAPES_H
 
 #include <vector>
+#include <cmath>
 
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
 
+#include "geometry_arena.h"
 
-// renders (and builds at first invocation) a sphere
-// -------------------------------------------------
-void renderSphere()
+
+// builds (at first invocation) a sphere, drawn as GL_TRIANGLE_STRIP
+// ------------------------------------------------------------------
+const GeometryAllocation& sphereGeometry()
 {
-    static unsigned int sphereVAO = 0;
-    static unsigned int indexCount;
+    static GeometryAllocation sphere;
 
-    if (sphereVAO == 0)
+    if (sphere.getRange().indexCount == 0)
     {
-        glGenVertexArrays(1, &sphereVAO);
-
-        unsigned int vbo, ebo;
-        glGenBuffers(1, &vbo);
-        glGenBuffers(1, &ebo);
-
         std::vector<glm::vec3> positions;
         std::vector<glm::vec2> uv;
         std::vector<glm::vec3> normals;
@@ -69,8 +65,6 @@ void renderSphere()
             }
             oddRow = !oddRow;
         }
-        indexCount = static_cast<unsigned int>(indices.size());
-
         std::vector<float> data;
         for (unsigned int i = 0; i < positions.size(); ++i)
         {
@@ -89,29 +83,23 @@ void renderSphere()
                 data.push_back(uv[i].y);
             }
         }
-        glBindVertexArray(sphereVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), &data[0], GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-        unsigned int stride = (3 + 2 + 3) * sizeof(float);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-        glEnableVertexAttribArray(1);        
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));        
+        sphere = GeometryAllocation(VertexLayout_PosNormalUV, data.data(), static_cast<unsigned int>(positions.size()),
+                                    indices.data(), static_cast<unsigned int>(indices.size()));
     }
 
-    glBindVertexArray(sphereVAO);
-    glDrawElements(GL_TRIANGLE_STRIP, indexCount, GL_UNSIGNED_INT, 0);
+    return sphere;
+}
+
+void renderSphere()
+{
+    sphereGeometry().draw(GL_TRIANGLE_STRIP);
 }
 
 void renderQuad()
 {
-    static unsigned int quadVAO = 0;
+    static GeometryAllocation quad;
     
-    if (quadVAO == 0)
+    if (quad.getRange().indexCount == 0)
     {
         const float vertices[] = {
             -1.0f, -1.0f,   0.0f, 0.0f,  // Bottom-left
@@ -120,29 +108,19 @@ void renderQuad()
             1.0f,  1.0f,   1.0f, 1.0f,   // Top-right
         };
 
-        unsigned int vbo;
-        glGenVertexArrays(1, &quadVAO);
-        glGenBuffers(1, &vbo);
+        const unsigned int indices[] = { 0, 1, 2, 3 };
 
-        glBindVertexArray(quadVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+        quad = GeometryAllocation(VertexLayout_PosUV, vertices, 4, indices, 4);
     }
 
-    glBindVertexArray(quadVAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    quad.draw(GL_TRIANGLE_STRIP);
 }
 
 void renderCube()
 {
-    static unsigned int cubeVAO = 0;
+    static GeometryAllocation cube;
     
-    if (cubeVAO == 0)
+    if (cube.getRange().indexCount == 0)
     {
         const float vertices[] = {
             // Back face (z = -1.0)
@@ -194,24 +172,15 @@ void renderCube()
             -1.0f,  1.0f,  1.0f,   0.0f,  1.0f,  0.0f,   0.0f, 0.0f,
         };
 
-        unsigned int vbo;
-        glGenVertexArrays(1, &cubeVAO);
-        glGenBuffers(1, &vbo);
-
-        glBindVertexArray(cubeVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        // every vertex is used once
+        unsigned int indices[36];
+        for (unsigned int i = 0; i < 36; i++)
+            indices[i] = i;
 
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+        cube = GeometryAllocation(VertexLayout_PosNormalUV, vertices, 36, indices, 36);
     }
 
-    glBindVertexArray(cubeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    cube.draw(GL_TRIANGLES);
 }
 
 #endif
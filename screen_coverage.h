@@ -0,0 +1,25 @@
+// Screen size of bounding spheres, shared by everything that picks a
+// resolution from how large something is on screen (texture streaming,
+// shadow atlas tiles)
+
+#ifndef SCREEN_COVERAGE_H
+#define SCREEN_COVERAGE_H
+
+#include <limits>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+
+// Projected diameter in pixels of a bounding sphere, "infinite" once the camera is inside it
+inline float ScreenCoverage(const glm::vec3& center, float radius, const glm::mat4& view, float fovY,
+                            float viewportHeight)
+{
+    const float distance = -(view * glm::vec4(center, 1.0f)).z;
+    if (distance <= radius)
+        return std::numeric_limits<float>::max();
+
+    return radius / (distance * std::tan(fovY * 0.5f)) * viewportHeight;
+}
+
+#endif
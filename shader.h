@@ -5,10 +5,15 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
   
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
 
+#include "trace_events.h"
+#include "gl_resources.h"
 
+
+// Owns its program, move-only
 class Shader
 {
 public:
@@ -18,6 +23,8 @@ public:
     // constructor reads and builds the shader
     Shader(const char* vertexPath, const char* fragmentPath)
     {
+        TRACE_SCOPE_DETAIL("Shader compile", fragmentPath);
+
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -82,7 +89,8 @@ public:
         };
 
         // shader Program
-        ID = glCreateProgram();
+        program = GLProgram::create();
+        ID = program;
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         glLinkProgram(ID);
@@ -102,6 +110,8 @@ public:
 
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
     {
+        TRACE_SCOPE_DETAIL("Shader compile", fragmentPath);
+
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -187,7 +197,8 @@ public:
         };
 
         // shader Program
-        ID = glCreateProgram();
+        program = GLProgram::create();
+        ID = program;
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         glAttachShader(ID, geometry);
@@ -207,10 +218,78 @@ public:
         glDeleteShader(geometry);
     }
 
-    // voluntary destructor
+    // compute program, needs a GL 4.3 context
+    explicit Shader(const char* computePath)
+    {
+        TRACE_SCOPE_DETAIL("Shader compile", computePath);
+
+        // 1. retrieve the compute source code from filePath
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        // ensure ifstream objects can throw exceptions:
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+
+        // 2. compile shader
+        unsigned int compute;
+        int success;
+        char infoLog[512];
+
+        compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        // print compile errors if any
+        glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+        if(!success)
+        {
+            glGetShaderInfoLog(compute, 512, NULL, infoLog);
+            std::cout << "In file " << computePath << '\n'
+                      << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+        };
+
+        // shader Program
+        program = GLProgram::create();
+        ID = program;
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        // print linking errors if any
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            glGetProgramInfoLog(ID, 512, NULL, infoLog);
+            std::cout << "File " << computePath << '\n'
+                      << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        }
+
+        glDeleteShader(compute);
+    }
+
+    Shader(Shader&& other) noexcept : ID(other.ID), program(std::move(other.program)) { other.ID = 0; }
+    Shader& operator=(Shader&& other) noexcept
+    {
+        program = std::move(other.program);
+        ID = other.ID;
+        other.ID = 0;
+        return *this;
+    }
+
+    // voluntary destructor, the program is deleted with the Shader otherwise
     void deleteProgram()
     {
-        glDeleteProgram(ID);
+        program.reset();
+        ID = 0;
     }
 
     // use/activate the shader
@@ -247,6 +326,10 @@ public:
     { 
         glUniform3f(glGetUniformLocation(ID, name.c_str()), values.x, values.y, values.z);
     }
+    void setVec4(const std::string &name, glm::vec4 values) const
+    { 
+        glUniform4f(glGetUniformLocation(ID, name.c_str()), values.x, values.y, values.z, values.w);
+    }
     void setMat3(const std::string &name, glm::mat3 matrix) const
     {
         glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(matrix));
@@ -262,6 +345,9 @@ public:
         glUniformBlockBinding(shader.ID, uniform_block_index, binding_point);
     }
 
+private:
+    GLProgram program;
+
 };
 
 #endif
@@ -0,0 +1,130 @@
+#version 430 core
+
+// Frustum and Hi-Z occlusion culling, one thread per object.
+// Writes one DrawElementsIndirectCommand per visible object, baseInstance
+// carries the object index to the vertex shader.
+
+layout (local_size_x = 64) in;
+
+struct Object {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 boundsMin;   // local space AABB
+    vec4 boundsMax;
+    uvec4 draw;       // indexCount, firstIndex, baseVertex, unused
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int  baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Objects {
+    Object objects[];
+};
+
+layout (std430, binding = 1) writeonly buffer Commands {
+    DrawCommand commands[];
+};
+
+layout (std430, binding = 2) buffer DrawCount {
+    uint drawCount;
+};
+
+layout (binding = 0) uniform sampler2D depthPyramid;
+
+uniform int objectCount;
+uniform vec4 frustumPlanes[6];    // world space, normals point inside
+uniform bool occlusionCulling;
+uniform mat4 pyramidViewProjection; // the frame the pyramid was built from
+uniform int pyramidLevels;
+uniform bool compact;             // pack visible commands and count them, else culled ones get 0 instances
+
+
+bool insideFrustum(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 plane = frustumPlanes[i];
+        if (dot(plane.xyz, center) + plane.w < -dot(abs(plane.xyz), extent))
+            return false;
+    }
+    return true;
+}
+
+bool passesOcclusion(vec3 center, vec3 extent)
+{
+    vec2 uvMin = vec2(1.0);
+    vec2 uvMax = vec2(0.0);
+    float nearestDepth = 1.0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                                   (i & 2) != 0 ? 1.0 : -1.0,
+                                                   (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = pyramidViewProjection * vec4(corner, 1.0);
+
+        // crosses the near plane, can't say anything
+        if (clip.w <= 0.0)
+            return true;
+
+        vec3 ndc = clip.xyz / clip.w;
+        uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+        uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+        nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+    }
+
+    uvMin = clamp(uvMin, 0.0, 1.0);
+    uvMax = clamp(uvMax, 0.0, 1.0);
+
+    // the level where the rectangle covers at most 2x2 texels
+    vec2 size = (uvMax - uvMin) * vec2(textureSize(depthPyramid, 0));
+    int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, pyramidLevels - 1);
+
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+    ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+    float farthest = max(max(texelFetch(depthPyramid, texelMin, level).r,
+                                   texelFetch(depthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+                               max(texelFetch(depthPyramid, ivec2(texelMin.x, texelMax.y), level).r,
+                                   texelFetch(depthPyramid, texelMax, level).r));
+
+    return nearestDepth <= farthest;
+}
+
+void main()
+{
+    int id = int(gl_GlobalInvocationID.x);
+    if (id >= objectCount)
+        return;
+
+    Object object = objects[id];
+
+    // world space AABB around the transformed local box
+    vec3 localCenter = (object.boundsMin.xyz + object.boundsMax.xyz) * 0.5;
+    vec3 localExtent = (object.boundsMax.xyz - object.boundsMin.xyz) * 0.5;
+    vec3 center = vec3(object.model * vec4(localCenter, 1.0));
+    mat3 absModel = mat3(abs(object.model[0].xyz), abs(object.model[1].xyz), abs(object.model[2].xyz));
+    vec3 extent = absModel * localExtent;
+
+    bool visible = insideFrustum(center, extent);
+    if (visible && occlusionCulling)
+        visible = passesOcclusion(center, extent);
+
+    DrawCommand command;
+    command.count = object.draw.x;
+    command.instanceCount = visible ? 1u : 0u;
+    command.firstIndex = object.draw.y;
+    command.baseVertex = int(object.draw.z);
+    command.baseInstance = uint(id);
+
+    if (!compact)
+        commands[id] = command;
+    else if (visible)
+        commands[atomicAdd(drawCount, 1u)] = command;
+}
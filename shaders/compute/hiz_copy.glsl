@@ -0,0 +1,18 @@
+#version 430 core
+
+// Copies the depth buffer into level 0 of the depth pyramid
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D depthMap;
+layout (r32f, binding = 0) uniform writeonly image2D pyramidLevel;
+
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, imageSize(pyramidLevel))))
+        return;
+
+    imageStore(pyramidLevel, texel, vec4(texelFetch(depthMap, texel, 0).r));
+}
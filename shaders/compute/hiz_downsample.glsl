@@ -0,0 +1,42 @@
+#version 430 core
+
+// Builds the next pyramid level, each texel keeps the farthest depth it covers
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D pyramid;
+layout (r32f, binding = 0) uniform writeonly image2D dstLevel;
+
+uniform int srcLevel;
+
+
+float fetchDepth(ivec2 texel, ivec2 srcSize)
+{
+    return texelFetch(pyramid, min(texel, srcSize - 1), srcLevel).r;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(dstLevel);
+    if (any(greaterThanEqual(texel, dstSize)))
+        return;
+
+    ivec2 srcSize = textureSize(pyramid, srcLevel);
+    ivec2 src = texel * 2;
+
+    float depth = max(max(fetchDepth(src, srcSize), fetchDepth(src + ivec2(1, 0), srcSize)),
+                      max(fetchDepth(src + ivec2(0, 1), srcSize), fetchDepth(src + ivec2(1, 1), srcSize)));
+
+    // odd sizes: the last column/row also covers the texels that don't fit into 2x2
+    bool extraColumn = (srcSize.x & 1) != 0 && texel.x == dstSize.x - 1;
+    bool extraRow = (srcSize.y & 1) != 0 && texel.y == dstSize.y - 1;
+    if (extraColumn)
+        depth = max(depth, max(fetchDepth(src + ivec2(2, 0), srcSize), fetchDepth(src + ivec2(2, 1), srcSize)));
+    if (extraRow)
+        depth = max(depth, max(fetchDepth(src + ivec2(0, 2), srcSize), fetchDepth(src + ivec2(1, 2), srcSize)));
+    if (extraColumn && extraRow)
+        depth = max(depth, fetchDepth(src + ivec2(2, 2), srcSize));
+
+    imageStore(dstLevel, texel, vec4(depth));
+}
@@ -10,9 +10,7 @@ uniform samplerCube environmentMap;
 void main()
 {
     vec3 envColor = texture(environmentMap, localPos).rgb;
-    
-    envColor = envColor / (envColor + vec3(1.0));
-    envColor = pow(envColor, vec3(1.0/2.2)); 
-  
+
+    // linear HDR, tonemapped after the bloom
     FragColor = vec4(envColor, 1.0);
 }
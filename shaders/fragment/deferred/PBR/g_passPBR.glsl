@@ -10,9 +10,7 @@ in vec3 Normal;
 
 uniform sampler2D albedoMap;
 uniform sampler2D normalMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
+uniform sampler2D ormMap; // r = ao, g = roughness, b = metallic
 
 
 vec3 getNormalFromMap(); // inefficient tangent space calculation here
@@ -28,9 +26,10 @@ void main()
     gAlbedoAo.rgb = texture(albedoMap, TexCoords).rgb;
 
     // Store roughness, metalic and ao in the remaining spots in the buffers
-    gPositionMetallic.a = texture(metallicMap,  TexCoords).r;
-    gNormalRoughness.a  = texture(roughnessMap, TexCoords).r;
-    gAlbedoAo.a         = texture(aoMap,        TexCoords).r;
+    vec3 orm = texture(ormMap, TexCoords).rgb;
+    gPositionMetallic.a = orm.b;
+    gNormalRoughness.a  = orm.g;
+    gAlbedoAo.a         = orm.r;
 }
 
 vec3 getNormalFromMap()
@@ -0,0 +1,58 @@
+#version 330 core
+
+layout (location = 0) out vec4 gPositionMetallic;
+layout (location = 1) out vec4 gNormalRoughness;
+layout (location = 2) out vec4 gAlbedoAo;
+
+in vec2 TexCoords;
+in vec3 WorldPos;
+in vec3 Normal;
+flat in int MaterialId;
+
+// layers of each material in the arrays, size matches MATERIAL_MAX_COUNT
+layout (std140) uniform Materials {
+    ivec4 layers[256]; // x = albedo, y = normal, z = orm
+};
+
+uniform sampler2DArray albedoArray;
+uniform sampler2DArray normalArray;
+uniform sampler2DArray ormArray; // r = ao, g = roughness, b = metallic
+
+
+vec3 getNormalFromMap(ivec4 layer); // inefficient tangent space calculation here
+
+
+void main()
+{
+    ivec4 layer = layers[MaterialId];
+
+    // store the fragment position vector in the first gbuffer texture
+    gPositionMetallic.rgb = WorldPos;
+    // also store the per-fragment normals into the gbuffer
+    gNormalRoughness.rgb = getNormalFromMap(layer);
+    // and the diffuse per-fragment color
+    gAlbedoAo.rgb = texture(albedoArray, vec3(TexCoords, layer.x)).rgb;
+
+    // Store roughness, metalic and ao in the remaining spots in the buffers
+    vec3 orm = texture(ormArray, vec3(TexCoords, layer.z)).rgb;
+    gPositionMetallic.a = orm.b;
+    gNormalRoughness.a  = orm.g;
+    gAlbedoAo.a         = orm.r;
+}
+
+vec3 getNormalFromMap(ivec4 layer)
+{
+    vec3 tangentNormal = texture(normalArray, vec3(TexCoords, layer.y)).xyz * 2.0 - 1.0;
+
+    vec3 Q1  = dFdx(WorldPos);
+    vec3 Q2  = dFdy(WorldPos);
+    vec2 st1 = dFdx(TexCoords);
+    vec2 st2 = dFdy(TexCoords);
+
+    vec3 N   = normalize(Normal);
+    vec3 T  = normalize(Q1*st2.t - Q2*st1.t);
+    vec3 B  = -normalize(cross(N, T));
+    mat3 TBN = mat3(T, B, N);
+
+    return normalize(TBN * tangentNormal);
+}
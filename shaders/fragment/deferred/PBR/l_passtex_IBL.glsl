@@ -1,4 +1,5 @@
 #version 330 core
+#extension GL_ARB_texture_cube_map_array : enable
 
 out vec4 FragColor;
 
@@ -8,18 +9,50 @@ in vec2 TexCoords;
 uniform sampler2D PositionMetallicMap;
 uniform sampler2D normalRoughnessMap;
 uniform sampler2D AlbedoAoMap;
+uniform sampler2D ssaoMap;     // screen space AO, combined with the material's
 
-// diffuse irradiance map (indirect/ambient lighting)
-uniform samplerCube irradianceMap;
+// diffuse irradiance (indirect/ambient lighting) as 9 SH coefficients,
+// convolved and prescaled on the CPU, see spherical_harmonics.h
+layout (std140) uniform SHIrradiance {
+    vec4 shCoefficients[9];
+};
 
 // pre-convoluted maps for specular IBL
 uniform samplerCube prefilterMap;
 uniform sampler2D   brdfLUT;
 
+// local probes, box projected, see probe_grid.h. Without cubemap arrays only the global maps are used
+const int MAX_REFLECTION_PROBES = 16;
+struct ProbeData {
+    vec4 boxMin;        // w: blend distance
+    vec4 boxMax;        // w: cubemap array layer
+    vec4 position;      // capture point
+    vec4 sh[9];
+};
+layout (std140) uniform ReflectionProbes {
+    ProbeData probes[MAX_REFLECTION_PROBES];
+};
+uniform int probeCount;
+uniform usampler2D probeTiles;  // per screen tile up to 4 probes, index + 1, smallest box first
+uniform int probeTileSize;
+#ifdef GL_ARB_texture_cube_map_array
+uniform samplerCubeArray probeArray;
+#endif
+
 // lights
 uniform vec3 lightPositions[4];
 uniform vec3 lightColors[4];
 
+// cached point light shadows, one atlas tile per light and cube face
+uniform sampler2DShadow pointShadowAtlas;
+uniform vec4 pointShadowTiles[24];      // x, y, size in atlas uv, size 0 = not shadowed
+uniform vec2 pointShadowDepthRange[4];  // near, far of the face projections
+
+// directional light, its cascaded shadows resolved to a screen space mask
+uniform vec3 sunDirection; // from the light into the scene
+uniform vec3 sunColor;
+uniform sampler2D sunShadowMask;
+
 uniform vec3 camPos;
 
 const float PI = 3.14159265359;
@@ -30,6 +63,11 @@ float GeometrySchlickGGX(float NdotV, float roughness);
 float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness);
 vec3 fresnelSchlick(float cosTheta, vec3 F0);
 vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
+float pointShadow(int light, vec3 worldPos, vec3 N);
+vec3 cookTorrance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness);
+vec3 irradianceSH(vec3 N);
+vec3 irradianceSHProbe(int probe, vec3 N);
+float localProbes(vec3 worldPos, vec3 N, vec3 R, float lod, inout vec3 irradiance, inout vec3 prefiltered);
 
 
 void main()
@@ -44,7 +82,7 @@ void main()
     vec3 albedo     = pow(albedoAoSample.rgb, vec3(2.2));
     float metallic  = posMetalSample.a;
     float roughness = normRoughSample.a;
-    float ao        = albedoAoSample.a;
+    float ao        = albedoAoSample.a * texture(ssaoMap, TexCoords).r;
 
     vec3 V = normalize(camPos - WorldPos);
 
@@ -59,40 +97,35 @@ void main()
     {
         // calculate per-light radiance
         vec3 L = normalize(lightPositions[i] - WorldPos);
-        vec3 H = normalize(V + L);
         float distance    = length(lightPositions[i] - WorldPos);
         float attenuation = 1.0 / (distance * distance);
-        vec3 radiance     = lightColors[i] * attenuation;        
+        vec3 radiance     = lightColors[i] * attenuation * pointShadow(i, WorldPos, N);
         
-        // cook-torrance brdf
-        float NDF = DistributionGGX(N, H, roughness);        
-        float G   = GeometrySmith(N, V, L, roughness);      
-        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);       
-        
-        vec3 kS = F;
-        vec3 kD = vec3(1.0) - kS;
-        kD *= 1.0 - metallic;	  
-        
-        vec3 numerator    = NDF * G * F;
-        float denominator = 4.0 * NdotV * max(dot(N, L), 0.0) + 0.0001;
-        vec3 specular     = numerator / denominator;  
-            
-        // add to outgoing radiance Lo
-        float NdotL = max(dot(N, L), 0.0);                
-        Lo += (kD * albedo / PI + specular) * radiance * NdotL; 
+        Lo += cookTorrance(N, V, L, radiance, albedo, F0, metallic, roughness);
     }
 
-    // Indirect ambient (diffuse) lighting
+    // sun
+    vec3 sunL = normalize(-sunDirection);
+    if (dot(N, sunL) > 0.0)
+        Lo += cookTorrance(N, V, sunL, sunColor * texture(sunShadowMask, TexCoords).r, albedo, F0, metallic, roughness);
+
+    // Indirect ambient lighting, diffuse and specular
     vec3 kS = fresnelSchlickRoughness(NdotV, F0, roughness);
     vec3 kD = 1.0 - kS;
-    vec3 irradiance = texture(irradianceMap, N).rgb;
-    vec3 diffuse    = irradiance * albedo;
-
-    // Indirect specular reflections
-    vec3 R = reflect(-V, N);   
-
+    vec3 R = reflect(-V, N);
     const float MAX_REFLECTION_LOD = 4.0;
-    vec3 prefilteredColor = textureLod(prefilterMap, R,  roughness * MAX_REFLECTION_LOD).rgb;
+    float lod = roughness * MAX_REFLECTION_LOD;
+
+    // local probes first, the global maps fill in the weight they leave
+    vec3 irradiance       = vec3(0.0);
+    vec3 prefilteredColor = vec3(0.0);
+    float globalWeight = localProbes(WorldPos, N, R, lod, irradiance, prefilteredColor);
+    if (globalWeight > 0.0)
+    {
+        irradiance       += globalWeight * irradianceSH(N);
+        prefilteredColor += globalWeight * textureLod(prefilterMap, R, lod).rgb;
+    }
+    vec3 diffuse = irradiance * albedo;
 
     vec2 envBRDF  = texture(brdfLUT, vec2(NdotV, roughness)).rg;
     vec3 specular = prefilteredColor * (kS * envBRDF.x + envBRDF.y);
@@ -100,14 +133,76 @@ void main()
     vec3 ambient    = (kD * diffuse + specular) * ao;
 
     vec3 color = ambient + Lo;
-	
-    color = color / (color + vec3(1.0));
-    color = pow(color, vec3(1.0/2.2));  
-   
+
+    // linear HDR, tonemapped after the bloom
     FragColor = vec4(color, 1.0);
 }
 
 
+vec3 cookTorrance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness)
+{
+    vec3 H = normalize(V + L);
+
+    // cook-torrance brdf
+    float NDF = DistributionGGX(N, H, roughness);
+    float G   = GeometrySmith(N, V, L, roughness);
+    vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+    vec3 kS = F;
+    vec3 kD = vec3(1.0) - kS;
+    kD *= 1.0 - metallic;
+
+    float NdotL = max(dot(N, L), 0.0);
+    vec3 numerator    = NDF * G * F;
+    float denominator = 4.0 * max(dot(N, V), 0.0) * NdotL + 0.0001;
+    vec3 specular     = numerator / denominator;
+
+    // outgoing radiance
+    return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+
+// 1 lit, 0 shadowed. The face and its texel follow the cubemap face selection rules
+float pointShadow(int light, vec3 worldPos, vec3 N)
+{
+    vec3 d = worldPos + N * 0.05 - lightPositions[light];
+    vec3 a = abs(d);
+
+    int face;
+    float ma;
+    vec2 st;
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        ma = a.x;
+        face = d.x > 0.0 ? 0 : 1;
+        st = d.x > 0.0 ? vec2(-d.z, -d.y) : vec2(d.z, -d.y);
+    }
+    else if (a.y >= a.z)
+    {
+        ma = a.y;
+        face = d.y > 0.0 ? 2 : 3;
+        st = d.y > 0.0 ? vec2(d.x, d.z) : vec2(d.x, -d.z);
+    }
+    else
+    {
+        ma = a.z;
+        face = d.z > 0.0 ? 4 : 5;
+        st = d.z > 0.0 ? vec2(d.x, -d.y) : vec2(-d.x, -d.y);
+    }
+
+    vec4 tile = pointShadowTiles[light * 6 + face];
+    vec2 range = pointShadowDepthRange[light];
+    if (tile.z == 0.0 || ma >= range.y)
+        return 1.0;
+
+    // depth the face's perspective projection wrote for this distance
+    float ndcDepth = (range.y + range.x) / (range.y - range.x) - 2.0 * range.y * range.x / ((range.y - range.x) * ma);
+
+    // half a texel inside the tile, the neighbours are other faces
+    float halfTexel = 0.5 / float(textureSize(pointShadowAtlas, 0).x);
+    vec2 uv = clamp(tile.xy + (st / ma * 0.5 + 0.5) * tile.z, tile.xy + halfTexel, tile.xy + tile.z - halfTexel);
+    return texture(pointShadowAtlas, vec3(uv, ndcDepth * 0.5 + 0.5));
+}
+
 vec3 fresnelSchlick(float cosTheta, vec3 F0)
 {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
@@ -152,3 +247,68 @@ float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
 	
     return ggx1 * ggx2;
 }
+
+// E(N) / PI from the L2 coefficients, the basis constants are already folded in
+vec3 irradianceSH(vec3 N)
+{
+    vec3 result = shCoefficients[0].rgb
+                + shCoefficients[1].rgb * N.y
+                + shCoefficients[2].rgb * N.z
+                + shCoefficients[3].rgb * N.x
+                + shCoefficients[4].rgb * (N.x * N.y)
+                + shCoefficients[5].rgb * (N.y * N.z)
+                + shCoefficients[6].rgb * (3.0 * N.z * N.z - 1.0)
+                + shCoefficients[7].rgb * (N.x * N.z)
+                + shCoefficients[8].rgb * (N.x * N.x - N.y * N.y);
+    return max(result, vec3(0.0)); // ringing can dip below zero opposite bright lights
+}
+
+vec3 irradianceSHProbe(int probe, vec3 N)
+{
+    vec3 result = probes[probe].sh[0].rgb
+                + probes[probe].sh[1].rgb * N.y
+                + probes[probe].sh[2].rgb * N.z
+                + probes[probe].sh[3].rgb * N.x
+                + probes[probe].sh[4].rgb * (N.x * N.y)
+                + probes[probe].sh[5].rgb * (N.y * N.z)
+                + probes[probe].sh[6].rgb * (3.0 * N.z * N.z - 1.0)
+                + probes[probe].sh[7].rgb * (N.x * N.z)
+                + probes[probe].sh[8].rgb * (N.x * N.x - N.y * N.y);
+    return max(result, vec3(0.0));
+}
+
+// Blends at most two of the tile's probes whose box contains worldPos, each fading out
+// over its blend distance towards the box faces. Returns the weight left for the global maps
+float localProbes(vec3 worldPos, vec3 N, vec3 R, float lod, inout vec3 irradiance, inout vec3 prefiltered)
+{
+    float remaining = 1.0;
+#ifdef GL_ARB_texture_cube_map_array
+    uvec4 tile = texelFetch(probeTiles, ivec2(gl_FragCoord.xy) / probeTileSize, 0);
+    int sampled = 0;
+    for (int i = 0; i < 4 && sampled < 2; ++i)
+    {
+        int probe = int(tile[i]) - 1;
+        if (probe < 0 || probe >= probeCount)
+            break;
+
+        vec3 boxMin = probes[probe].boxMin.xyz;
+        vec3 boxMax = probes[probe].boxMax.xyz;
+        vec3 inside = min(worldPos - boxMin, boxMax - worldPos);
+        float edge  = min(min(inside.x, inside.y), inside.z);
+        if (edge <= 0.0)
+            continue;
+        float weight = clamp(edge / probes[probe].boxMin.w, 0.0, 1.0) * remaining;
+
+        // where the reflection leaves the box, looked up from the capture point
+        vec3 exits = max((boxMax - worldPos) / R, (boxMin - worldPos) / R);
+        float t = min(min(exits.x, exits.y), exits.z);
+        vec3 direction = worldPos + R * t - probes[probe].position.xyz;
+
+        prefiltered += weight * textureLod(probeArray, vec4(direction, probes[probe].boxMax.w), lod).rgb;
+        irradiance  += weight * irradianceSHProbe(probe, N);
+        remaining   -= weight;
+        sampled++;
+    }
+#endif
+    return remaining;
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+out float FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D ssaoInput;
+uniform sampler2D depthNormal; // view space normal, linear depth
+
+
+// 4x4 like the noise tile, texels of other surfaces are left out
+void main()
+{
+    ivec2 size = textureSize(ssaoInput, 0);
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    float centerDepth = texelFetch(depthNormal, center, 0).w;
+
+    float result = 0.0;
+    float weightSum = 0.0;
+    for (int y = -2; y < 2; ++y)
+    {
+        for (int x = -2; x < 2; ++x)
+        {
+            ivec2 texel = clamp(center + ivec2(x, y), ivec2(0), size - 1);
+            float depth = texelFetch(depthNormal, texel, 0).w;
+            float weight = exp(-abs(depth - centerDepth) / (0.05 * centerDepth));
+
+            result    += texelFetch(ssaoInput, texel, 0).r * weight;
+            weightSum += weight;
+        }
+    }
+
+    FragColor = result / max(weightSum, 1e-4);
+}
@@ -0,0 +1,38 @@
+#version 330 core
+
+layout (location = 0) out vec4 FragColor; // view space normal, linear view depth
+
+in vec2 TexCoords;
+
+uniform sampler2D gPosition; // world position
+uniform sampler2D gNormal;   // world normal
+uniform mat4 view;
+uniform int scale;           // full resolution texels per low resolution texel
+
+const float BACKGROUND_DEPTH = 1e4;
+
+
+void main()
+{
+    ivec2 fullSize = textureSize(gPosition, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * scale;
+
+    // the closest surface of the block, so thin foreground objects survive
+    vec4 result = vec4(0.0, 0.0, 1.0, BACKGROUND_DEPTH);
+    for (int y = 0; y < scale; ++y)
+    {
+        for (int x = 0; x < scale; ++x)
+        {
+            ivec2 texel = min(base + ivec2(x, y), fullSize - 1);
+            vec3 normal = texelFetch(gNormal, texel, 0).xyz;
+            if (dot(normal, normal) < 0.01)
+                continue; // nothing rendered here
+
+            float depth = -(view * vec4(texelFetch(gPosition, texel, 0).xyz, 1.0)).z;
+            if (depth < result.w)
+                result = vec4(normalize(mat3(view) * normal), depth);
+        }
+    }
+
+    FragColor = result;
+}
@@ -0,0 +1,68 @@
+#version 330 core
+
+const int MAX_SAMPLES = 64;
+const float BACKGROUND_DEPTH = 1e4;
+
+out float FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D depthNormal; // view space normal, linear depth
+uniform sampler2D texNoise;
+
+uniform vec3 samples[MAX_SAMPLES];
+uniform int sampleCount;
+uniform float radius;
+uniform float bias;
+uniform int frameIndex; // rotates the kernel, the temporal history averages the rotations
+uniform mat4 projection;
+
+
+vec3 viewPosition(vec2 uv, float depth)
+{
+    vec2 ndc = uv * 2.0 - 1.0;
+    return vec3(ndc.x * depth / projection[0][0], ndc.y * depth / projection[1][1], -depth);
+}
+
+void main()
+{
+    vec4 center = texture(depthNormal, TexCoords);
+    if (center.w >= BACKGROUND_DEPTH)
+    {
+        FragColor = 1.0;
+        return;
+    }
+
+    // tile the noise over this target, whatever its size
+    vec2 noiseScale = vec2(textureSize(depthNormal, 0)) / vec2(textureSize(texNoise, 0));
+
+    vec3 fragPos   = viewPosition(TexCoords, center.w);
+    vec3 normal    = center.xyz;
+    vec3 randomVec = texture(texNoise, TexCoords * noiseScale).xyz;
+    float angle = float(frameIndex) * 2.39996; // golden angle
+    randomVec.xy = mat2(cos(angle), sin(angle), -sin(angle), cos(angle)) * randomVec.xy;
+
+    vec3 tangent   = normalize(randomVec - normal * dot(randomVec, normal));
+    vec3 bitangent = cross(normal, tangent);
+    mat3 TBN       = mat3(tangent, bitangent, normal);
+
+    float occlusion = 0.0;
+    for (int i = 0; i < MAX_SAMPLES; ++i)
+    {
+        if (i >= sampleCount)
+            break;
+
+        // get sample position
+        vec3 samplePos = fragPos + TBN * samples[i] * radius;
+
+        vec4 offset = projection * vec4(samplePos, 1.0);
+        offset.xy   = offset.xy / offset.w * 0.5 + 0.5;
+
+        float sampleZ = -texture(depthNormal, offset.xy).w;
+
+        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPos.z - sampleZ));
+        occlusion       += (sampleZ >= samplePos.z + bias ? 1.0 : 0.0) * rangeCheck;
+    }
+
+    FragColor = 1.0 - occlusion / float(sampleCount);
+}
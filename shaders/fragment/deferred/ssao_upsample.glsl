@@ -0,0 +1,61 @@
+#version 330 core
+
+out float FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D ssaoInput;   // low resolution AO
+uniform sampler2D depthNormal; // low resolution view space normal, linear depth
+uniform sampler2D gPosition;   // full resolution world position
+uniform sampler2D gNormal;     // full resolution world normal
+uniform mat4 view;
+
+
+// Bilinear weights of the 4 nearest low resolution texels, scaled down for
+// texels whose depth or normal differ, so AO doesn't bleed over edges
+void main()
+{
+    vec3 normal = texture(gNormal, TexCoords).xyz;
+    if (dot(normal, normal) < 0.01)
+    {
+        FragColor = 1.0;
+        return;
+    }
+    normal = normalize(mat3(view) * normal);
+    float depth = -(view * vec4(texture(gPosition, TexCoords).xyz, 1.0)).z;
+
+    ivec2 lowSize = textureSize(ssaoInput, 0);
+    vec2 position = TexCoords * vec2(lowSize) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+
+    float result = 0.0;
+    float weightSum = 0.0;
+    float closestDifference = 1e30;
+    float closestAo = 1.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), lowSize - 1);
+        vec4 low = texelFetch(depthNormal, texel, 0);
+        float ao = texelFetch(ssaoInput, texel, 0).r;
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float difference = abs(low.w - depth);
+        float depthWeight = 1.0 / (1e-3 + difference / depth);
+        float normalWeight = pow(max(dot(low.xyz, normal), 0.0), 8.0);
+        float weight = bilinear.x * bilinear.y * depthWeight * normalWeight;
+
+        result    += ao * weight;
+        weightSum += weight;
+
+        if (difference < closestDifference)
+        {
+            closestDifference = difference;
+            closestAo = ao;
+        }
+    }
+
+    // no texel on this surface, take the nearest in depth
+    FragColor = weightSum > 1e-3 ? result / weightSum : closestAo;
+}
@@ -0,0 +1,53 @@
+#version 330 core
+
+layout (location = 0) out vec2 History;            // value, accumulated frames
+layout (location = 1) out vec4 HistoryDepthNormal; // what the value was computed for
+
+in vec2 TexCoords;
+
+uniform sampler2D currentValue;
+uniform sampler2D depthNormal;        // view space normal, linear depth
+uniform sampler2D history;
+uniform sampler2D historyDepthNormal;
+
+uniform mat4 projection;
+uniform mat4 inverseView;
+uniform mat4 previousView;
+uniform mat4 previousViewProjection;
+uniform int maxFrames;
+uniform bool historyValid;
+
+const float BACKGROUND_DEPTH = 1e4;
+
+
+void main()
+{
+    vec4 current = texture(depthNormal, TexCoords);
+    float value = texture(currentValue, TexCoords).r;
+
+    HistoryDepthNormal = current;
+    History = vec2(value, 1.0);
+    if (!historyValid || current.w >= BACKGROUND_DEPTH)
+        return;
+
+    // where this surface was last frame
+    vec2 ndc = TexCoords * 2.0 - 1.0;
+    vec3 viewPos = vec3(ndc.x * current.w / projection[0][0], ndc.y * current.w / projection[1][1], -current.w);
+    vec3 worldPos = vec3(inverseView * vec4(viewPos, 1.0));
+
+    vec4 previousClip = previousViewProjection * vec4(worldPos, 1.0);
+    vec2 previousUV = previousClip.xy / previousClip.w * 0.5 + 0.5;
+    if (previousClip.w <= 0.0 || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0))))
+        return;
+
+    // the history there has to belong to the same surface
+    vec4 previous = texture(historyDepthNormal, previousUV);
+    float expectedDepth = -(previousView * vec4(worldPos, 1.0)).z;
+    vec3 expectedNormal = mat3(previousView) * (mat3(inverseView) * current.xyz);
+    if (abs(previous.w - expectedDepth) > 0.05 * expectedDepth || dot(previous.xyz, expectedNormal) < 0.9)
+        return;
+
+    vec2 accumulated = texture(history, previousUV).rg;
+    float frames = min(accumulated.g + 1.0, float(maxFrames));
+    History = vec2(mix(accumulated.r, value, 1.0 / frames), frames);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;    // HDR
+uniform sampler2D bloom;    // half resolution, bilinear
+uniform float intensity;
+
+
+void main()
+{
+    vec3 color = texture(scene, TexCoords).rgb;
+    color += texture(bloom, TexCoords).rgb * intensity;
+
+    // HDR tonemapping
+    color = color / (color + vec3(1.0));
+    // gamma correct
+    color = pow(color, vec3(1.0/2.2));
+
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,83 @@
+#version 330 core
+
+out vec3 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;   // the level above, bilinear
+uniform bool firstLevel;    // bright pass + Karis average on the scene
+uniform vec4 curve;         // threshold, threshold - knee, 2 * knee, 0.25 / knee
+
+
+float luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// keeps what is above the threshold with a quadratic knee instead of a hard cut
+vec3 brightPass(vec3 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - curve.y, 0.0, curve.z);
+    soft = soft * soft * curve.w;
+    float contribution = max(soft, brightness - curve.x) / max(brightness, 1e-4);
+    return color * contribution;
+}
+
+// weighted by 1 / (1 + luma) so a single very bright texel can't flicker through the chain
+vec3 karisAverage(vec3 a, vec3 b, vec3 c, vec3 d)
+{
+    float wa = 1.0 / (1.0 + luminance(a));
+    float wb = 1.0 / (1.0 + luminance(b));
+    float wc = 1.0 / (1.0 + luminance(c));
+    float wd = 1.0 / (1.0 + luminance(d));
+    return (a * wa + b * wb + c * wc + d * wd) / (wa + wb + wc + wd);
+}
+
+void main()
+{
+    // 13 bilinear taps covering 6x6 texels of the source:
+    // a . b . c
+    // . j . k .
+    // d . e . f
+    // . l . m .
+    // g . h . i
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+    float x = texel.x, y = texel.y;
+
+    vec3 a = texture(source, TexCoords + vec2(-2.0 * x,  2.0 * y)).rgb;
+    vec3 b = texture(source, TexCoords + vec2( 0.0,      2.0 * y)).rgb;
+    vec3 c = texture(source, TexCoords + vec2( 2.0 * x,  2.0 * y)).rgb;
+    vec3 d = texture(source, TexCoords + vec2(-2.0 * x,  0.0)).rgb;
+    vec3 e = texture(source, TexCoords).rgb;
+    vec3 f = texture(source, TexCoords + vec2( 2.0 * x,  0.0)).rgb;
+    vec3 g = texture(source, TexCoords + vec2(-2.0 * x, -2.0 * y)).rgb;
+    vec3 h = texture(source, TexCoords + vec2( 0.0,     -2.0 * y)).rgb;
+    vec3 i = texture(source, TexCoords + vec2( 2.0 * x, -2.0 * y)).rgb;
+    vec3 j = texture(source, TexCoords + vec2(-x,  y)).rgb;
+    vec3 k = texture(source, TexCoords + vec2( x,  y)).rgb;
+    vec3 l = texture(source, TexCoords + vec2(-x, -y)).rgb;
+    vec3 m = texture(source, TexCoords + vec2( x, -y)).rgb;
+
+    // five overlapping 2x2 boxes, the center one weighted 0.5, the corners 0.125
+    vec3 color;
+    if (firstLevel)
+    {
+        vec3 center      = karisAverage(j, k, l, m);
+        vec3 topLeft     = karisAverage(a, b, d, e);
+        vec3 topRight    = karisAverage(b, c, e, f);
+        vec3 bottomLeft  = karisAverage(d, e, g, h);
+        vec3 bottomRight = karisAverage(e, f, h, i);
+        color = center * 0.5 + (topLeft + topRight + bottomLeft + bottomRight) * 0.125;
+        color = brightPass(color);
+    }
+    else
+    {
+        color  = (j + k + l + m) * 0.125;
+        color += (a + c + g + i) * 0.03125;
+        color += (b + d + f + h) * 0.0625;
+        color += e * 0.125;
+    }
+
+    FragColor = max(color, vec3(0.0001));
+}
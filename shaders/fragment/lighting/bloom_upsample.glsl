@@ -0,0 +1,27 @@
+#version 330 core
+
+out vec3 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;   // the level below, added to the bound level by blending
+uniform float radius;       // tent size in source texels
+
+
+void main()
+{
+    // 3x3 tent: 1 2 1 / 2 4 2 / 1 2 1
+    vec2 offset = radius / vec2(textureSize(source, 0));
+
+    vec3 color  = texture(source, TexCoords).rgb * 4.0;
+    color += texture(source, TexCoords + vec2(-offset.x, 0.0)).rgb * 2.0;
+    color += texture(source, TexCoords + vec2( offset.x, 0.0)).rgb * 2.0;
+    color += texture(source, TexCoords + vec2(0.0, -offset.y)).rgb * 2.0;
+    color += texture(source, TexCoords + vec2(0.0,  offset.y)).rgb * 2.0;
+    color += texture(source, TexCoords + vec2(-offset.x, -offset.y)).rgb;
+    color += texture(source, TexCoords + vec2( offset.x, -offset.y)).rgb;
+    color += texture(source, TexCoords + vec2(-offset.x,  offset.y)).rgb;
+    color += texture(source, TexCoords + vec2( offset.x,  offset.y)).rgb;
+
+    FragColor = color / 16.0;
+}
@@ -0,0 +1,74 @@
+#version 330 core
+
+layout (location = 0) out float ShadowMask;  // 1 lit, 0 shadowed
+layout (location = 1) out vec4 DepthNormal;  // view space normal, linear depth, for the temporal history
+
+in vec2 TexCoords;
+
+uniform sampler2D gPosition; // world position
+uniform sampler2D gNormal;   // world normal
+uniform mat4 view;
+
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[4];
+uniform float cascadeSplits[4];     // far view depth of each cascade
+uniform float cascadeTexelSizes[4]; // world size of a shadow texel
+uniform int cascadeCount;
+uniform int frameIndex;             // rotates the taps, the history averages the rotations
+
+const int TAPS = 4;
+const float FILTER_RADIUS = 1.5;    // shadow texels
+const float BACKGROUND_DEPTH = 1e4;
+
+
+float interleavedGradientNoise(vec2 pixel)
+{
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+void main()
+{
+    vec3 N = texture(gNormal, TexCoords).xyz;
+    if (dot(N, N) < 0.01)
+    {
+        ShadowMask = 1.0;
+        DepthNormal = vec4(0.0, 0.0, 1.0, BACKGROUND_DEPTH);
+        return;
+    }
+    N = normalize(N);
+
+    vec3 worldPos = texture(gPosition, TexCoords).xyz;
+    float depth = -(view * vec4(worldPos, 1.0)).z;
+    DepthNormal = vec4(normalize(mat3(view) * N), depth);
+
+    // the first cascade whose split covers the depth
+    int cascade = cascadeCount;
+    for (int i = cascadeCount - 1; i >= 0; --i)
+    {
+        if (depth < cascadeSplits[i])
+            cascade = i;
+    }
+    ShadowMask = 1.0;
+    if (cascade == cascadeCount)
+        return; // past the shadow distance
+
+    // normal offset against acne, a texel and a half of this cascade
+    vec3 offsetPos = worldPos + N * cascadeTexelSizes[cascade] * 1.5;
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(offsetPos, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0)
+        return;
+
+    // a few hardware PCF taps on a Vogel disk, rotated per pixel and per frame
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float rotation = 6.2831853 * interleavedGradientNoise(gl_FragCoord.xy) + float(frameIndex) * 2.39996;
+    float lit = 0.0;
+    for (int i = 0; i < TAPS; ++i)
+    {
+        float r = sqrt((float(i) + 0.5) / float(TAPS)) * FILTER_RADIUS;
+        float theta = float(i) * 2.39996 + rotation;
+        vec2 offset = vec2(cos(theta), sin(theta)) * r * texelSize;
+        lit += texture(shadowMap, vec4(projCoords.xy + offset, float(cascade), projCoords.z));
+    }
+    ShadowMask = lit / float(TAPS);
+}
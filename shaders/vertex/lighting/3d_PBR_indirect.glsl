@@ -0,0 +1,38 @@
+#version 430 core
+
+// 3d_PBR.glsl for GPU culled draws, the transforms come from the object buffer
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 4) in uint aObjectId; // per instance, offset by baseInstance
+
+struct Object {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 draw;
+};
+
+layout (std430, binding = 0) readonly buffer Objects {
+    Object objects[];
+};
+
+out vec2 TexCoords;
+out vec3 WorldPos;
+out vec3 Normal;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+void main()
+{
+    Object object = objects[aObjectId];
+
+    TexCoords = aTexCoords;
+    WorldPos = vec3(object.model * vec4(aPos, 1.0));
+    Normal = mat3(object.normalMatrix) * aNormal;
+
+    gl_Position =  projection * view * vec4(WorldPos, 1.0);
+}
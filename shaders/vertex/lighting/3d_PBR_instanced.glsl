@@ -0,0 +1,36 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+out vec3 WorldPos;
+out vec3 Normal;
+flat out int MaterialId;
+
+struct Instance {
+    mat4 model;
+    mat4 normalMatrix;
+    ivec4 material; // x = index into the material table
+};
+
+// filled per draw by MaterialSystem, size matches MATERIAL_MAX_INSTANCES
+layout (std140) uniform Instances {
+    Instance instances[64];
+};
+
+uniform mat4 projection;
+uniform mat4 view;
+
+void main()
+{
+    Instance instance = instances[gl_InstanceID];
+
+    TexCoords = aTexCoords;
+    WorldPos = vec3(instance.model * vec4(aPos, 1.0));
+    Normal = mat3(instance.normalMatrix) * aNormal;
+    MaterialId = instance.material.x;
+
+    gl_Position =  projection * view * vec4(WorldPos, 1.0);
+}
@@ -0,0 +1,487 @@
+// Cached point light shadows in one depth atlas
+//
+// Every shadowed point light owns six square tiles of the atlas, one per
+// cube face, sized by how large the light's range is on screen. Tiles are
+// buddy-allocated from a quadtree of the atlas. A tile keeps its depth
+// across frames and is only rendered again when its light moves, its size
+// changes or a caster inside its face frustum moves. At most
+// `maxTileUpdates` tiles are rendered per frame, the most important first;
+// a light samples its tiles only once all six have been rendered.
+// The face layout matches the cubemap convention, so the lighting shader
+// finds the face and its texel analytically.
+
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "gl_resources.h"
+#include "screen_coverage.h"
+#include "trace_events.h"
+
+
+const int SHADOW_ATLAS_MAX_LIGHTS = 4;          // keep in sync with the lighting shader
+const int SHADOW_ATLAS_MIN_TILE = 128;
+const int SHADOW_ATLAS_MAX_TILE = 1024;
+const float SHADOW_ATLAS_TEXELS_PER_PIXEL = 0.5f;  // tile texels per pixel of the light's range on screen
+const float SHADOW_ATLAS_NEAR = 0.05f;
+
+// Draws one caster with the depth shader (its lightSpaceMatrix is set), the shader only needs "model"
+typedef std::function<void(Shader& depthShader)> ShadowCasterDraw;
+
+struct ShadowAtlasStats {
+    unsigned int tilesRendered;     // this frame
+    unsigned int tilesPending;      // dirty tiles left over for the next frames
+    unsigned int castersDrawn;      // this frame
+};
+
+class ShadowAtlas
+{
+public:
+    void init(int atlasSize = 4096, unsigned int tileUpdatesPerFrame = 12)
+    {
+        size = atlasSize;
+        maxTileUpdates = tileUpdatesPerFrame;
+
+        depth = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, depth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(depth, GPUMemory_RenderTargets, GL_DEPTH_COMPONENT24, size, size);
+
+        framebuffer = GLFramebuffer::create();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // the whole atlas is one free node of the largest level
+        freeNodes.assign(levelCount(), std::vector<Node>());
+        freeNodes[0].push_back({ 0, 0 });
+    }
+
+    int addLight(const glm::vec3& position, float range)
+    {
+        if (lights.size() >= SHADOW_ATLAS_MAX_LIGHTS)
+        {
+            std::cout << "ERROR::SHADOW_ATLAS::TOO_MANY_LIGHTS" << std::endl;
+            return -1;
+        }
+
+        Light light;
+        light.position = position;
+        light.range = range;
+        lights.push_back(light);
+        return static_cast<int>(lights.size() - 1);
+    }
+
+    void moveLight(int light, const glm::vec3& position, float range)
+    {
+        Light& l = lights[light];
+        if (l.position == position && l.range == range)
+            return;
+
+        l.position = position;
+        l.range = range;
+        markLightDirty(l);
+    }
+
+    // Bounding sphere of a caster, draw renders it into the current tile
+    int addCaster(const glm::vec3& center, float radius, ShadowCasterDraw draw)
+    {
+        Caster caster;
+        caster.center = center;
+        caster.radius = radius;
+        caster.draw = std::move(draw);
+        casters.push_back(std::move(caster));
+
+        // it may throw a shadow into tiles that are already cached
+        markCasterDirty(casters.back());
+        return static_cast<int>(casters.size() - 1);
+    }
+
+    // Tiles that saw the caster before or see it now are rendered again
+    void moveCaster(int caster, const glm::vec3& center, float radius)
+    {
+        Caster& c = casters[caster];
+        if (c.center == center && c.radius == radius)
+            return;
+
+        markCasterDirty(c);
+        c.center = center;
+        c.radius = radius;
+        markCasterDirty(c);
+    }
+
+    // Sizes the tiles from the camera and renders the dirty ones within the budget
+    void update(Shader& depthShader, const glm::mat4& view, float fovY, int viewportWidth, int viewportHeight)
+    {
+        TRACE_SCOPE("ShadowAtlas::update");
+
+        stats = {};
+        for (Light& light : lights)
+        {
+            light.importance = ScreenCoverage(light.position, light.range, view, fovY, (float)viewportHeight);
+            resizeTiles(light);
+        }
+
+        // most important lights first, their tiles were invalidated the longest
+        std::vector<Light*> order;
+        for (Light& light : lights)
+            order.push_back(&light);
+        std::sort(order.begin(), order.end(), [](const Light* a, const Light* b) { return a->importance > b->importance; });
+
+        bool bound = false;
+        for (Light* light : order)
+        {
+            for (int face = 0; face < 6; face++)
+            {
+                Tile& tile = light->tiles[face];
+                if (!tile.dirty || tile.size == 0)
+                    continue;
+
+                if (stats.tilesRendered >= maxTileUpdates)
+                {
+                    stats.tilesPending++;
+                    continue;
+                }
+
+                if (!bound)
+                {
+                    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                    glEnable(GL_DEPTH_TEST);
+                    glEnable(GL_SCISSOR_TEST);
+                    glEnable(GL_POLYGON_OFFSET_FILL);
+                    glPolygonOffset(2.0f, 4.0f);
+                    bound = true;
+                }
+                renderTile(*light, face, depthShader);
+            }
+
+            // dirty tiles still hold the depth of their last render, only schedule them
+            light->valid = std::all_of(light->tiles, light->tiles + 6, [](const Tile& t) { return t.rendered && t.size != 0; });
+        }
+
+        if (bound)
+        {
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, viewportWidth, viewportHeight);
+        }
+    }
+
+    // Tiles as (x, y, size) in atlas uv per light and face, size 0 for lights without valid tiles
+    void setUniforms(const Shader& shader, int unit) const
+    {
+        for (int i = 0; i < SHADOW_ATLAS_MAX_LIGHTS; i++)
+        {
+            const std::string light = "[" + std::to_string(i) + "]";
+            const bool valid = i < (int)lights.size() && lights[i].valid;
+            if (valid)
+                shader.setVec2("pointShadowDepthRange" + light, SHADOW_ATLAS_NEAR, lights[i].range);
+
+            for (int face = 0; face < 6; face++)
+            {
+                glm::vec4 rect(0.0f);
+                if (valid)
+                {
+                    const Tile& tile = lights[i].tiles[face];
+                    rect = glm::vec4((float)tile.x / size, (float)tile.y / size, (float)tile.size / size, 0.0f);
+                }
+                shader.setVec4("pointShadowTiles[" + std::to_string(i * 6 + face) + "]", rect);
+            }
+        }
+
+        shader.setInt("pointShadowAtlas", unit);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, depth);
+    }
+
+    const ShadowAtlasStats& getStats() const
+    {
+        return stats;
+    }
+
+    unsigned int getTexture() const
+    {
+        return depth;
+    }
+
+private:
+    struct Node {
+        int x, y;
+    };
+
+    struct Tile {
+        int x = 0, y = 0;
+        int size = 0;           // 0 when not allocated
+        bool dirty = true;      // casters or the light moved since the last render
+        bool rendered = false;  // rendered at least once since it was allocated
+    };
+
+    struct Light {
+        glm::vec3 position;
+        float range;
+        float importance = 0.0f;    // pixels covered by the range
+        bool valid = false;         // all six tiles rendered at least once, maybe stale
+        int requestedSize = 0;      // tile size asked for, the tiles got less when the atlas was full
+        Tile tiles[6];
+    };
+
+    struct Caster {
+        glm::vec3 center;
+        float radius;
+        ShadowCasterDraw draw;
+    };
+
+    GLTexture depth;
+    GLFramebuffer framebuffer;
+    int size = 4096;
+    unsigned int maxTileUpdates = 12;
+
+    std::vector<Light> lights;
+    std::vector<Caster> casters;
+    std::vector<std::vector<Node>> freeNodes;   // per quadtree level, level 0 is the whole atlas
+    ShadowAtlasStats stats = {};
+
+    // cube face axes (forward, up) in the same order and orientation as GL cubemap faces
+    static void faceAxes(int face, glm::vec3& forward, glm::vec3& up)
+    {
+        static const glm::vec3 forwards[6] = {
+            glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(-1.0f,  0.0f,  0.0f),
+            glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3( 0.0f, -1.0f,  0.0f),
+            glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 0.0f,  0.0f, -1.0f),
+        };
+        static const glm::vec3 ups[6] = {
+            glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 0.0f, -1.0f,  0.0f),
+            glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 0.0f,  0.0f, -1.0f),
+            glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 0.0f, -1.0f,  0.0f),
+        };
+        forward = forwards[face];
+        up = ups[face];
+    }
+
+    static glm::mat4 faceViewProjection(const Light& light, int face)
+    {
+        glm::vec3 forward, up;
+        faceAxes(face, forward, up);
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_ATLAS_NEAR, light.range);
+        return projection * glm::lookAt(light.position, light.position + forward, up);
+    }
+
+    // Sphere against the 90 degree frustum of one face
+    static bool faceSees(const Light& light, int face, const glm::vec3& center, float radius)
+    {
+        const glm::vec3 p = center - light.position;
+        if (glm::length(p) - radius > light.range)
+            return false;
+
+        glm::vec3 forward, up;
+        faceAxes(face, forward, up);
+        const glm::vec3 right = glm::cross(forward, up);
+
+        const float a = glm::dot(p, forward);
+        const float b = glm::dot(p, right);
+        const float c = glm::dot(p, up);
+        const float slack = radius * 1.41421356f;  // side planes are at 45 degrees
+        return a + radius > SHADOW_ATLAS_NEAR &&
+               a - b >= -slack && a + b >= -slack && a - c >= -slack && a + c >= -slack;
+    }
+
+    void markLightDirty(Light& light)
+    {
+        for (Tile& tile : light.tiles)
+            tile.dirty = true;
+    }
+
+    void markCasterDirty(const Caster& caster)
+    {
+        for (Light& light : lights)
+        {
+            for (int face = 0; face < 6; face++)
+            {
+                if (faceSees(light, face, caster.center, caster.radius))
+                    light.tiles[face].dirty = true;
+            }
+        }
+    }
+
+    // Pow2 tile size for the light's coverage. The tiles stay while the ideal
+    // size is within a factor of two of the size last asked for, so they don't
+    // flip every frame. That's the requested size and not the granted one: a
+    // light that got smaller tiles from a full atlas keeps them instead of
+    // being reallocated and re-rendered every frame
+    void resizeTiles(Light& light)
+    {
+        const float ideal = std::clamp(light.importance * SHADOW_ATLAS_TEXELS_PER_PIXEL,
+                                       (float)SHADOW_ATLAS_MIN_TILE, (float)SHADOW_ATLAS_MAX_TILE);
+        const int current = light.tiles[0].size;
+        const int requested = light.requestedSize;
+        if (current != 0 && ideal >= requested * 0.5f && ideal <= requested * 2.0f)
+            return;
+
+        int wanted = SHADOW_ATLAS_MIN_TILE;
+        while (wanted * 2 <= ideal)
+            wanted *= 2;
+        if (current != 0 && wanted == requested)
+            return;
+        light.requestedSize = wanted;
+
+        for (Tile& tile : light.tiles)
+            freeTile(tile);
+
+        // fall back to smaller tiles when the atlas is full
+        for (int tileSize = wanted; tileSize >= SHADOW_ATLAS_MIN_TILE; tileSize /= 2)
+        {
+            bool allocated = true;
+            for (Tile& tile : light.tiles)
+                allocated = allocated && allocateTile(tile, tileSize);
+            if (allocated)
+                break;
+
+            for (Tile& tile : light.tiles)
+                freeTile(tile);
+        }
+
+        if (light.tiles[0].size == 0)
+            std::cout << "ERROR::SHADOW_ATLAS::OUT_OF_SPACE" << std::endl;
+        markLightDirty(light);
+        light.valid = false;
+    }
+
+    int levelCount() const
+    {
+        int levels = 1;
+        while ((size >> (levels - 1)) > SHADOW_ATLAS_MIN_TILE)
+            levels++;
+        return levels;
+    }
+
+    int levelOf(int tileSize) const
+    {
+        int level = 0;
+        while ((size >> level) > tileSize)
+            level++;
+        return level;
+    }
+
+    // Buddy allocation, larger free nodes are split into four
+    bool allocateTile(Tile& tile, int tileSize)
+    {
+        const int level = levelOf(tileSize);
+
+        int source = level;
+        while (source >= 0 && freeNodes[source].empty())
+            source--;
+        if (source < 0)
+            return false;
+
+        for (; source < level; source++)
+        {
+            const Node node = freeNodes[source].back();
+            freeNodes[source].pop_back();
+
+            const int half = (size >> source) / 2;
+            freeNodes[source + 1].push_back({ node.x + half, node.y + half });
+            freeNodes[source + 1].push_back({ node.x, node.y + half });
+            freeNodes[source + 1].push_back({ node.x + half, node.y });
+            freeNodes[source + 1].push_back({ node.x, node.y });
+        }
+
+        const Node node = freeNodes[level].back();
+        freeNodes[level].pop_back();
+        tile.x = node.x;
+        tile.y = node.y;
+        tile.size = tileSize;
+        tile.dirty = true;
+        tile.rendered = false;
+        return true;
+    }
+
+    // Merges the four siblings back into their parent once they are all free
+    void freeTile(Tile& tile)
+    {
+        if (tile.size == 0)
+            return;
+
+        Node node = { tile.x, tile.y };
+        for (int level = levelOf(tile.size); ; level--)
+        {
+            std::vector<Node>& nodes = freeNodes[level];
+            if (level == 0)
+            {
+                nodes.push_back(node);
+                break;
+            }
+
+            const int parentSize = size >> (level - 1);
+            const Node parent = { node.x / parentSize * parentSize, node.y / parentSize * parentSize };
+            const int half = parentSize / 2;
+
+            int siblings = 0;
+            for (const Node& n : nodes)
+            {
+                if (n.x >= parent.x && n.x < parent.x + parentSize && n.y >= parent.y && n.y < parent.y + parentSize)
+                    siblings++;
+            }
+            if (siblings < 3)
+            {
+                nodes.push_back(node);
+                break;
+            }
+
+            nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [&](const Node& n)
+            {
+                return n.x >= parent.x && n.x < parent.x + half * 2 && n.y >= parent.y && n.y < parent.y + half * 2;
+            }), nodes.end());
+            node = parent;
+        }
+
+        tile = Tile();
+    }
+
+    void renderTile(Light& light, int face, Shader& depthShader)
+    {
+        Tile& tile = light.tiles[face];
+
+        glViewport(tile.x, tile.y, tile.size, tile.size);
+        glScissor(tile.x, tile.y, tile.size, tile.size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        depthShader.use();
+        depthShader.setMat4("lightSpaceMatrix", faceViewProjection(light, face));
+        for (const Caster& caster : casters)
+        {
+            if (!faceSees(light, face, caster.center, caster.radius))
+                continue;
+            caster.draw(depthShader);
+            stats.castersDrawn++;
+        }
+
+        tile.dirty = false;
+        tile.rendered = true;
+        stats.tilesRendered++;
+    }
+};
+
+#endif
@@ -0,0 +1,297 @@
+// Diffuse irradiance of an environment as 9 spherical harmonic coefficients
+//
+// The environment cubemap is read back once (a small mip is plenty for a
+// signal this smooth) and projected onto the 9 L2 real SH basis functions,
+// every texel weighted by its solid angle. Rows are spread over all cores
+// and each row is processed 4 texels at a time with SSE when available.
+// The coefficients are convolved with the cosine lobe and prescaled by the
+// basis constants, so the shader evaluates E(n) / PI with a handful of
+// multiply-adds instead of sampling an irradiance cubemap.
+
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SH_USE_SSE 1
+#else
+#define SH_USE_SSE 0
+#endif
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "thread_pool.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const unsigned int SH_IRRADIANCE_BINDING = 3; // uniform block binding, keep in sync with the shaders
+const int SH_PROJECTION_SIZE = 128;           // face size environments are projected at, plenty for 9 coefficients
+
+// std140 layout of the SHIrradiance block, rgb used
+struct SH9Irradiance {
+    glm::vec4 coefficients[9];
+};
+
+namespace SHDetail {
+
+// radiance * basis * solid angle of one row, 9 coefficients x rgb
+struct RowSum {
+    float rgb[9][3];
+};
+
+// direction of a texel of a GL cubemap face before normalization, u and v in [-1, 1]
+inline void FaceDirection(int face, float u, float v, float& x, float& y, float& z)
+{
+    switch (face)
+    {
+        case 0:  x =  1.0f; y = -v;    z = -u;    break; // +X
+        case 1:  x = -1.0f; y = -v;    z =  u;    break; // -X
+        case 2:  x =  u;    y =  1.0f; z =  v;    break; // +Y
+        case 3:  x =  u;    y = -1.0f; z = -v;    break; // -Y
+        case 4:  x =  u;    y = -v;    z =  1.0f; break; // +Z
+        default: x = -u;    y = -v;    z = -1.0f; break; // -Z
+    }
+}
+
+// adds one texel, (x, y, z) normalized, weight = solid angle
+inline void AccumulateTexel(RowSum& sum, const float* rgb, float x, float y, float z, float weight)
+{
+    const float basis[9] = {
+        0.282095f,
+        0.488603f * y,
+        0.488603f * z,
+        0.488603f * x,
+        1.092548f * x * y,
+        1.092548f * y * z,
+        0.315392f * (3.0f * z * z - 1.0f),
+        1.092548f * x * z,
+        0.546274f * (x * x - y * y)
+    };
+    for (int i = 0; i < 9; i++)
+    {
+        const float w = basis[i] * weight;
+        sum.rgb[i][0] += rgb[0] * w;
+        sum.rgb[i][1] += rgb[1] * w;
+        sum.rgb[i][2] += rgb[2] * w;
+    }
+}
+
+inline void ProjectRow(RowSum& sum, const float* row, int face, int size, float v)
+{
+    const float texelSize = 2.0f / size;
+    const float texelArea = texelSize * texelSize;
+
+    int x = 0;
+#if SH_USE_SSE
+    __m128 acc[9][3];
+    for (int i = 0; i < 9; i++)
+        acc[i][0] = acc[i][1] = acc[i][2] = _mm_setzero_ps();
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 negOne = _mm_set1_ps(-1.0f);
+    const __m128 vv = _mm_set1_ps(v);
+    const __m128 area = _mm_set1_ps(texelArea);
+    for (; x + 4 <= size; x += 4)
+    {
+        const __m128 u = _mm_set_ps((x + 3.5f) * texelSize - 1.0f, (x + 2.5f) * texelSize - 1.0f,
+                                    (x + 1.5f) * texelSize - 1.0f, (x + 0.5f) * texelSize - 1.0f);
+        const __m128 negU = _mm_sub_ps(_mm_setzero_ps(), u);
+        const __m128 negV = _mm_sub_ps(_mm_setzero_ps(), vv);
+
+        __m128 dx, dy, dz;
+        switch (face)
+        {
+            case 0:  dx = one;     dy = negV;    dz = negU;    break;
+            case 1:  dx = negOne;  dy = negV;    dz = u;       break;
+            case 2:  dx = u;       dy = one;     dz = vv;      break;
+            case 3:  dx = u;       dy = negOne;  dz = negV;    break;
+            case 4:  dx = u;       dy = negV;    dz = one;     break;
+            default: dx = negU;    dy = negV;    dz = negOne;  break;
+        }
+
+        // 1 / |d| normalizes, its cube is the solid angle of the texel over its area
+        const __m128 lengthSq = _mm_add_ps(one, _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(vv, vv)));
+        const __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+        const __m128 weight = _mm_mul_ps(area, _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength)));
+        dx = _mm_mul_ps(dx, invLength);
+        dy = _mm_mul_ps(dy, invLength);
+        dz = _mm_mul_ps(dz, invLength);
+
+        const __m128 basis[9] = {
+            _mm_set1_ps(0.282095f),
+            _mm_mul_ps(_mm_set1_ps(0.488603f), dy),
+            _mm_mul_ps(_mm_set1_ps(0.488603f), dz),
+            _mm_mul_ps(_mm_set1_ps(0.488603f), dx),
+            _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dy)),
+            _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dy, dz)),
+            _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one)),
+            _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dz)),
+            _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)))
+        };
+
+        const float* p = row + x * 3;
+        const __m128 r = _mm_mul_ps(weight, _mm_set_ps(p[9], p[6], p[3], p[0]));
+        const __m128 g = _mm_mul_ps(weight, _mm_set_ps(p[10], p[7], p[4], p[1]));
+        const __m128 b = _mm_mul_ps(weight, _mm_set_ps(p[11], p[8], p[5], p[2]));
+        for (int i = 0; i < 9; i++)
+        {
+            acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(basis[i], r));
+            acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(basis[i], g));
+            acc[i][2] = _mm_add_ps(acc[i][2], _mm_mul_ps(basis[i], b));
+        }
+    }
+
+    for (int i = 0; i < 9; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float lanes[4];
+            _mm_storeu_ps(lanes, acc[i][c]);
+            sum.rgb[i][c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+#endif
+
+    // the rest, or everything without SSE
+    for (; x < size; x++)
+    {
+        const float u = (x + 0.5f) * texelSize - 1.0f;
+        float dx, dy, dz;
+        FaceDirection(face, u, v, dx, dy, dz);
+
+        const float invLength = 1.0f / std::sqrt(1.0f + u * u + v * v);
+        const float weight = texelArea * invLength * invLength * invLength;
+        AccumulateTexel(sum, row + x * 3, dx * invLength, dy * invLength, dz * invLength, weight);
+    }
+}
+
+} // namespace SHDetail
+
+// faces: 6 RGB float images of size x size in GL cubemap face order, rows are spread over jobs
+SH9Irradiance ProjectCubemapSH9(const std::vector<float> (&faces)[6], int size, JobSystem& jobs = SharedJobs())
+{
+    TRACE_SCOPE("ProjectCubemapSH9");
+
+    std::vector<SHDetail::RowSum> rows(6 * size);
+    jobs.parallelFor(rows.size(), [&](size_t index)
+    {
+        const int face = static_cast<int>(index / size);
+        const int y = static_cast<int>(index % size);
+        SHDetail::RowSum& sum = rows[index];
+        for (int i = 0; i < 9; i++)
+            sum.rgb[i][0] = sum.rgb[i][1] = sum.rgb[i][2] = 0.0f;
+
+        const float v = (y + 0.5f) * 2.0f / size - 1.0f;
+        SHDetail::ProjectRow(sum, faces[face].data() + (size_t)y * size * 3, face, size, v);
+    }, 16);
+
+    // the texel solid angles only approximately add up to the sphere
+    double total[9][3] = {};
+    for (const SHDetail::RowSum& row : rows)
+        for (int i = 0; i < 9; i++)
+            for (int c = 0; c < 3; c++)
+                total[i][c] += row.rgb[i][c];
+
+    double solidAngle = 0.0;
+    const double texelArea = 4.0 / ((double)size * size);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            const double u = (x + 0.5) * 2.0 / size - 1.0;
+            const double v = (y + 0.5) * 2.0 / size - 1.0;
+            solidAngle += texelArea / std::pow(1.0 + u * u + v * v, 1.5);
+        }
+    }
+    const double normalization = 4.0 * 3.14159265358979 / (6.0 * solidAngle);
+
+    // cosine lobe convolution per band (PI, 2PI/3, PI/4), divided by PI like the
+    // old irradiance map, times the basis constants the shader leaves out
+    const double band[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+    const double basis[9] = { 0.282095, 0.488603, 0.488603, 0.488603, 1.092548, 1.092548, 0.315392, 1.092548, 0.546274 };
+
+    SH9Irradiance result;
+    for (int i = 0; i < 9; i++)
+    {
+        const double scale = normalization * band[i] * basis[i];
+        result.coefficients[i] = glm::vec4(total[i][0] * scale, total[i][1] * scale, total[i][2] * scale, 0.0f);
+    }
+    return result;
+}
+
+// First mip level of a cubemap no larger than maxSize, or its smallest
+// level when the chain stops before that
+int CubemapLevelAtMost(unsigned int cubemap, int maxSize)
+{
+    int level = 0, size = 0;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+    while (size > maxSize)
+    {
+        int next = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level + 1, GL_TEXTURE_WIDTH, &next);
+        if (next <= 0)
+            break;
+        level++;
+        size = next;
+    }
+    return level;
+}
+
+// Reads back one mip level of a GL_RGB cubemap and projects it
+SH9Irradiance ComputeCubemapIrradianceSH9(unsigned int cubemap, int level)
+{
+    TRACE_GPU_SCOPE("ComputeCubemapIrradianceSH9");
+
+    int size = 0;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_WIDTH, &size);
+    if (size <= 0)
+    {
+        std::cout << "ERROR::SPHERICAL_HARMONICS::CUBEMAP_LEVEL_NOT_FOUND" << std::endl;
+        return SH9Irradiance{};
+    }
+
+    std::vector<float> faces[6];
+    glPixelStorei(GL_PACK_ALIGNMENT, 4); // RGB float rows are always 4 byte aligned
+    for (int i = 0; i < 6; i++)
+    {
+        faces[i].resize((size_t)size * size * 3);
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGB, GL_FLOAT, faces[i].data());
+    }
+
+    return ProjectCubemapSH9(faces, size);
+}
+
+// Static uniform buffer with the coefficients, bind it to SH_IRRADIANCE_BINDING
+GLBuffer CreateSH9UniformBuffer(const SH9Irradiance& irradiance)
+{
+    GLBuffer buffer = GLBuffer::create();
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(SH9Irradiance), &irradiance, GL_STATIC_DRAW);
+    buffer.track(GPUMemory_Environment, sizeof(SH9Irradiance));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer;
+}
+
+// Points the shader's SHIrradiance block at SH_IRRADIANCE_BINDING
+void ConfigureSH9Shader(const Shader& shader)
+{
+    const unsigned int block = glGetUniformBlockIndex(shader.ID, "SHIrradiance");
+    if (block == GL_INVALID_INDEX)
+    {
+        std::cout << "ERROR::SPHERICAL_HARMONICS::SHADER_BLOCK_NOT_FOUND" << std::endl;
+        return;
+    }
+    glUniformBlockBinding(shader.ID, block, SH_IRRADIANCE_BINDING);
+}
+
+#endif
@@ -0,0 +1,241 @@
+// Screen space ambient occlusion at a fraction of the screen resolution
+//
+// The G-buffer's world positions and normals are reduced to a half (or
+// quarter) resolution buffer of view space normal + linear depth, keeping
+// the closest texel of each block. AO is computed there with a uniform
+// controlled kernel rotated every frame, accumulated over frames by
+// temporal reprojection, its 4x4 noise pattern removed by a depth-aware blur and
+// the result brought back to full resolution with a bilateral upsample that
+// only takes low resolution texels lying on the same surface. All sizes come
+// from the targets themselves, resize() follows the window.
+
+#ifndef SSAO_H
+#define SSAO_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "temporal_accumulation.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const int SSAO_MAX_SAMPLES = 64;    // keep in sync with ssao_lowres.glsl
+const int SSAO_NOISE_SIZE = 4;
+
+class SSAO
+{
+public:
+    SSAO()
+        : downsampleShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/ssao_downsample.glsl"),
+          ssaoShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/ssao_lowres.glsl"),
+          blurShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/ssao_blur_bilateral.glsl"),
+          upsampleShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/ssao_upsample.glsl")
+    {
+    }
+
+    // scale 2 = half, 4 = quarter resolution
+    void init(int width, int height, int resolutionScale = 2)
+    {
+        scale = std::max(resolutionScale, 1);
+        createNoise();
+        setQuality(8, 0.5f); // the temporal history makes up for the rest
+
+        downsampleShader.use();
+        downsampleShader.setInt("gPosition", 0);
+        downsampleShader.setInt("gNormal", 1);
+
+        ssaoShader.use();
+        ssaoShader.setInt("depthNormal", 0);
+        ssaoShader.setInt("texNoise", 1);
+
+        blurShader.use();
+        blurShader.setInt("ssaoInput", 0);
+        blurShader.setInt("depthNormal", 1);
+
+        upsampleShader.use();
+        upsampleShader.setInt("ssaoInput", 0);
+        upsampleShader.setInt("depthNormal", 1);
+        upsampleShader.setInt("gPosition", 2);
+        upsampleShader.setInt("gNormal", 3);
+
+        resize(width, height);
+    }
+
+    // Reallocates the targets when the size changed, cheap to call every frame
+    void resize(int width, int height)
+    {
+        if (width == fullWidth && height == fullHeight)
+            return;
+        if (width <= 0 || height <= 0)
+            return; // minimized
+
+        fullWidth = width;
+        fullHeight = height;
+        lowWidth = std::max(width / scale, 1);
+        lowHeight = std::max(height / scale, 1);
+
+        depthNormal = createTarget(depthNormalFramebuffer, GL_RGBA16F, GL_RGBA, GL_FLOAT, lowWidth, lowHeight);
+        aoRaw = createTarget(aoRawFramebuffer, GL_R8, GL_RED, GL_UNSIGNED_BYTE, lowWidth, lowHeight);
+        aoBlurred = createTarget(aoBlurredFramebuffer, GL_R8, GL_RED, GL_UNSIGNED_BYTE, lowWidth, lowHeight);
+        aoFull = createTarget(aoFullFramebuffer, GL_R8, GL_RED, GL_UNSIGNED_BYTE, fullWidth, fullHeight);
+        temporal.resize(lowWidth, lowHeight);
+    }
+
+    // Kernel size and radius (world units), the kernel is rebuilt for the count
+    void setQuality(int sampleCount, float sampleRadius, float depthBias = 0.025f)
+    {
+        samples = std::clamp(sampleCount, 1, SSAO_MAX_SAMPLES);
+        radius = sampleRadius;
+        bias = depthBias;
+
+        // hemisphere samples, denser near the center
+        std::uniform_real_distribution<float> random(0.0f, 1.0f);
+        std::default_random_engine generator;
+        ssaoShader.use();
+        for (int i = 0; i < samples; ++i)
+        {
+            glm::vec3 sample(random(generator) * 2.0f - 1.0f, random(generator) * 2.0f - 1.0f, random(generator));
+            sample = glm::normalize(sample) * random(generator);
+
+            float t = (float)i / samples;
+            sample *= 0.1f + 0.9f * t * t;
+            ssaoShader.setVec3("samples[" + std::to_string(i) + "]", sample);
+        }
+    }
+
+    // Renders the AO of the current G-buffer into getTexture()
+    void render(unsigned int gPosition, unsigned int gNormal, const glm::mat4& view, const glm::mat4& projection)
+    {
+        TRACE_GPU_SCOPE("SSAO");
+        glDisable(GL_DEPTH_TEST);
+
+        // 1. closest depth + normal per low resolution texel
+        glBindFramebuffer(GL_FRAMEBUFFER, depthNormalFramebuffer);
+        glViewport(0, 0, lowWidth, lowHeight);
+        downsampleShader.use();
+        downsampleShader.setMat4("view", view);
+        downsampleShader.setInt("scale", scale);
+        bindTextures(gPosition, gNormal);
+        renderQuad();
+
+        // 2. occlusion
+        glBindFramebuffer(GL_FRAMEBUFFER, aoRawFramebuffer);
+        ssaoShader.use();
+        ssaoShader.setMat4("projection", projection);
+        ssaoShader.setInt("sampleCount", samples);
+        ssaoShader.setFloat("radius", radius);
+        ssaoShader.setFloat("bias", bias);
+        ssaoShader.setInt("frameIndex", frame++);
+        bindTextures(depthNormal, noise);
+        renderQuad();
+
+        // 3. converge over frames, then remove the remaining noise within a surface
+        temporal.resolve(aoRaw, depthNormal, view, projection);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, aoBlurredFramebuffer);
+        blurShader.use();
+        bindTextures(temporal.getTexture(), depthNormal);
+        renderQuad();
+
+        // 4. back to full resolution
+        glBindFramebuffer(GL_FRAMEBUFFER, aoFullFramebuffer);
+        glViewport(0, 0, fullWidth, fullHeight);
+        upsampleShader.use();
+        upsampleShader.setMat4("view", view);
+        bindTextures(aoBlurred, depthNormal, gPosition, gNormal);
+        renderQuad();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Full resolution AO, 1 = unoccluded
+    unsigned int getTexture() const
+    {
+        return aoFull;
+    }
+
+private:
+    Shader downsampleShader;
+    Shader ssaoShader;
+    Shader blurShader;
+    Shader upsampleShader;
+    TemporalAccumulator temporal;
+
+    GLTexture noise;
+    GLTexture depthNormal, aoRaw, aoBlurred, aoFull;
+    GLFramebuffer depthNormalFramebuffer, aoRawFramebuffer, aoBlurredFramebuffer, aoFullFramebuffer;
+
+    int scale = 2;
+    int fullWidth = 0, fullHeight = 0;
+    int lowWidth = 0, lowHeight = 0;
+
+    int frame = 0;
+    int samples = 8;
+    float radius = 0.5f;
+    float bias = 0.025f;
+
+    static void bindTextures(unsigned int t0, unsigned int t1, unsigned int t2 = 0, unsigned int t3 = 0)
+    {
+        const unsigned int textures[4] = { t0, t1, t2, t3 };
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            if (!textures[i])
+                continue;
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+    }
+
+    static GLTexture createTarget(GLFramebuffer& framebuffer, GLenum internalFormat, GLenum format, GLenum type,
+                                  int width, int height)
+    {
+        GLTexture texture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(texture, GPUMemory_RenderTargets, internalFormat, width, height);
+
+        framebuffer = GLFramebuffer::create();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SSAO::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        return texture;
+    }
+
+    // random rotations around the normal, tiled over the screen
+    void createNoise()
+    {
+        std::uniform_real_distribution<float> random(0.0f, 1.0f);
+        std::default_random_engine generator;
+        std::vector<glm::vec3> rotations;
+        for (int i = 0; i < SSAO_NOISE_SIZE * SSAO_NOISE_SIZE; i++)
+            rotations.push_back(glm::vec3(random(generator) * 2.0f - 1.0f, random(generator) * 2.0f - 1.0f, 0.0f));
+
+        noise = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, noise);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SSAO_NOISE_SIZE, SSAO_NOISE_SIZE, 0, GL_RGB, GL_FLOAT, rotations.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        GPUMemoryTrackTexture(noise, GPUMemory_RenderTargets, GL_RGB16F, SSAO_NOISE_SIZE, SSAO_NOISE_SIZE);
+    }
+};
+
+#endif
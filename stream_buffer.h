@@ -0,0 +1,216 @@
+// Ring buffer for data rewritten every frame (text quads, instance data, uniforms)
+//
+// With GL 4.4 / ARB_buffer_storage the buffer is mapped once, persistently
+// and coherently, and split into one region per frame in flight. A fence
+// at the end of each frame guards its region, so writes never touch memory
+// the GPU may still read and nothing waits on an implicit sync.
+// On plain GL 3.3 it falls back to glMapBufferRange(UNSYNCHRONIZED) within
+// the frame and orphans the buffer at the end of it.
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const unsigned int STREAM_BUFFER_FRAMES = 3;                 // frames the GPU may be behind
+const size_t STREAM_BUFFER_FRAME_BYTES = 4 * 1024 * 1024;   // per frame
+const GLuint64 STREAM_BUFFER_WAIT_TIMEOUT = 1000000;         // 1 ms per glClientWaitSync call
+
+// Valid until the end of the frame. data is only writable until commit()
+struct StreamAllocation {
+    void *data = nullptr;
+    unsigned int buffer = 0;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+class StreamBuffer
+{
+public:
+    void init(size_t frameBytes = STREAM_BUFFER_FRAME_BYTES)
+    {
+        persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+        regionSize = frameBytes;
+
+        int alignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniformAlignment = alignment > 0 ? (size_t)alignment : 256;
+
+        buffer = GLBuffer::create();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (persistent)
+        {
+            const size_t totalSize = regionSize * STREAM_BUFFER_FRAMES;
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags));
+            buffer.track(GPUMemory_Buffers, totalSize);
+        }
+        else
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, regionSize, nullptr, GL_STREAM_DRAW);
+            buffer.track(GPUMemory_Buffers, regionSize);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        region = 0;
+        head = 0;
+    }
+
+    void shutdown()
+    {
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+
+        if (mapped)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            mapped = nullptr;
+        }
+        buffer.reset();
+    }
+
+    // Space for this frame, aligned relative to the start of the buffer.
+    // Empty allocation if the frame's region is full
+    StreamAllocation allocate(size_t size, size_t alignment = 16)
+    {
+        StreamAllocation allocation;
+
+        const size_t regionStart = persistent ? region * regionSize : 0;
+        const size_t offset = alignUp(regionStart + head, alignment);
+        if (offset + size > regionStart + regionSize)
+        {
+            if (!overflowReported)
+                std::cout << "ERROR::STREAM_BUFFER::FRAME_REGION_FULL" << std::endl;
+            overflowReported = true;
+            return allocation;
+        }
+        head = offset + size - regionStart;
+
+        allocation.buffer = buffer;
+        allocation.offset = offset;
+        allocation.size = size;
+
+        if (persistent)
+        {
+            allocation.data = mapped + offset;
+        }
+        else
+        {
+            // nothing earlier in the frame overlaps, no need to sync
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            allocation.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                               GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        }
+        return allocation;
+    }
+
+    // Finishes writing an allocation, call before the draw using it
+    void commit(StreamAllocation& allocation)
+    {
+        if (!persistent && allocation.data)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        allocation.data = nullptr;
+    }
+
+    StreamAllocation upload(const void *data, size_t size, size_t alignment = 16)
+    {
+        StreamAllocation allocation = allocate(size, alignment);
+        if (allocation.data)
+            std::memcpy(allocation.data, data, size);
+        commit(allocation);
+        return allocation;
+    }
+
+    // Once per frame after the last draw using this frame's allocations
+    void endFrame()
+    {
+        if (!buffer)
+            return;
+
+        if (persistent)
+        {
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region = (region + 1) % STREAM_BUFFER_FRAMES;
+
+            // normally long done, this only waits when the GPU is frames behind
+            if (fences[region])
+            {
+                TRACE_SCOPE("StreamBuffer wait");
+                GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+                for (;;)
+                {
+                    const GLenum result = glClientWaitSync(fences[region], waitFlags, STREAM_BUFFER_WAIT_TIMEOUT);
+                    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+                        break;
+                    waitFlags = 0;
+                }
+                glDeleteSync(fences[region]);
+                fences[region] = 0;
+            }
+        }
+        else
+        {
+            // orphan, the driver hands out fresh storage while the old one is still read
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, regionSize, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        head = 0;
+    }
+
+    unsigned int getBuffer() const
+    {
+        return buffer;
+    }
+
+    // Offsets for glBindBufferRange(GL_UNIFORM_BUFFER, ...) have to be multiples of this
+    size_t getUniformAlignment() const
+    {
+        return uniformAlignment;
+    }
+
+    bool isPersistent() const
+    {
+        return persistent;
+    }
+
+private:
+    GLBuffer buffer;
+    unsigned char *mapped = nullptr;
+    bool persistent = false;
+    size_t regionSize = 0;
+    unsigned int region = 0;
+    size_t head = 0;        // bytes used in the current region
+    size_t uniformAlignment = 256;
+    GLsync fences[STREAM_BUFFER_FRAMES] = {};
+    bool overflowReported = false;
+
+    static size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+};
+
+// Shared by everything streaming per frame data, main calls init/endFrame/shutdown
+StreamBuffer FrameStream;
+
+#endif
@@ -0,0 +1,148 @@
+// Temporal accumulation of a noisy screen space signal (AO, shadow masks)
+//
+// Keeps a history of the signal with the view normal + linear depth it was
+// computed for. Each frame every pixel is reprojected into the previous
+// frame with the previous view projection; where the surface there matches
+// in depth and normal the new value is blended into the history as a running
+// average over up to `maxFrames` frames, elsewhere the history restarts.
+// Producers vary their sample pattern per frame, so a few samples per frame
+// converge to the quality of many.
+
+#ifndef TEMPORAL_ACCUMULATION_H
+#define TEMPORAL_ACCUMULATION_H
+
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "render_shapes.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+class TemporalAccumulator
+{
+public:
+    TemporalAccumulator()
+        : resolveShader("shaders/vertex/2d_tex.glsl", "shaders/fragment/deferred/temporal_resolve.glsl")
+    {
+        resolveShader.use();
+        resolveShader.setInt("currentValue", 0);
+        resolveShader.setInt("depthNormal", 1);
+        resolveShader.setInt("history", 2);
+        resolveShader.setInt("historyDepthNormal", 3);
+    }
+
+    // Same size as the signal, history is dropped
+    void resize(int targetWidth, int targetHeight)
+    {
+        if (targetWidth == width && targetHeight == height)
+            return;
+
+        width = targetWidth;
+        height = targetHeight;
+        for (int i = 0; i < 2; i++)
+        {
+            // value + accumulated frame count, filtered so reprojection can land between texels
+            history[i] = createTexture(GL_RG16F, GL_RG, GL_LINEAR);
+            historyDepthNormal[i] = createTexture(GL_RGBA16F, GL_RGBA, GL_NEAREST);
+
+            framebuffers[i] = GLFramebuffer::create();
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, history[i], 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, historyDepthNormal[i], 0);
+            const unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::TEMPORAL_ACCUMULATION::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        historyValid = false;
+    }
+
+    // current: the signal in .r, depthNormal: view space normal + linear depth of the same pixels.
+    // Leaves the viewport at the target size
+    void resolve(unsigned int current, unsigned int depthNormal, const glm::mat4& view, const glm::mat4& projection)
+    {
+        TRACE_GPU_SCOPE("Temporal resolve");
+
+        const int write = 1 - read;
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[write]);
+        glViewport(0, 0, width, height);
+
+        resolveShader.use();
+        resolveShader.setMat4("projection", projection);
+        resolveShader.setMat4("inverseView", glm::inverse(view));
+        resolveShader.setMat4("previousView", previousView);
+        resolveShader.setMat4("previousViewProjection", previousProjection * previousView);
+        resolveShader.setInt("maxFrames", maxFrames);
+        resolveShader.setBool("historyValid", historyValid);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, current);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthNormal);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, history[read]);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, historyDepthNormal[read]);
+        renderQuad();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        read = write;
+        previousView = view;
+        previousProjection = projection;
+        historyValid = true;
+    }
+
+    // Accumulated signal in .r
+    unsigned int getTexture() const
+    {
+        return history[read];
+    }
+
+    // Longer averages are smoother but lag behind moving shadows
+    void setMaxFrames(int frames)
+    {
+        maxFrames = frames > 1 ? frames : 1;
+    }
+
+    void reset()
+    {
+        historyValid = false;
+    }
+
+private:
+    Shader resolveShader;
+
+    GLTexture history[2];
+    GLTexture historyDepthNormal[2];
+    GLFramebuffer framebuffers[2];
+    int read = 0;
+    int width = 0, height = 0;
+
+    int maxFrames = 8;
+    bool historyValid = false;
+    glm::mat4 previousView = glm::mat4(1.0f);
+    glm::mat4 previousProjection = glm::mat4(1.0f);
+
+    GLTexture createTexture(GLenum internalFormat, GLenum format, GLenum filter) const
+    {
+        GLTexture texture = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GPUMemoryTrackTexture(texture, GPUMemory_RenderTargets, internalFormat, width, height);
+        return texture;
+    }
+};
+
+#endif
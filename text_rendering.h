@@ -7,6 +7,8 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
+#include <cstring>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -16,6 +18,9 @@
 #include <glad/glad.h>
 
 #include "shader.h"
+#include "trace_events.h"
+#include "gl_resources.h"
+#include "stream_buffer.h"
 
 
 struct Character {
@@ -26,11 +31,14 @@ struct Character {
 };
 
 std::map<char, Character> Characters;
+std::vector<GLTexture> glyphTextures; // owns the Character texture ids
 
-unsigned int VAO, VBO;
+GLVertexArray VAO; // quads come from FrameStream
 
 int loadFont(const char *path)
 {
+    TRACE_SCOPE_DETAIL("loadFont", path);
+
     FT_Library ft;
     if (FT_Init_FreeType(&ft))
     {
@@ -57,8 +65,7 @@ int loadFont(const char *path)
             continue;
         }
         // generate texture
-        unsigned int texture;
-        glGenTextures(1, &texture);
+        GLTexture texture = GLTexture::create();
         glBindTexture(GL_TEXTURE_2D, texture);
         glTexImage2D(
             GL_TEXTURE_2D,
@@ -71,6 +78,7 @@ int loadFont(const char *path)
             GL_UNSIGNED_BYTE,
             face->glyph->bitmap.buffer
         );
+        texture.track(GPUMemory_Text, face->glyph->bitmap.width * face->glyph->bitmap.rows);
         // set texture options
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -84,45 +92,52 @@ int loadFont(const char *path)
             face->glyph->advance.x
         };
         Characters.insert(std::pair<char, Character>(c, character));
+        glyphTextures.push_back(std::move(texture));
     }
 
     FT_Done_Face(face);
     FT_Done_FreeType(ft);
 
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    VAO = GLVertexArray::create();
     glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
     return 0;
 }
 
-void RenderText(Shader &s, std::string text, float x, float y, float scale, glm::vec3 color)
+// Frees the glyph textures and the quad VAO
+void unloadFont()
 {
-    // activate corresponding render state	
-    // s.use();
-    s.setVec3("textColor", color.x, color.y, color.z);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(VAO);
+    Characters.clear();
+    glyphTextures.clear();
+    VAO.reset();
+}
 
-    // iterate through all characters
-    std::string::const_iterator c;
-    for (c = text.begin(); c != text.end(); c++)
+void RenderText(Shader &s, std::string text, float x, float y, float scale, glm::vec3 color)
+{
+    if (text.empty())
+        return;
+
+    // all quads of the string go up in one write
+    const size_t GLYPH_VERTICES = 6;
+    const size_t VERTEX_BYTES = 4 * sizeof(float);
+    StreamAllocation quads = FrameStream.allocate(text.size() * GLYPH_VERTICES * VERTEX_BYTES, VERTEX_BYTES);
+    if (!quads.data)
+        return;
+
+    float (*vertices)[4] = static_cast<float (*)[4]>(quads.data);
+    for (size_t i = 0; i < text.size(); i++)
     {
-        Character ch = Characters[*c];
+        const Character& ch = Characters[text[i]];
 
         float xpos = x + ch.Bearing.x * scale;
         float ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
 
         float w = ch.Size.x * scale;
         float h = ch.Size.y * scale;
-        // update VBO for each character
-        float vertices[6][4] = {
+
+        const float quad[6][4] = {
             { xpos,     ypos + h,   0.0f, 0.0f },            
             { xpos,     ypos,       0.0f, 1.0f },
             { xpos + w, ypos,       1.0f, 1.0f },
@@ -131,17 +146,30 @@ void RenderText(Shader &s, std::string text, float x, float y, float scale, glm:
             { xpos + w, ypos,       1.0f, 1.0f },
             { xpos + w, ypos + h,   1.0f, 0.0f }           
         };
-        // render glyph texture over quad
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-        // update content of VBO memory
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        // render quad
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        std::memcpy(vertices + i * GLYPH_VERTICES, quad, sizeof(quad));
+
         // now advance cursors for next glyph (note that advance is number of 1/64 pixels)
         x += (ch.Advance >> 6) * scale; // bitshift by 6 to get value in pixels (2^6 = 64)
     }
+    FrameStream.commit(quads);
+
+    // activate corresponding render state	
+    // s.use();
+    s.setVec3("textColor", color.x, color.y, color.z);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, quads.buffer);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, VERTEX_BYTES, 0);
+
+    // one draw per glyph, each has its own texture
+    const GLint firstVertex = static_cast<GLint>(quads.offset / VERTEX_BYTES);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, Characters[text[i]].TextureID);
+        glDrawArrays(GL_TRIANGLES, firstVertex + static_cast<GLint>(i * GLYPH_VERTICES), GLYPH_VERTICES);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
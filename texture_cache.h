@@ -0,0 +1,238 @@
+// Process wide cache of file textures, shared by every Model and PBRMaterial
+//
+// Entries are keyed by canonical path + colour space + filter and by a hash
+// of the decoded pixels, so the same file reached through different relative
+// paths, or identical images saved under different names, end up as one GL
+// texture. A content hit is only taken when the size, the settings and a
+// second independent hash match too. The cache only keeps weak references, a texture is deleted once
+// the last CachedTexture using it goes away.
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+
+#include "texture_loader.h"
+#include "gl_resources.h"
+
+
+// Refcounted texture, converts to the raw id like GLTexture does
+class CachedTexture
+{
+public:
+    CachedTexture() = default;
+    explicit CachedTexture(std::shared_ptr<GLTexture> texture) : texture(std::move(texture)) {}
+
+    operator unsigned int() const { return get(); }
+    unsigned int get() const { return texture ? texture->get() : 0; }
+
+    explicit operator bool() const { return get() != 0; }
+
+private:
+    std::shared_ptr<GLTexture> texture;
+};
+
+// Two independent 64 bit hashes of the pixels and settings: the first keys
+// the cache, the second is compared on a hit
+struct TextureContentHash {
+    uint64_t hash = 0;
+    uint64_t check = 0;
+};
+
+struct TextureCacheStats {
+    unsigned int pathHits;
+    unsigned int contentHits;
+    unsigned int loads;
+};
+
+class TextureCache
+{
+public:
+    // Full path of the file as it would be opened, relative paths are resolved
+    // against the working directory and ./.. segments removed
+    static std::string canonicalPath(const std::string& path)
+    {
+        std::error_code error;
+        const std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+        return error ? path : canonical.generic_string();
+    }
+
+    // Already loaded texture for the file, empty if there is none (doesn't load anything)
+    CachedTexture find(const std::string& path, Input_format format, Texture_filter filter = LINEAR)
+    {
+        auto entry = byPath.find(pathKey(canonicalPath(path), format, filter));
+        if (entry == byPath.end())
+            return CachedTexture();
+
+        std::shared_ptr<GLTexture> texture = entry->second.lock();
+        if (!texture)
+        {
+            byPath.erase(entry);
+            return CachedTexture();
+        }
+
+        stats.pathHits++;
+        return CachedTexture(std::move(texture));
+    }
+
+    CachedTexture load(const std::string& path, Input_format format, Texture_filter filter = LINEAR)
+    {
+        CachedTexture cached = find(path, format, filter);
+        if (cached)
+            return cached;
+
+        ImageData image = LoadImageData(path.c_str());
+        cached = fromImage(path, image, format, filter);
+        FreeImageData(image);
+
+        return cached;
+    }
+
+    // Uploads an image decoded elsewhere (on a worker thread) unless the same
+    // pixels are already in the cache. GL thread only, the image is not freed.
+    // The content hash can be computed up front on the decoding thread
+    CachedTexture fromImage(const std::string& path, const ImageData& image, Input_format format,
+                            Texture_filter filter = LINEAR, const TextureContentHash *precomputedHash = nullptr)
+    {
+        if (!image.data)
+            return CachedTexture();
+
+        const std::string key = pathKey(canonicalPath(path), format, filter);
+        const TextureContentHash hash = precomputedHash ? *precomputedHash : contentHash(image, format, filter);
+
+        std::shared_ptr<GLTexture> texture;
+        auto sameContent = byContent.find(hash.hash);
+        const bool occupied = sameContent != byContent.end() && !sameContent->second.texture.expired();
+        if (occupied && sameContent->second.matches(image, format, filter, hash.check))
+        {
+            texture = sameContent->second.texture.lock();
+            if (texture)
+                stats.contentHits++;
+        }
+
+        if (!texture)
+        {
+            texture = std::make_shared<GLTexture>(TextureFromImage(image, format, filter));
+            if (texture->get() == 0)
+                return CachedTexture();
+
+            // a colliding image keeps its entry, this one is only found by path
+            if (!occupied)
+                byContent[hash.hash] = { hash.check, image.width, image.height, image.nrChannels, format, filter, texture };
+            stats.loads++;
+        }
+
+        byPath[key] = texture;
+        return CachedTexture(std::move(texture));
+    }
+
+    // Drops the entries of textures that were already deleted
+    void trim()
+    {
+        for (auto entry = byPath.begin(); entry != byPath.end();)
+            entry = entry->second.expired() ? byPath.erase(entry) : std::next(entry);
+        for (auto entry = byContent.begin(); entry != byContent.end();)
+            entry = entry->second.texture.expired() ? byContent.erase(entry) : std::next(entry);
+    }
+
+    // Every 8 byte word goes through a full avalanche mixer (the murmur3
+    // finalizer) before it's folded in, so no bit of it can cancel out with
+    // another word's. The two hashes use different seeds and fold constants.
+    // The size and settings are part of both
+    static TextureContentHash contentHash(const ImageData& image, Input_format format, Texture_filter filter = LINEAR)
+    {
+        TextureContentHash result = { 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL };
+        auto mix = [&](uint64_t value)
+        {
+            result.hash = rotateLeft(result.hash ^ avalanche(value + 0x165667b19e3779f9ULL), 27) * 0xff51afd7ed558ccdULL;
+            result.check = rotateLeft(result.check ^ avalanche(value ^ 0x27d4eb2f165667c5ULL), 31) * 0xc4ceb9fe1a85ec53ULL;
+        };
+
+        mix(((uint64_t)image.width << 32) | (uint32_t)image.height);
+        mix(((uint64_t)image.nrChannels << 32) | (uint32_t)format);
+        mix((uint64_t)filter);
+
+        const size_t size = (size_t)image.width * image.height * image.nrChannels;
+        const unsigned char *bytes = image.data;
+
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            mix(word);
+        }
+        uint64_t tail = size - i; // the tail length keeps trailing zero bytes significant
+        for (int shift = 8; i < size; i++, shift += 8)
+            tail |= (uint64_t)bytes[i] << shift;
+        mix(tail);
+
+        result.hash = avalanche(result.hash);
+        result.check = avalanche(result.check);
+        return result;
+    }
+
+    const TextureCacheStats& getStats() const
+    {
+        return stats;
+    }
+
+    void report()
+    {
+        trim();
+        std::cout << "Texture cache: " << stats.loads << " loaded, "
+                  << stats.pathHits << " path hits, " << stats.contentHits << " content hits, "
+                  << byContent.size() << " alive" << '\n';
+    }
+
+private:
+    struct ContentEntry {
+        uint64_t check;
+        int width;
+        int height;
+        int nrChannels;
+        Input_format format;
+        Texture_filter filter;
+        std::weak_ptr<GLTexture> texture;
+
+        bool matches(const ImageData& image, Input_format imageFormat, Texture_filter imageFilter, uint64_t imageCheck) const
+        {
+            return check == imageCheck && width == image.width && height == image.height &&
+                   nrChannels == image.nrChannels && format == imageFormat && filter == imageFilter;
+        }
+    };
+
+    std::unordered_map<std::string, std::weak_ptr<GLTexture>> byPath;
+    std::unordered_map<uint64_t, ContentEntry> byContent;
+    TextureCacheStats stats = {};
+
+    static uint64_t rotateLeft(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static uint64_t avalanche(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+
+    static std::string pathKey(const std::string& canonical, Input_format format, Texture_filter filter)
+    {
+        return canonical + '|' + std::to_string(format) + '|' + std::to_string(filter);
+    }
+};
+
+TextureCache Textures;
+
+#endif
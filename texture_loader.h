@@ -2,11 +2,19 @@
 #define TEXTURE_LOADER_H
 
 #include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
 
 #include <glad/glad.h>
 
 #include <stb/image_load.cpp>
 
+#include "trace_events.h"
+#include "gl_resources.h"
+#include "ktx_file.h"
+#include "hdr_image.h"
+
 
 enum Texture_filter {
     NEAREST = 0x2600,
@@ -25,6 +33,8 @@ enum Input_format {
 // Generate textures and its object and bind it
 unsigned int TextureFromFile(const char* path)
 {
+    TRACE_SCOPE_DETAIL("TextureFromFile", path);
+
     // Load image
     int width, height, nrChannels;
     unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
@@ -73,6 +83,7 @@ unsigned int TextureFromFile(const char* path)
     // The last argument is the actual image data
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    GPUMemoryTrackTexture(id, GPUMemory_Textures, format, width, height, 1, true);
 
     // Free the image data after its loaded into GL object
     stbi_image_free(data);
@@ -80,27 +91,184 @@ unsigned int TextureFromFile(const char* path)
     return id;
 }
 
-unsigned int TextureFromFile(const char* path, Input_format texformat)
+// Decoded image waiting for upload, LoadImageData doesn't touch GL so it can run on any thread
+struct ImageData {
+    unsigned char *data = nullptr;
+    int width = 0;
+    int height = 0;
+    int nrChannels = 0;
+};
+
+ImageData LoadImageData(const char* path)
 {
-    // Load image
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
-    if (!data)
-    {
+    TRACE_SCOPE_DETAIL("LoadImageData", path);
+
+    ImageData image;
+    image.data = stbi_load(path, &image.width, &image.height, &image.nrChannels, 0);
+    if (!image.data)
         std::cout << "Failed to load texture" << std::endl;
-        return 0;
+
+    return image;
+}
+
+inline void FreeImageData(ImageData& image)
+{
+    stbi_image_free(image.data);
+    image.data = nullptr;
+}
+
+// Packs the first channel of three grayscale maps into one RGB image
+// (R = ao, G = roughness, B = metallic). Missing maps (no data) are filled
+// with the given defaults, differently sized maps are point sampled up to
+// the largest one. Free the result with FreeImageData
+ImageData PackORMImage(const ImageData& ao, const ImageData& roughness, const ImageData& metallic,
+                       unsigned char defaultAo = 255, unsigned char defaultRoughness = 255,
+                       unsigned char defaultMetallic = 0)
+{
+    TRACE_SCOPE("PackORMImage");
+
+    const ImageData* sources[3] = { &ao, &roughness, &metallic };
+    const unsigned char defaults[3] = { defaultAo, defaultRoughness, defaultMetallic };
+
+    ImageData packed;
+    packed.nrChannels = 3;
+    for (const ImageData* source : sources)
+    {
+        if (!source->data)
+            continue;
+        packed.width = std::max(packed.width, source->width);
+        packed.height = std::max(packed.height, source->height);
+    }
+    if (packed.width == 0 || packed.height == 0)
+        return packed;
+
+    // malloc, stbi_image_free is free()
+    packed.data = static_cast<unsigned char*>(std::malloc((size_t)packed.width * packed.height * 3));
+    if (!packed.data)
+        return packed;
+
+    for (int channel = 0; channel < 3; channel++)
+    {
+        const ImageData& source = *sources[channel];
+        unsigned char *dst = packed.data + channel;
+
+        for (int y = 0; y < packed.height; y++)
+        {
+            const int sy = source.data ? (int)((long long)y * source.height / packed.height) : 0;
+            for (int x = 0; x < packed.width; x++, dst += 3)
+            {
+                if (!source.data)
+                {
+                    *dst = defaults[channel];
+                    continue;
+                }
+                const int sx = (int)((long long)x * source.width / packed.width);
+                *dst = source.data[((size_t)sy * source.width + sx) * source.nrChannels];
+            }
+        }
+    }
+
+    return packed;
+}
+
+// Point sampled copy with another size and channel count, gray is replicated
+// to RGB and a missing alpha is opaque. Without source data the result is
+// filled with `fill` (RGBA). Free the result with FreeImageData
+ImageData ConvertImage(const ImageData& source, int width, int height, int channels,
+                       const unsigned char fill[4])
+{
+    ImageData converted;
+    converted.width = width;
+    converted.height = height;
+    converted.nrChannels = channels;
+    converted.data = static_cast<unsigned char*>(std::malloc((size_t)width * height * channels));
+    if (!converted.data)
+        return converted;
+
+    unsigned char *dst = converted.data;
+    for (int y = 0; y < height; y++)
+    {
+        const int sy = source.data ? (int)((long long)y * source.height / height) : 0;
+        for (int x = 0; x < width; x++, dst += channels)
+        {
+            unsigned char texel[4] = { fill[0], fill[1], fill[2], fill[3] };
+            if (source.data)
+            {
+                const int sx = (int)((long long)x * source.width / width);
+                const unsigned char *src = source.data + ((size_t)sy * source.width + sx) * source.nrChannels;
+
+                if (source.nrChannels < 3)
+                    texel[0] = texel[1] = texel[2] = src[0];
+                else
+                    texel[0] = src[0], texel[1] = src[1], texel[2] = src[2];
+                texel[3] = source.nrChannels == 4 ? src[3] : 255;
+            }
+
+            for (int c = 0; c < channels; c++)
+                dst[c] = texel[c];
+        }
+    }
+
+    return converted;
+}
+
+// Next mip level of an image, a 2x2 box filter (odd edges repeat the last
+// texel). Averages the stored values, sRGB data is not linearized first.
+// Free the result with FreeImageData
+ImageData DownsampleImage(const ImageData& source)
+{
+    ImageData half;
+    if (!source.data)
+        return half;
+
+    half.width = std::max(source.width / 2, 1);
+    half.height = std::max(source.height / 2, 1);
+    half.nrChannels = source.nrChannels;
+    half.data = static_cast<unsigned char*>(std::malloc((size_t)half.width * half.height * half.nrChannels));
+    if (!half.data)
+        return half;
+
+    const int channels = source.nrChannels;
+    unsigned char *dst = half.data;
+    for (int y = 0; y < half.height; y++)
+    {
+        const int y0 = std::min(y * 2, source.height - 1);
+        const int y1 = std::min(y * 2 + 1, source.height - 1);
+        for (int x = 0; x < half.width; x++, dst += channels)
+        {
+            const int x0 = std::min(x * 2, source.width - 1);
+            const int x1 = std::min(x * 2 + 1, source.width - 1);
+            const unsigned char *texels[4] = {
+                source.data + ((size_t)y0 * source.width + x0) * channels,
+                source.data + ((size_t)y0 * source.width + x1) * channels,
+                source.data + ((size_t)y1 * source.width + x0) * channels,
+                source.data + ((size_t)y1 * source.width + x1) * channels,
+            };
+
+            for (int c = 0; c < channels; c++)
+                dst[c] = (unsigned char)((texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4);
+        }
     }
 
+    return half;
+}
+
+// Uploads a decoded image, GL thread only (the image data is not freed)
+unsigned int TextureFromImage(const ImageData& image, Input_format texformat, Texture_filter mag_filter = LINEAR)
+{
+    if (!image.data)
+        return 0;
+
     // Get the format based on the number of channels
     GLenum format;
-    if (nrChannels == 1)
+    if (image.nrChannels == 1)
     {
         format = GL_RED;
         texformat = RED;
     }
-    else if (nrChannels == 3)
+    else if (image.nrChannels == 3)
         format = GL_RGB;
-    else if (nrChannels == 4)
+    else if (image.nrChannels == 4)
     {
         format = GL_RGBA;
         if (texformat == GAMMA_CORRECTED)
@@ -111,7 +279,6 @@ unsigned int TextureFromFile(const char* path, Input_format texformat)
     else
     {
         std::cout << "Unsupported texture format" << std::endl;
-        stbi_image_free(data);
         return 0;
     }
 
@@ -125,29 +292,34 @@ unsigned int TextureFromFile(const char* path, Input_format texformat)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
 
     // Texture filtering with mipmaps
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
     // Set the image as the openGL objects data and generate a mipmap for it
-
-    // The first argument specifies the texture target
-    // The second argument specifies the mipmap level for which we want to create a texture for
-    // The third argument tells OpenGL in what kind of format we want to store the texture
-    // The 4th and 5th argument sets the width and height of the resulting texture
-    // The next argument should always be 0 (some legacy stuff).
-    // The 7th and 8th argument specify the format and datatype of the source image
-    // The last argument is the actual image data
-    glTexImage2D(GL_TEXTURE_2D, 0, texformat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    glTexImage2D(GL_TEXTURE_2D, 0, texformat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    GPUMemoryTrackTexture(id, GPUMemory_Textures, texformat, image.width, image.height, 1, true);
+
+    return id;
+}
+
+unsigned int TextureFromFile(const char* path, Input_format texformat)
+{
+    TRACE_SCOPE_DETAIL("TextureFromFile", path);
+
+    ImageData image = LoadImageData(path);
+    const unsigned int id = TextureFromImage(image, texformat);
 
     // Free the image data after its loaded into GL object
-    stbi_image_free(data);
+    FreeImageData(image);
 
     return id;
 }
 
 unsigned int TextureFromFile(const char* path, Texture_filter mag_filter)
 {
+    TRACE_SCOPE_DETAIL("TextureFromFile", path);
+
     // Load image
     int width, height, nrChannels;
     unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
@@ -196,6 +368,7 @@ unsigned int TextureFromFile(const char* path, Texture_filter mag_filter)
     // The last argument is the actual image data
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    GPUMemoryTrackTexture(id, GPUMemory_Textures, format, width, height, 1, true);
 
     // Free the image data after its loaded into GL object
     stbi_image_free(data);
@@ -205,6 +378,8 @@ unsigned int TextureFromFile(const char* path, Texture_filter mag_filter)
 
 unsigned int loadCubemap(const char** faces)
 {
+    TRACE_SCOPE("loadCubemap");
+
     unsigned int id;
     glGenTextures(1, &id);
     glBindTexture(GL_TEXTURE_CUBE_MAP, id);
@@ -220,6 +395,8 @@ unsigned int loadCubemap(const char** faces)
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 
                          0, GL_RGB, width, height, 0, inputFormat, GL_UNSIGNED_BYTE, data
             );
+            if (i == 0)
+                GPUMemoryTrackTexture(id, GPUMemory_Environment, GL_RGB, width, height, 6);
             stbi_image_free(data);
         }
         else
@@ -238,34 +415,110 @@ unsigned int loadCubemap(const char** faces)
     return id;
 }  
 
-unsigned int loadHdrTexture(const char* path)
+// Streams an HDR image into a texture a row at a time, packed to internalFormat:
+// GL_RGB9_E5 (default, 9 bit mantissas with a shared exponent), GL_R11F_G11F_B10F
+// (6/6/5 bit mantissas, renderable) or GL_RGB16F. All three clamp at ~65000
+unsigned int loadHdrTexture(const char* path, GLenum internalFormat = GL_RGB9_E5)
 {
-    int width, height, nrComponents;
-    float *data = stbi_loadf(path, &width, &height, &nrComponents, 0);
+    TRACE_SCOPE_DETAIL("loadHdrTexture", path);
+
+    HDRImageReader image;
+    if (!image.open(path))
+    {
+        std::cout << "Failed to load HDR image." << std::endl;
+        return 0;
+    }
+    const int width = image.getWidth(), height = image.getHeight();
+
     unsigned int hdrTexture;
-    if (data)
+    glGenTextures(1, &hdrTexture);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    const GLenum type = internalFormat == GL_RGB9_E5 ? GL_UNSIGNED_INT_5_9_9_9_REV
+                      : internalFormat == GL_R11F_G11F_B10F ? GL_UNSIGNED_INT_10F_11F_11F_REV : GL_FLOAT;
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGB, type, nullptr);
+    GPUMemoryTrackTexture(hdrTexture, GPUMemory_Environment, internalFormat, width, height);
+
+    // one row of floats and one packed, never the whole image
+    std::vector<float> row((size_t)width * 3);
+    std::vector<uint32_t> packed(type == GL_FLOAT ? 0 : (size_t)width);
+    GLint previousAlignment = 1;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    int y;
+    while (image.readRow(row.data(), y))
     {
-        glGenTextures(1, &hdrTexture);
-        glBindTexture(GL_TEXTURE_2D, hdrTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data); 
+        if (type == GL_FLOAT)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1, GL_RGB, GL_FLOAT, row.data());
+            continue;
+        }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        for (int x = 0; x < width; x++)
+        {
+            const float* texel = &row[(size_t)x * 3];
+            packed[x] = internalFormat == GL_RGB9_E5 ? PackRGB9E5(texel[0], texel[1], texel[2])
+                                                     : PackR11G11B10F(texel[0], texel[1], texel[2]);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1, GL_RGB, type, packed.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
 
-        stbi_image_free(data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return hdrTexture;
+}
+
+// Loads an uncompressed KTX file (2D or cubemap, every mip level stored),
+// as written by the offline bakers in tools/. Returns 0 on failure
+unsigned int loadKTXTexture(const char* path, GPUMemoryCategory category = GPUMemory_Textures)
+{
+    TRACE_SCOPE_DETAIL("loadKTXTexture", path);
+
+    KTXImage ktx;
+    if (!ReadKTX(path, ktx))
+        return 0;
+    if (ktx.faces != 1 && ktx.faces != 6)
+    {
+        std::cout << "ERROR::KTX::UNSUPPORTED_FACE_COUNT: " << path << std::endl;
+        return 0;
     }
-    else
+
+    const GLenum target = ktx.faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+
+    GLint previousAlignment = 1;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // KTX rows are padded to 4 bytes
+    for (int level = 0; level < ktx.levels; level++)
     {
-        std::cout << "Failed to load HDR image." << std::endl;
+        for (int face = 0; face < ktx.faces; face++)
+        {
+            const GLenum imageTarget = ktx.faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+            glTexImage2D(imageTarget, level, ktx.glInternalFormat, ktx.levelWidth(level), ktx.levelHeight(level), 0,
+                         ktx.glFormat, ktx.glType, ktx.image(level, face).data());
+        }
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+    GPUMemoryTrackTexture(texture, category, ktx.glInternalFormat, ktx.width, ktx.height, ktx.faces, ktx.levels > 1);
 
-    return hdrTexture;
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, ktx.levels - 1);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, ktx.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return texture;
 }
 
 inline void deleteTexture(unsigned int texture)
 {
+    GPUMemoryUntrack(GLResource_Texture, texture);
     glDeleteTextures(1, &texture);
 }
 
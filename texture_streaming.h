@@ -0,0 +1,540 @@
+// Textures streamed in mip by mip under a VRAM budget
+//
+// A texture starts as a 1x1 placeholder. A background thread decodes the
+// image and builds its mip chain, then the main thread uploads the levels
+// it needs, smallest first and a limited amount per frame. Resident levels
+// are clamped with GL_TEXTURE_BASE_LEVEL, so the texture id stays the same
+// while it grows or shrinks. Every frame the renderer reports how many
+// pixels a texture covers on screen (request()), which gives the mip it
+// needs. The decoded chain is kept until every level is resident, so finer
+// levels are uploaded from it as they're needed; only a complete texture
+// that lost levels to the budget is decoded again. When the
+// budget is full, levels nobody needs and then the least recently used
+// textures are dropped first. The small tail of each chain always stays.
+
+#ifndef TEXTURE_STREAMING_H
+#define TEXTURE_STREAMING_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "texture_loader.h"
+#include "screen_coverage.h"
+#include "gl_resources.h"
+#include "trace_events.h"
+
+
+const size_t TEXTURE_STREAMING_BUDGET = 256 * 1024 * 1024;         // bytes of resident levels
+const size_t TEXTURE_STREAMING_UPLOAD_BYTES = 8 * 1024 * 1024;     // per frame, at least one level
+const int TEXTURE_STREAMING_TAIL_SIZE = 64;                         // levels this small are never evicted
+
+typedef unsigned int StreamedTextureHandle;
+
+// Loads the full resolution image, runs on the streaming thread
+typedef std::function<ImageData()> TextureSourceLoader;
+
+struct TextureStreamingStats {
+    unsigned int decodes;        // images decoded by the streaming thread
+    unsigned int levelsUploaded;
+    unsigned int levelsEvicted;
+};
+
+class TextureStreamer
+{
+public:
+    TextureStreamer() = default;
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    ~TextureStreamer()
+    {
+        stopThread();
+    }
+
+    void init(size_t budgetBytes = TEXTURE_STREAMING_BUDGET)
+    {
+        budget = budgetBytes;
+        stopping = false;
+        worker = std::thread(&TextureStreamer::workerLoop, this);
+    }
+
+    // Frees everything, has to run while the context is alive
+    void shutdown()
+    {
+        stopThread();
+
+        for (std::unique_ptr<StreamedTexture>& texture : textures)
+        {
+            freeChain(*texture);
+            texture->texture.reset();
+            texture->placeholder.reset();
+        }
+        textures.clear();
+        residentBytes = 0;
+    }
+
+    // The placeholder (fill, RGBA) is bound until the first levels arrive
+    StreamedTextureHandle add(const std::string& name, TextureSourceLoader loader, Input_format format,
+                              const unsigned char fill[4])
+    {
+        std::unique_ptr<StreamedTexture> texture = std::make_unique<StreamedTexture>();
+        texture->name = name;
+        texture->loader = std::move(loader);
+        texture->format = format;
+        texture->placeholder = createPlaceholder(fill);
+
+        const StreamedTextureHandle handle = static_cast<StreamedTextureHandle>(textures.size());
+        textures.push_back(std::move(texture));
+        queueDecode(handle);
+        return handle;
+    }
+
+    StreamedTextureHandle add(const std::string& path, Input_format format, const unsigned char fill[4])
+    {
+        return add(path, [path]() { return LoadImageData(path.c_str()); }, format, fill);
+    }
+
+    // The texture spans `pixels` on screen this frame, the largest request of the frame wins
+    void request(StreamedTextureHandle handle, float pixels)
+    {
+        if (handle >= textures.size())
+            return;
+
+        StreamedTexture& texture = *textures[handle];
+        texture.requestedPixels = std::max(texture.requestedPixels, pixels);
+        texture.lastUsed = frame;
+    }
+
+    // Once per frame before drawing with the textures
+    void update()
+    {
+        TRACE_SCOPE("TextureStreamer::update");
+
+        collectDecoded();
+
+        for (StreamedTextureHandle handle = 0; handle < textures.size(); handle++)
+        {
+            StreamedTexture& texture = *textures[handle];
+            if (texture.mipCount > 0 && texture.lastUsed == frame)
+                texture.desiredMip = mipForPixels(texture, texture.requestedPixels);
+            texture.requestedPixels = 0.0f;
+
+            // finer levels are needed than were decoded last time, and they'd fit
+            if (!texture.decoding && texture.chain.empty() && texture.desiredMip < texture.residentMip &&
+                residentBytes + levelBytes(texture, texture.residentMip - 1) <= budget + evictableBytes(handle))
+                queueDecode(handle);
+        }
+
+        uploadLevels();
+        frame++;
+    }
+
+    unsigned int getTexture(StreamedTextureHandle handle) const
+    {
+        if (handle >= textures.size())
+            return 0;
+
+        const StreamedTexture& texture = *textures[handle];
+        return texture.residentMip < texture.mipCount ? texture.texture.get() : texture.placeholder.get();
+    }
+
+    // Finest resident level, -1 while only the placeholder is there
+    int getResidentMip(StreamedTextureHandle handle) const
+    {
+        const StreamedTexture& texture = *textures[handle];
+        return texture.residentMip < texture.mipCount ? texture.residentMip : -1;
+    }
+
+    size_t getResidentBytes() const
+    {
+        return residentBytes;
+    }
+
+    size_t getBudget() const
+    {
+        return budget;
+    }
+
+    void setBudget(size_t budgetBytes)
+    {
+        budget = budgetBytes;
+    }
+
+    const TextureStreamingStats& getStats() const
+    {
+        return stats;
+    }
+
+    void report() const
+    {
+        std::printf("Texture streaming: %u textures, %.2f / %.2f MB resident, %u decodes, %u levels uploaded, %u evicted\n",
+                    (unsigned int)textures.size(), residentBytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0),
+                    stats.decodes, stats.levelsUploaded, stats.levelsEvicted);
+    }
+
+private:
+    struct StreamedTexture {
+        std::string name;
+        TextureSourceLoader loader;
+        Input_format format = RGB;
+        GLTexture texture;
+        GLTexture placeholder;
+
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        int mipCount = 0;       // 0 until the first decode
+        int tailMip = 0;        // first level of the tail that always stays
+        int residentMip = 0;    // finest uploaded level, mipCount when none
+        int desiredMip = 0;
+
+        float requestedPixels = 0.0f;
+        uint64_t lastUsed = 0;
+        size_t bytes = 0;       // resident levels
+
+        bool decoding = false;
+        std::vector<ImageData> chain;   // decoded levels, kept until all of them are resident
+    };
+
+    struct DecodeJob {
+        StreamedTextureHandle handle;
+        std::string name;
+        TextureSourceLoader loader;
+    };
+
+    struct DecodeResult {
+        StreamedTextureHandle handle;
+        std::vector<ImageData> chain;
+    };
+
+    std::vector<std::unique_ptr<StreamedTexture>> textures;
+    size_t budget = TEXTURE_STREAMING_BUDGET;
+    size_t residentBytes = 0;
+    uint64_t frame = 1;
+    TextureStreamingStats stats = {};
+
+    // streaming thread, only the queues are shared
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<DecodeJob> jobs;
+    std::vector<DecodeResult> results;
+    bool stopping = false;
+
+    void stopThread()
+    {
+        if (!worker.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+
+        jobs.clear();
+        for (DecodeResult& result : results)
+        {
+            for (ImageData& level : result.chain)
+                FreeImageData(level);
+        }
+        results.clear();
+    }
+
+    void workerLoop()
+    {
+        TraceSetThreadName("Texture streaming");
+
+        for (;;)
+        {
+            DecodeJob job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            DecodeResult result;
+            result.handle = job.handle;
+            {
+                TRACE_SCOPE_DETAIL("Stream texture", job.name.c_str());
+
+                ImageData image = job.loader();
+                if (image.data)
+                {
+                    result.chain.push_back(image);
+                    while (result.chain.back().width > 1 || result.chain.back().height > 1)
+                        result.chain.push_back(DownsampleImage(result.chain.back()));
+                }
+                else
+                {
+                    std::cout << "ERROR::TEXTURE_STREAMING::LOAD_FAILED " << job.name << std::endl;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back(std::move(result));
+        }
+    }
+
+    void queueDecode(StreamedTextureHandle handle)
+    {
+        StreamedTexture& texture = *textures[handle];
+        texture.decoding = true;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({ handle, texture.name, texture.loader });
+        }
+        wake.notify_one();
+    }
+
+    void collectDecoded()
+    {
+        std::vector<DecodeResult> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(results);
+        }
+
+        for (DecodeResult& result : finished)
+        {
+            StreamedTexture& texture = *textures[result.handle];
+            texture.decoding = false;
+            stats.decodes++;
+            if (result.chain.empty())
+                continue;
+
+            if (texture.mipCount == 0)
+            {
+                texture.width = result.chain[0].width;
+                texture.height = result.chain[0].height;
+                texture.channels = result.chain[0].nrChannels;
+                texture.mipCount = static_cast<int>(result.chain.size());
+                texture.residentMip = texture.mipCount;
+
+                texture.tailMip = texture.mipCount - 1;
+                while (texture.tailMip > 0 && levelSize(texture, texture.tailMip - 1) <= TEXTURE_STREAMING_TAIL_SIZE)
+                    texture.tailMip--;
+                texture.desiredMip = texture.tailMip; // until the next request
+            }
+
+            freeChain(texture);
+            texture.chain = std::move(result.chain);
+        }
+    }
+
+    // Coarse to fine, so every frame ends with a complete (if blurry) texture
+    void uploadLevels()
+    {
+        size_t uploaded = 0;
+
+        for (StreamedTextureHandle handle = 0; handle < textures.size(); handle++)
+        {
+            StreamedTexture& texture = *textures[handle];
+            if (texture.chain.empty())
+                continue;
+
+            const int target = std::min(texture.desiredMip, texture.tailMip);
+            while (texture.residentMip > target)
+            {
+                const int level = texture.residentMip - 1;
+                const size_t bytes = levelBytes(texture, level);
+
+                if (uploaded > 0 && uploaded + bytes > TEXTURE_STREAMING_UPLOAD_BYTES)
+                    return; // the rest next frame, the chain is kept until then
+
+                // the tail goes in regardless of the budget
+                if (level < texture.tailMip && !makeRoom(bytes, handle))
+                    break;
+
+                uploadLevel(texture, level);
+                uploaded += bytes;
+            }
+
+            // finer levels requested later come from the chain, no decode
+            if (texture.residentMip == 0)
+                freeChain(texture);
+        }
+    }
+
+    void uploadLevel(StreamedTexture& texture, int level)
+    {
+        TRACE_SCOPE_DETAIL("Upload texture level", texture.name.c_str());
+
+        GLenum format;
+        const Input_format internalFormat = internalFormatFor(texture.format, texture.channels, format);
+
+        if (!texture.texture)
+        {
+            texture.texture = GLTexture::create();
+            glBindTexture(GL_TEXTURE_2D, texture.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.mipCount - 1);
+        }
+
+        const ImageData& image = texture.chain[level];
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        GLint previousAlignment = 1;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // small RGB levels have unaligned rows
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+        texture.residentMip = level;
+        texture.bytes += levelBytes(texture, level);
+        residentBytes += levelBytes(texture, level);
+        texture.texture.track(GPUMemory_Textures, texture.bytes);
+        stats.levelsUploaded++;
+    }
+
+    // Drops the finest level, the texture keeps sampling the ones below
+    void evictLevel(StreamedTexture& texture)
+    {
+        const int level = texture.residentMip;
+
+        GLenum format;
+        const Input_format internalFormat = internalFormatFor(texture.format, texture.channels, format);
+
+        // outside the BASE/MAX range, an empty level lets the driver release its storage
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+
+        texture.residentMip = level + 1;
+        texture.bytes -= levelBytes(texture, level);
+        residentBytes -= levelBytes(texture, level);
+        texture.texture.track(GPUMemory_Textures, texture.bytes);
+        stats.levelsEvicted++;
+    }
+
+    // Textures not used this frame can lose every level above the tail,
+    // the ones in use only the levels finer than they need
+    int evictionLimit(const StreamedTexture& texture) const
+    {
+        return texture.lastUsed == frame ? std::min(texture.desiredMip, texture.tailMip) : texture.tailMip;
+    }
+
+    size_t evictableBytes(StreamedTextureHandle requester) const
+    {
+        size_t bytes = 0;
+        for (StreamedTextureHandle handle = 0; handle < textures.size(); handle++)
+        {
+            const StreamedTexture& candidate = *textures[handle];
+            if (handle == requester)
+                continue;
+            for (int level = candidate.residentMip; level < evictionLimit(candidate); level++)
+                bytes += levelBytes(candidate, level);
+        }
+        return bytes;
+    }
+
+    // Evicts until `bytes` more fit the budget, least recently used first
+    bool makeRoom(size_t bytes, StreamedTextureHandle requester)
+    {
+        while (residentBytes + bytes > budget)
+        {
+            StreamedTexture* victim = nullptr;
+            for (StreamedTextureHandle handle = 0; handle < textures.size(); handle++)
+            {
+                StreamedTexture& candidate = *textures[handle];
+                if (handle == requester || candidate.residentMip >= evictionLimit(candidate))
+                    continue;
+
+                if (!victim || candidate.lastUsed < victim->lastUsed ||
+                    (candidate.lastUsed == victim->lastUsed && candidate.residentMip < victim->residentMip))
+                    victim = &candidate;
+            }
+
+            if (!victim)
+                return false;
+            evictLevel(*victim);
+        }
+        return true;
+    }
+
+    static void freeChain(StreamedTexture& texture)
+    {
+        for (ImageData& level : texture.chain)
+            FreeImageData(level);
+        texture.chain.clear();
+    }
+
+    static int levelSize(const StreamedTexture& texture, int level)
+    {
+        return std::max(std::max(texture.width, texture.height) >> level, 1);
+    }
+
+    static size_t levelBytes(const StreamedTexture& texture, int level)
+    {
+        GLenum format;
+        const Input_format internalFormat = internalFormatFor(texture.format, texture.channels, format);
+        return GPUTextureBytes(internalFormat, std::max(texture.width >> level, 1), std::max(texture.height >> level, 1));
+    }
+
+    // Enough texels for `pixels` on screen, clamped to the chain
+    static int mipForPixels(const StreamedTexture& texture, float pixels)
+    {
+        if (pixels <= 1.0f)
+            return texture.mipCount - 1;
+
+        const float ratio = std::max(texture.width, texture.height) / pixels;
+        const int mip = ratio > 1.0f ? static_cast<int>(std::floor(std::log2(ratio))) : 0;
+        return std::min(mip, texture.mipCount - 1);
+    }
+
+    // Same choice as TextureFromImage
+    static Input_format internalFormatFor(Input_format requested, int channels, GLenum& format)
+    {
+        if (channels == 1)
+        {
+            format = GL_RED;
+            return RED;
+        }
+        if (channels == 4)
+        {
+            format = GL_RGBA;
+            return requested == GAMMA_CORRECTED ? GAMMA_CORRECTED_ALPHA : RGBA;
+        }
+        format = GL_RGB;
+        return requested;
+    }
+
+    static GLTexture createPlaceholder(const unsigned char fill[4])
+    {
+        GLTexture placeholder = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, placeholder);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, fill);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        placeholder.track(GPUMemory_Textures, 4);
+        return placeholder;
+    }
+};
+
+#endif
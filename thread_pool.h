@@ -0,0 +1,299 @@
+// Persistent worker threads for running independent CPU work on all cores
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "trace_events.h"
+
+
+inline unsigned int hardwareThreadCount()
+{
+    const unsigned int count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// Number of unfinished jobs of a group, JobSystem::wait() returns once it is 0
+struct JobCounter {
+    std::atomic<int> pending{0};
+
+    bool done() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// Long lived workers with one job deque each. A worker pushes and pops
+// its own jobs at the back (the most recent, still in cache) and, once
+// empty, steals from the front of the others (the oldest, usually the
+// biggest pieces left). Threads that aren't workers submit to a shared
+// deque and help running jobs while they wait, so nested parallelism
+// can't deadlock. Jobs can also be held until the counter of another
+// group reaches 0, which chains the stages of a frame without a wait
+// in between.
+class JobSystem
+{
+public:
+    // threadCount includes the thread that waits, so threadCount - 1 workers are started
+    explicit JobSystem(unsigned int threadCount = hardwareThreadCount())
+    {
+        const unsigned int workerCount = std::max(threadCount, 2u) - 1;
+        for (unsigned int i = 0; i <= workerCount; i++)
+            queues.push_back(std::make_unique<Queue>());
+
+        running = true;
+        for (unsigned int i = 1; i <= workerCount; i++)
+        {
+            workers.emplace_back([this, i]()
+            {
+                TraceSetThreadName(("Job worker " + std::to_string(i)).c_str());
+                currentSystem = this;
+                currentQueue = i;
+                workerLoop(i);
+            });
+        }
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // counter, when given, is incremented now and decremented when the job finished
+    void submit(std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push({ std::move(job), counter });
+    }
+
+    // Like submit, but the job is only queued once every job counted by
+    // dependency finished (right away when none is pending). counter is
+    // incremented now, so waiting on it also covers the held job
+    void submitAfter(const JobCounter& dependency, std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            // checked under the lock the finishing job takes to release the held ones
+            std::lock_guard<std::mutex> lock(heldMutex);
+            if (!dependency.done())
+            {
+                held.push_back({ &dependency, { std::move(job), counter } });
+                return;
+            }
+        }
+        push({ std::move(job), counter });
+    }
+
+    // Runs jobs until every job counted by counter finished. Once there is
+    // nothing left to steal, sleeps until a job is queued or the last one finished
+    void wait(JobCounter& counter)
+    {
+        const unsigned int self = selfQueue();
+        while (!counter.done())
+        {
+            if (tryRun(self))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this, &counter]()
+            {
+                return counter.done() || queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+    // Like the free parallelFor, on the pool's workers
+    template <typename Fn>
+    void parallelFor(size_t count, Fn fn, size_t grain = 1)
+    {
+        grain = std::max<size_t>(grain, 1);
+        JobCounter counter;
+        for (size_t begin = 0; begin < count; begin += grain)
+        {
+            const size_t end = std::min(begin + grain, count);
+            submit([&fn, begin, end]()
+            {
+                for (size_t i = begin; i < end; i++)
+                    fn(i);
+            }, &counter);
+        }
+        wait(counter);
+    }
+
+    unsigned int getThreadCount() const
+    {
+        return static_cast<unsigned int>(workers.size()) + 1;
+    }
+
+private:
+    struct Job {
+        std::function<void()> fn;
+        JobCounter* counter;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct HeldJob {
+        const JobCounter* dependency;
+        Job job;
+    };
+
+    // queue 0 is shared by the threads that aren't workers
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{0};
+    bool running = false;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::mutex heldMutex;
+    std::vector<HeldJob> held;
+
+    static inline thread_local JobSystem* currentSystem = nullptr;
+    static inline thread_local unsigned int currentQueue = 0;
+
+    unsigned int selfQueue() const
+    {
+        return currentSystem == this ? currentQueue : 0;
+    }
+
+    void push(Job job)
+    {
+        Queue& queue = *queues[selfQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Counts a finished job, queues the jobs held on counter once it reached 0.
+    // Decremented under the lock: a waiter can free the counter as soon as it
+    // reads 0, and a new counter at the same address must not match
+    void finish(JobCounter* counter)
+    {
+        std::vector<Job> ready;
+        {
+            std::lock_guard<std::mutex> lock(heldMutex);
+            if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            for (size_t i = 0; i < held.size();)
+            {
+                if (held[i].dependency == counter)
+                {
+                    ready.push_back(std::move(held[i].job));
+                    held[i] = std::move(held.back());
+                    held.pop_back();
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+        for (Job& job : ready)
+            push(std::move(job));
+
+        // for the threads sleeping in wait(), the counter isn't touched anymore
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_all();
+    }
+
+    bool pop(unsigned int index, bool own, Job& job)
+    {
+        Queue& queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            return false;
+
+        if (own)
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool tryRun(unsigned int self)
+    {
+        Job job;
+        bool found = pop(self, self != 0, job);
+        for (unsigned int i = 1; i < queues.size() && !found; i++)
+            found = pop((self + i) % queues.size(), false, job);
+        if (!found)
+            return false;
+
+        job.fn();
+        if (job.counter)
+            finish(job.counter);
+        return true;
+    }
+
+    void workerLoop(unsigned int self)
+    {
+        for (;;)
+        {
+            if (tryRun(self))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return !running || queued.load(std::memory_order_acquire) > 0; });
+            if (!running)
+                return;
+        }
+    }
+};
+
+// Pool shared by the renderer and its loaders, started on first use
+inline JobSystem& SharedJobs()
+{
+    static JobSystem jobs;
+    return jobs;
+}
+
+// Calls fn(i) for every i in [0, count) on the shared pool, the calling
+// thread helping out. Indices are handed out in chunks of `grain`, idle
+// workers steal the chunks left, so uneven items balance themselves.
+// fn has to be safe to call concurrently for different indices.
+template <typename Fn>
+void parallelFor(size_t count, Fn fn, size_t grain = 1)
+{
+    SharedJobs().parallelFor(count, fn, grain);
+}
+
+#endif
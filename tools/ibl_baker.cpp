@@ -0,0 +1,677 @@
+// Offline IBL baker: equirectangular HDR map -> KTX cubemaps + BRDF LUT
+//
+//     ibl_baker <equirectangular image (.hdr, .exr, ...)> <output folder> [options]
+//         --size N            environment cubemap face size (512)
+//         --prefilter-size N  prefiltered cubemap face size (128), 5 roughness mips
+//         --lut-size N        BRDF lookup texture size (512)
+//         --samples N         GGX samples per texel (1024)
+//         --threads N         threads, all cores by default
+//         --verify            also bake the LUT without SSE and compare the two
+//
+// Writes environment.ktx (RGB16F cubemap with its full mip chain),
+// prefiltered.ktx (RGB16F cubemap, mip m = roughness m / 4) and brdf_lut.ktx
+// (RG16F), the same data generateIBLCubemaps_env and the BRDF pass render,
+// without a GL context. loadIBLCubemaps_env and loadKTXTexture read them.
+//
+// Everything runs on a JobSystem: rows of faces are jobs, stolen by idle
+// workers. The prefilter transforms its tangent space samples and the LUT
+// integrates its samples 4 at a time with SSE when available. Prefiltering
+// samples the mip chain of the environment at the level matching each
+// sample's solid angle (mip filtered importance sampling), so 1024 samples
+// are enough even at high roughness.
+//
+// Build: a C++17 compiler with the engine's include paths, e.g.
+//     g++ -std=c++17 -O2 -I.. -I<deps> ibl_baker.cpp <glad.c> -lpthread
+// (glad is only linked for the trace events, no context is created)
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <filesystem>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BAKER_USE_SSE 1
+#else
+#define BAKER_USE_SSE 0
+#endif
+
+#include <glm/glm.hpp>
+
+#include "../thread_pool.h"
+#include "../ktx_file.h"
+#include "../hdr_image.h"
+
+
+const float PI = 3.14159265359f;
+const int PREFILTER_LEVELS = 5; // keep in sync with MAX_REFLECTION_LOD in the lighting shader
+
+struct BakeSettings {
+    int environmentSize = 512;
+    int prefilterSize = 128;
+    int lutSize = 512;
+    int samples = 1024;
+    unsigned int threads = hardwareThreadCount();
+    bool verify = false;
+};
+
+// RGB float cubemap level, GL face order, rows bottom to top like GL
+struct CubeLevel {
+    int size;
+    std::vector<float> faces[6];
+};
+
+using CubeChain = std::vector<CubeLevel>;
+
+struct EquirectImage {
+    int width = 0, height = 0;
+    std::vector<float> rgb;
+};
+
+
+// Conversions
+// -----------
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0)); // inf, nan
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7BFF); // clamp to the largest half instead of inf
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (uint16_t)sign;
+        mantissa |= 0x800000; // denormal
+        const int shift = 14 - exponent;
+        return (uint16_t)(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+    }
+
+    // round to nearest, the carry may bump the exponent which is still right
+    return (uint16_t)(sign | (((uint32_t)exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+// direction of a texel of a GL cubemap face before normalization, u and v in [-1, 1]
+glm::vec3 faceDirection(int face, float u, float v)
+{
+    switch (face)
+    {
+        case 0:  return glm::vec3( 1.0f, -v,   -u);
+        case 1:  return glm::vec3(-1.0f, -v,    u);
+        case 2:  return glm::vec3( u,    1.0f,  v);
+        case 3:  return glm::vec3( u,   -1.0f, -v);
+        case 4:  return glm::vec3( u,   -v,     1.0f);
+        default: return glm::vec3(-u,   -v,    -1.0f);
+    }
+}
+
+// inverse of faceDirection
+int directionToFace(const glm::vec3& d, float& u, float& v)
+{
+    const glm::vec3 a = glm::abs(d);
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        u = (d.x > 0.0f ? -d.z : d.z) / a.x;
+        v = -d.y / a.x;
+        return d.x > 0.0f ? 0 : 1;
+    }
+    if (a.y >= a.z)
+    {
+        u = d.x / a.y;
+        v = (d.y > 0.0f ? d.z : -d.z) / a.y;
+        return d.y > 0.0f ? 2 : 3;
+    }
+    u = (d.z > 0.0f ? d.x : -d.x) / a.z;
+    v = -d.y / a.z;
+    return d.z > 0.0f ? 4 : 5;
+}
+
+
+// Sampling
+// --------
+
+glm::vec3 sampleEquirect(const EquirectImage& image, const glm::vec3& direction)
+{
+    // same mapping as equirectangular.glsl
+    const float s = std::atan2(direction.z, direction.x) / (2.0f * PI) + 0.5f;
+    const float t = std::asin(std::clamp(direction.y, -1.0f, 1.0f)) / PI + 0.5f;
+
+    const float x = s * image.width - 0.5f;
+    const float y = std::clamp(t * image.height - 0.5f, 0.0f, image.height - 1.0f);
+    const int x0 = (int)std::floor(x), y0 = (int)y;
+    const float fx = x - x0, fy = y - y0;
+    const int y1 = std::min(y0 + 1, image.height - 1);
+
+    auto texel = [&](int tx, int ty)
+    {
+        tx = ((tx % image.width) + image.width) % image.width; // wraps around horizontally
+        const float* p = &image.rgb[((size_t)ty * image.width + tx) * 3];
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+
+    return glm::mix(glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx),
+                    glm::mix(texel(x0, y1), texel(x0 + 1, y1), fx), fy);
+}
+
+// bilinear inside one face, clamped at its edges
+glm::vec3 sampleFace(const CubeLevel& level, int face, float u, float v)
+{
+    const float x = std::clamp((u * 0.5f + 0.5f) * level.size - 0.5f, 0.0f, level.size - 1.0f);
+    const float y = std::clamp((v * 0.5f + 0.5f) * level.size - 0.5f, 0.0f, level.size - 1.0f);
+    const int x0 = (int)x, y0 = (int)y;
+    const int x1 = std::min(x0 + 1, level.size - 1), y1 = std::min(y0 + 1, level.size - 1);
+    const float fx = x - x0, fy = y - y0;
+
+    const std::vector<float>& data = level.faces[face];
+    auto texel = [&](int tx, int ty)
+    {
+        const float* p = &data[((size_t)ty * level.size + tx) * 3];
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+
+    return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), fx),
+                    glm::mix(texel(x0, y1), texel(x1, y1), fx), fy);
+}
+
+// trilinear, like textureLod on a GL_LINEAR_MIPMAP_LINEAR cubemap
+glm::vec3 sampleCube(const CubeChain& chain, const glm::vec3& direction, float lod)
+{
+    float u, v;
+    const int face = directionToFace(direction, u, v);
+
+    lod = std::clamp(lod, 0.0f, (float)(chain.size() - 1));
+    const int level0 = (int)lod;
+    const int level1 = std::min(level0 + 1, (int)chain.size() - 1);
+    const glm::vec3 color0 = sampleFace(chain[level0], face, u, v);
+    if (level1 == level0)
+        return color0;
+    return glm::mix(color0, sampleFace(chain[level1], face, u, v), lod - level0);
+}
+
+
+// GGX helpers, same as the GL shaders
+// -----------------------------------
+
+float radicalInverseVdC(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+}
+
+// half vector around +Z
+glm::vec3 importanceSampleGGX(uint32_t i, uint32_t count, float roughness)
+{
+    const float a = roughness * roughness;
+    const float phi = 2.0f * PI * ((float)i / count);
+    const float xi = radicalInverseVdC(i);
+    const float cosTheta = std::sqrt((1.0f - xi) / (1.0f + (a * a - 1.0f) * xi));
+    const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+    return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+}
+
+float distributionGGX(float NdotH, float roughness)
+{
+    const float a2 = roughness * roughness * roughness * roughness;
+    const float denom = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+    return a2 / (PI * denom * denom);
+}
+
+
+// Bake steps
+// ----------
+
+bool loadEquirect(const char* path, EquirectImage& image)
+{
+    // .hdr and .exr natively, anything else through stb_image
+    HDRImageReader reader;
+    if (!reader.open(path))
+    {
+        std::cout << "ERROR::IBL_BAKER::IMAGE_NOT_LOADED: " << path << std::endl;
+        return false;
+    }
+
+    image.width = reader.getWidth();
+    image.height = reader.getHeight();
+    image.rgb.resize((size_t)image.width * image.height * 3);
+
+    // like the engine, row 0 is the bottom
+    std::vector<float> row((size_t)image.width * 3);
+    int y, rows = 0;
+    while (reader.readRow(row.data(), y))
+    {
+        std::copy(row.begin(), row.end(), image.rgb.begin() + (size_t)y * image.width * 3);
+        rows++;
+    }
+    if (rows != image.height)
+    {
+        std::cout << "ERROR::IBL_BAKER::IMAGE_TRUNCATED: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CubeChain bakeEnvironment(JobSystem& jobs, const EquirectImage& image, int size)
+{
+    CubeChain chain;
+    chain.push_back({ size, {} });
+    for (std::vector<float>& face : chain[0].faces)
+        face.resize((size_t)size * size * 3);
+
+    jobs.parallelFor(6 * (size_t)size, [&](size_t row)
+    {
+        const int face = (int)(row / size), y = (int)(row % size);
+        const float v = (y + 0.5f) * 2.0f / size - 1.0f;
+        float* out = &chain[0].faces[face][(size_t)y * size * 3];
+        for (int x = 0; x < size; x++)
+        {
+            const float u = (x + 0.5f) * 2.0f / size - 1.0f;
+            const glm::vec3 color = sampleEquirect(image, glm::normalize(faceDirection(face, u, v)));
+            out[x * 3 + 0] = color.r;
+            out[x * 3 + 1] = color.g;
+            out[x * 3 + 2] = color.b;
+        }
+    }, 8);
+
+    // box filtered mip chain down to 1x1
+    while (chain.back().size > 1)
+    {
+        const CubeLevel& source = chain.back();
+        CubeLevel level = { source.size / 2, {} };
+        for (std::vector<float>& face : level.faces)
+            face.resize((size_t)level.size * level.size * 3);
+
+        jobs.parallelFor(6 * (size_t)level.size, [&](size_t row)
+        {
+            const int face = (int)(row / level.size), y = (int)(row % level.size);
+            const float* above = &source.faces[face][(size_t)(2 * y) * source.size * 3];
+            const float* below = above + (size_t)source.size * 3;
+            float* out = &level.faces[face][(size_t)y * level.size * 3];
+            for (int x = 0; x < level.size * 3; x++)
+            {
+                const int c = x % 3, sx = (x / 3) * 2 * 3 + c;
+                out[x] = 0.25f * (above[sx] + above[sx + 3] + below[sx] + below[sx + 3]);
+            }
+        }, 8);
+        chain.push_back(std::move(level));
+    }
+    return chain;
+}
+
+// GGX samples around +Z for one roughness, structure of arrays padded to 4
+struct PrefilterSamples {
+    std::vector<float> x, y, z, weight, lod;
+};
+
+PrefilterSamples prepareSamples(float roughness, int count, int environmentSize, int faceSize)
+{
+    PrefilterSamples samples;
+    const float saTexel = 4.0f * PI / (6.0f * environmentSize * environmentSize);
+    // never finer than the face being written, or roughness 0 aliases
+    const float minLod = std::log2((float)environmentSize / faceSize);
+
+    for (int i = 0; i < count; i++)
+    {
+        const glm::vec3 H = importanceSampleGGX(i, count, roughness);
+        // V = N = +Z
+        const glm::vec3 L = glm::vec3(2.0f * H.z * H.x, 2.0f * H.z * H.y, 2.0f * H.z * H.z - 1.0f);
+        if (L.z <= 0.0f)
+            continue;
+
+        const float pdf = distributionGGX(H.z, roughness) * 0.25f + 0.0001f; // D * NdotH / (4 * HdotV), H.z = HdotV
+        const float saSample = 1.0f / (count * pdf + 0.0001f);
+        const float lod = roughness == 0.0f ? minLod : std::max(0.5f * std::log2(saSample / saTexel), minLod);
+
+        samples.x.push_back(L.x);
+        samples.y.push_back(L.y);
+        samples.z.push_back(L.z);
+        samples.weight.push_back(L.z);
+        samples.lod.push_back(lod);
+    }
+
+    while (samples.x.size() % 4)
+    {
+        samples.x.push_back(0.0f);
+        samples.y.push_back(0.0f);
+        samples.z.push_back(1.0f);
+        samples.weight.push_back(0.0f);
+        samples.lod.push_back(0.0f);
+    }
+    return samples;
+}
+
+// world space directions of the samples around N, 4 at a time
+void rotateSamples(const PrefilterSamples& samples, const glm::vec3& T, const glm::vec3& B, const glm::vec3& N,
+                   float* outX, float* outY, float* outZ)
+{
+    const size_t count = samples.x.size();
+#if BAKER_USE_SSE
+    const __m128 tx = _mm_set1_ps(T.x), ty = _mm_set1_ps(T.y), tz = _mm_set1_ps(T.z);
+    const __m128 bx = _mm_set1_ps(B.x), by = _mm_set1_ps(B.y), bz = _mm_set1_ps(B.z);
+    const __m128 nx = _mm_set1_ps(N.x), ny = _mm_set1_ps(N.y), nz = _mm_set1_ps(N.z);
+    for (size_t i = 0; i < count; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(&samples.x[i]);
+        const __m128 y = _mm_loadu_ps(&samples.y[i]);
+        const __m128 z = _mm_loadu_ps(&samples.z[i]);
+        _mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, x), _mm_mul_ps(bx, y)), _mm_mul_ps(nx, z)));
+        _mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ty, x), _mm_mul_ps(by, y)), _mm_mul_ps(ny, z)));
+        _mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tz, x), _mm_mul_ps(bz, y)), _mm_mul_ps(nz, z)));
+    }
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        outX[i] = T.x * samples.x[i] + B.x * samples.y[i] + N.x * samples.z[i];
+        outY[i] = T.y * samples.x[i] + B.y * samples.y[i] + N.y * samples.z[i];
+        outZ[i] = T.z * samples.x[i] + B.z * samples.y[i] + N.z * samples.z[i];
+    }
+#endif
+}
+
+CubeChain bakePrefiltered(JobSystem& jobs, const CubeChain& environment, int size, int sampleCount)
+{
+    CubeChain chain;
+    for (int mip = 0; mip < PREFILTER_LEVELS; mip++)
+    {
+        const int mipSize = std::max(size >> mip, 1);
+        const float roughness = (float)mip / (PREFILTER_LEVELS - 1);
+        const PrefilterSamples samples = prepareSamples(roughness, sampleCount, environment[0].size, mipSize);
+
+        CubeLevel level = { mipSize, {} };
+        for (std::vector<float>& face : level.faces)
+            face.resize((size_t)mipSize * mipSize * 3);
+
+        jobs.parallelFor(6 * (size_t)mipSize, [&](size_t row)
+        {
+            const int face = (int)(row / mipSize), y = (int)(row % mipSize);
+            const float v = (y + 0.5f) * 2.0f / mipSize - 1.0f;
+            std::vector<float> dx(samples.x.size()), dy(samples.x.size()), dz(samples.x.size());
+            float* out = &level.faces[face][(size_t)y * mipSize * 3];
+
+            for (int x = 0; x < mipSize; x++)
+            {
+                const float u = (x + 0.5f) * 2.0f / mipSize - 1.0f;
+                const glm::vec3 N = glm::normalize(faceDirection(face, u, v));
+                const glm::vec3 up = std::abs(N.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                const glm::vec3 T = glm::normalize(glm::cross(up, N));
+                const glm::vec3 B = glm::cross(N, T);
+                rotateSamples(samples, T, B, N, dx.data(), dy.data(), dz.data());
+
+                glm::vec3 color(0.0f);
+                float totalWeight = 0.0f;
+                for (size_t i = 0; i < samples.x.size(); i++)
+                {
+                    if (samples.weight[i] <= 0.0f)
+                        continue;
+                    color += sampleCube(environment, glm::vec3(dx[i], dy[i], dz[i]), samples.lod[i]) * samples.weight[i];
+                    totalWeight += samples.weight[i];
+                }
+                color /= std::max(totalWeight, 1e-6f);
+
+                out[x * 3 + 0] = color.r;
+                out[x * 3 + 1] = color.g;
+                out[x * 3 + 2] = color.b;
+            }
+        }, 1);
+        chain.push_back(std::move(level));
+    }
+    return chain;
+}
+
+// scale and bias of F0 in the split sum, x = NdotV, y = roughness, like cubemap_brdfconv.glsl.
+// vectorized = false integrates every sample with the scalar loop, the reference for --verify
+std::vector<float> bakeBRDF(JobSystem& jobs, int size, int sampleCount, bool vectorized = true)
+{
+    std::vector<float> lut((size_t)size * size * 2);
+
+    jobs.parallelFor(size, [&](size_t y)
+    {
+        const float roughness = (y + 0.5f) / size;
+        const float k = roughness * roughness / 2.0f;
+
+        // the half vectors only depend on the roughness, Hy never matters since V.y = 0
+        std::vector<float> hx, hz;
+        for (int i = 0; i < sampleCount; i++)
+        {
+            const glm::vec3 H = importanceSampleGGX(i, sampleCount, roughness);
+            hx.push_back(H.x);
+            hz.push_back(H.z);
+        }
+        while (hx.size() % 4)
+        {
+            hx.push_back(0.0f);
+            hz.push_back(0.0f); // NdotL < 0, skipped
+        }
+
+        for (int x = 0; x < size; x++)
+        {
+            const float NdotV = (x + 0.5f) / size;
+            const float vx = std::sqrt(1.0f - NdotV * NdotV), vz = NdotV;
+            const float gv = NdotV / (NdotV * (1.0f - k) + k);
+            float A = 0.0f, B = 0.0f;
+
+            size_t i = 0;
+#if BAKER_USE_SSE
+            if (vectorized)
+            {
+                const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+                const __m128 kk = _mm_set1_ps(k), oneMinusK = _mm_set1_ps(1.0f - k);
+                const __m128 Vx = _mm_set1_ps(vx), Vz = _mm_set1_ps(vz);
+                const __m128 gvOverNdotV = _mm_set1_ps(gv / NdotV);
+                __m128 sumA = zero, sumB = zero;
+                for (; i < hx.size(); i += 4)
+                {
+                    const __m128 Hx = _mm_loadu_ps(&hx[i]), Hz = _mm_loadu_ps(&hz[i]);
+                    const __m128 VdotH = _mm_max_ps(_mm_add_ps(_mm_mul_ps(Vx, Hx), _mm_mul_ps(Vz, Hz)), zero);
+                    const __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, VdotH), Hz), Vz);
+                    const __m128 valid = _mm_cmpgt_ps(NdotL, zero);
+
+                    // G = G1(V) * G1(L), G_Vis = G * VdotH / (NdotH * NdotV)
+                    const __m128 gl = _mm_div_ps(NdotL, _mm_add_ps(_mm_mul_ps(NdotL, oneMinusK), kk));
+                    const __m128 safeHz = _mm_max_ps(Hz, _mm_set1_ps(1e-6f));
+                    const __m128 gVis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(gl, gvOverNdotV), VdotH), safeHz);
+
+                    const __m128 f = _mm_sub_ps(one, VdotH);
+                    const __m128 f2 = _mm_mul_ps(f, f);
+                    const __m128 Fc = _mm_mul_ps(_mm_mul_ps(f2, f2), f);
+
+                    sumA = _mm_add_ps(sumA, _mm_and_ps(valid, _mm_mul_ps(_mm_sub_ps(one, Fc), gVis)));
+                    sumB = _mm_add_ps(sumB, _mm_and_ps(valid, _mm_mul_ps(Fc, gVis)));
+                }
+                float lanesA[4], lanesB[4];
+                _mm_storeu_ps(lanesA, sumA);
+                _mm_storeu_ps(lanesB, sumB);
+                A = lanesA[0] + lanesA[1] + lanesA[2] + lanesA[3];
+                B = lanesB[0] + lanesB[1] + lanesB[2] + lanesB[3];
+            }
+#endif
+            for (; i < hx.size(); i++)
+            {
+                const float VdotH = std::max(vx * hx[i] + vz * hz[i], 0.0f);
+                const float NdotL = 2.0f * VdotH * hz[i] - vz;
+                if (NdotL <= 0.0f)
+                    continue;
+
+                const float gl = NdotL / (NdotL * (1.0f - k) + k);
+                const float gVis = gl * gv * VdotH / (std::max(hz[i], 1e-6f) * NdotV);
+                const float Fc = std::pow(1.0f - VdotH, 5.0f);
+                A += (1.0f - Fc) * gVis;
+                B += Fc * gVis;
+            }
+
+            lut[((size_t)y * size + x) * 2 + 0] = A / sampleCount;
+            lut[((size_t)y * size + x) * 2 + 1] = B / sampleCount;
+        }
+    }, 1);
+
+    return lut;
+}
+
+
+// Compares the LUT against the scalar integration, they only differ in summation order
+bool verifyBRDF(JobSystem& jobs, const std::vector<float>& lut, int size, int sampleCount)
+{
+    const float TOLERANCE = 1e-4f;
+
+    const std::vector<float> reference = bakeBRDF(jobs, size, sampleCount, false);
+    float maxError = 0.0f;
+    for (size_t i = 0; i < lut.size(); i++)
+        maxError = std::max(maxError, std::abs(lut[i] - reference[i]));
+
+    std::cout << "  verify: BRDF LUT " << (BAKER_USE_SSE ? "SSE" : "scalar") << " vs scalar, max error " << maxError;
+    if (maxError > TOLERANCE)
+    {
+        std::cout << std::endl << "ERROR::IBL_BAKER::VERIFY_FAILED: BRDF LUT differs by more than " << TOLERANCE << std::endl;
+        return false;
+    }
+    std::cout << " (ok)" << std::endl;
+    return true;
+}
+
+
+// Output
+// ------
+
+void storeHalfRows(std::vector<uint8_t>& image, const float* data, int width, int height, int components)
+{
+    const size_t pitch = KTXRowPitch(width, components * 2);
+    for (int y = 0; y < height; y++)
+    {
+        uint16_t* row = reinterpret_cast<uint16_t*>(image.data() + y * pitch);
+        for (int i = 0; i < width * components; i++)
+            row[i] = floatToHalf(data[(size_t)y * width * components + i]);
+    }
+}
+
+bool writeCubemap(const std::string& path, const CubeChain& chain)
+{
+    KTXImage ktx;
+    KTXAllocate(ktx, KTX_GL_HALF_FLOAT, KTX_GL_RGB, KTX_GL_RGB16F, chain[0].size, chain[0].size, 6, (int)chain.size());
+    for (int level = 0; level < ktx.levels; level++)
+        for (int face = 0; face < 6; face++)
+            storeHalfRows(ktx.image(level, face), chain[level].faces[face].data(), chain[level].size, chain[level].size, 3);
+    return WriteKTX(path, ktx);
+}
+
+bool writeLUT(const std::string& path, const std::vector<float>& lut, int size)
+{
+    KTXImage ktx;
+    KTXAllocate(ktx, KTX_GL_HALF_FLOAT, KTX_GL_RG, KTX_GL_RG16F, size, size, 1, 1);
+    storeHalfRows(ktx.image(0, 0), lut.data(), size, size, 2);
+    return WriteKTX(path, ktx);
+}
+
+
+// Command line
+// ------------
+
+bool parseArguments(int argc, char** argv, BakeSettings& settings)
+{
+    for (int i = 3; i < argc; i++)
+    {
+        const std::string option = argv[i];
+        if (option == "--verify")
+        {
+            settings.verify = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cout << "ERROR::IBL_BAKER::MISSING_VALUE: " << option << std::endl;
+            return false;
+        }
+
+        const int value = std::atoi(argv[++i]);
+        if (value <= 0)
+        {
+            std::cout << "ERROR::IBL_BAKER::INVALID_VALUE: " << option << " " << argv[i] << std::endl;
+            return false;
+        }
+
+        if (option == "--size")
+            settings.environmentSize = value;
+        else if (option == "--prefilter-size")
+            settings.prefilterSize = value;
+        else if (option == "--lut-size")
+            settings.lutSize = value;
+        else if (option == "--samples")
+            settings.samples = value;
+        else if (option == "--threads")
+            settings.threads = (unsigned int)value;
+        else
+        {
+            std::cout << "ERROR::IBL_BAKER::UNKNOWN_OPTION: " << option << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BakeSettings settings;
+    if (argc < 3 || !parseArguments(argc, argv, settings))
+    {
+        std::cout << "usage: ibl_baker <equirectangular image> <output folder> [--size N] [--prefilter-size N]"
+                     " [--lut-size N] [--samples N] [--threads N] [--verify]" << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path output = argv[2];
+    std::filesystem::create_directories(output);
+
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point begin)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    };
+
+    JobSystem jobs(settings.threads);
+    std::cout << "Baking " << argv[1] << " on " << jobs.getThreadCount() << " threads" << std::endl;
+
+    Clock::time_point begin = Clock::now();
+    EquirectImage image;
+    if (!loadEquirect(argv[1], image))
+        return 1;
+    std::cout << "  loaded " << image.width << "x" << image.height << " in " << elapsed(begin) << " ms" << std::endl;
+
+    begin = Clock::now();
+    const CubeChain environment = bakeEnvironment(jobs, image, settings.environmentSize);
+    std::cout << "  environment " << settings.environmentSize << "px in " << elapsed(begin) << " ms" << std::endl;
+
+    begin = Clock::now();
+    const CubeChain prefiltered = bakePrefiltered(jobs, environment, settings.prefilterSize, settings.samples);
+    std::cout << "  prefiltered " << settings.prefilterSize << "px in " << elapsed(begin) << " ms" << std::endl;
+
+    begin = Clock::now();
+    const std::vector<float> lut = bakeBRDF(jobs, settings.lutSize, settings.samples);
+    std::cout << "  BRDF LUT " << settings.lutSize << "px in " << elapsed(begin) << " ms" << std::endl;
+
+    if (settings.verify && !verifyBRDF(jobs, lut, settings.lutSize, settings.samples))
+        return 1;
+
+    const bool written = writeCubemap((output / "environment.ktx").string(), environment)
+                      && writeCubemap((output / "prefiltered.ktx").string(), prefiltered)
+                      && writeLUT((output / "brdf_lut.ktx").string(), lut, settings.lutSize);
+    if (!written)
+        return 1;
+
+    std::cout << "Written to " << output.string() << std::endl;
+    return 0;
+}
@@ -0,0 +1,367 @@
+// Timeline events exported as Chrome trace event JSON
+// (open in chrome://tracing or ui.perfetto.dev)
+//
+// Every thread writes into its own chunked buffer, the only shared
+// state is an atomic list of those buffers, so recording takes no locks.
+// GPU timestamps are shifted onto the CPU timeline using an offset
+// measured with glGetInteger64v(GL_TIMESTAMP).
+
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+
+const unsigned int TRACE_CHUNK_EVENTS = 4096;               // events per buffer chunk
+const unsigned int TRACE_MAX_EVENTS_PER_THREAD = 1 << 20;  // further events are dropped
+const unsigned int TRACE_DETAIL_LENGTH = 48;               // bytes of per-event detail text
+const unsigned int TRACE_GPU_THREAD_ID = 0;                // virtual thread for GPU events
+
+struct TraceEvent {
+    const char* name;  // has to outlive the trace, string literals in practice
+    int64_t beginNs;
+    int64_t endNs;
+    char detail[TRACE_DETAIL_LENGTH];
+};
+
+struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    std::atomic<unsigned int> count{0};
+    std::atomic<TraceChunk*> next{nullptr};
+};
+
+struct TraceThreadBuffer {
+    unsigned int threadId;
+    char threadName[32];
+    TraceChunk* first;
+    TraceChunk* current;  // only touched by the owning thread
+    unsigned int totalEvents;
+    std::atomic<unsigned int> dropped{0};
+    TraceThreadBuffer* nextBuffer;
+};
+
+static std::atomic<TraceThreadBuffer*> traceBuffers{nullptr};
+static std::atomic<unsigned int> traceNextThreadId{1};
+static std::atomic<bool> traceEnabled{true};
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+// GPU clock to CPU clock offset in nanoseconds
+static std::atomic<int64_t> traceGpuOffsetNs{0};
+
+inline int64_t TraceTimeNs(std::chrono::steady_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - traceEpoch).count();
+}
+
+inline int64_t TraceNowNs()
+{
+    return TraceTimeNs(std::chrono::steady_clock::now());
+}
+
+TraceThreadBuffer* TraceCreateThreadBuffer(unsigned int threadId)
+{
+    TraceThreadBuffer* buffer = new TraceThreadBuffer();
+    buffer->threadId = threadId;
+    std::snprintf(buffer->threadName, sizeof(buffer->threadName), "Thread %u", threadId);
+    buffer->first = new TraceChunk();
+    buffer->current = buffer->first;
+    buffer->totalEvents = 0;
+
+    // push to the global list, buffers are never removed so the exporter can always walk it
+    buffer->nextBuffer = traceBuffers.load(std::memory_order_relaxed);
+    while (!traceBuffers.compare_exchange_weak(buffer->nextBuffer, buffer,
+                                               std::memory_order_release, std::memory_order_relaxed));
+    return buffer;
+}
+
+inline TraceThreadBuffer* TraceThisThread()
+{
+    thread_local TraceThreadBuffer* buffer = TraceCreateThreadBuffer(traceNextThreadId.fetch_add(1));
+    return buffer;
+}
+
+void TraceAppend(TraceThreadBuffer* buffer, const char* name, int64_t beginNs, int64_t endNs, const char* detail)
+{
+    if (buffer->totalEvents >= TRACE_MAX_EVENTS_PER_THREAD)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceChunk* chunk = buffer->current;
+    unsigned int index = chunk->count.load(std::memory_order_relaxed);
+    if (index == TRACE_CHUNK_EVENTS)
+    {
+        TraceChunk* next = new TraceChunk();
+        chunk->next.store(next, std::memory_order_release);
+        buffer->current = chunk = next;
+        index = 0;
+    }
+
+    TraceEvent& event = chunk->events[index];
+    event.name = name;
+    event.beginNs = beginNs;
+    event.endNs = endNs;
+    if (detail)
+    {
+        std::strncpy(event.detail, detail, TRACE_DETAIL_LENGTH - 1);
+        event.detail[TRACE_DETAIL_LENGTH - 1] = '\0';
+    }
+    else
+    {
+        event.detail[0] = '\0';
+    }
+
+    // publish the event to the exporter
+    chunk->count.store(index + 1, std::memory_order_release);
+    buffer->totalEvents++;
+}
+
+// Records a finished CPU event on the calling thread
+inline void TraceCpuEvent(const char* name, int64_t beginNs, int64_t endNs, const char* detail = nullptr)
+{
+    if (traceEnabled.load(std::memory_order_relaxed))
+        TraceAppend(TraceThisThread(), name, beginNs, endNs, detail);
+}
+
+void TraceSetThreadName(const char* name)
+{
+    TraceThreadBuffer* buffer = TraceThisThread();
+    std::strncpy(buffer->threadName, name, sizeof(buffer->threadName) - 1);
+    buffer->threadName[sizeof(buffer->threadName) - 1] = '\0';
+}
+
+inline void TraceSetEnabled(bool enabled)
+{
+    traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+// GPU timeline
+// ------------
+
+// GPU events are written from the GL thread only, into their own buffer
+TraceThreadBuffer* TraceGpuBuffer()
+{
+    static TraceThreadBuffer* buffer = nullptr;
+    if (!buffer)
+    {
+        buffer = TraceCreateThreadBuffer(TRACE_GPU_THREAD_ID);
+        std::strcpy(buffer->threadName, "GPU");
+    }
+    return buffer;
+}
+
+// Measures the GPU to CPU clock offset, call again from time to time to follow drift
+void TraceCalibrateGpuClock()
+{
+    GLint64 gpuNow = 0;
+    const int64_t cpuBefore = TraceNowNs();
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    const int64_t cpuAfter = TraceNowNs();
+
+    traceGpuOffsetNs.store((cpuBefore + cpuAfter) / 2 - gpuNow, std::memory_order_relaxed);
+}
+
+// Takes raw GL_TIMESTAMP values
+inline void TraceGpuEvent(const char* name, uint64_t gpuBeginNs, uint64_t gpuEndNs, const char* detail = nullptr)
+{
+    if (!traceEnabled.load(std::memory_order_relaxed))
+        return;
+
+    const int64_t offset = traceGpuOffsetNs.load(std::memory_order_relaxed);
+    TraceAppend(TraceGpuBuffer(), name, (int64_t)gpuBeginNs + offset, (int64_t)gpuEndNs + offset, detail);
+}
+
+// GPU scopes outside of the frame profiler (loading, IBL generation...)
+// Results are polled by TraceResolveGpuScopes without blocking, every frame
+// from Profiler::beginFrame even while the overlay is off
+struct TracePendingGpuScope {
+    const char* name;
+    unsigned int queries[2];
+    char detail[TRACE_DETAIL_LENGTH];
+};
+
+static std::vector<TracePendingGpuScope> tracePendingGpuScopes;
+
+void TraceResolveGpuScopes(bool wait = false)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < tracePendingGpuScopes.size(); i++)
+    {
+        TracePendingGpuScope& scope = tracePendingGpuScopes[i];
+
+        GLint available = 0;
+        glGetQueryObjectiv(scope.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !wait)
+        {
+            tracePendingGpuScopes[kept++] = scope;
+            continue;
+        }
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(scope.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(scope.queries[1], GL_QUERY_RESULT, &end);
+        glDeleteQueries(2, scope.queries);
+
+        TraceGpuEvent(scope.name, begin, end, scope.detail);
+    }
+    tracePendingGpuScopes.resize(kept);
+}
+
+// Export
+// ------
+
+void TraceWriteJsonString(std::ofstream& out, const char* text)
+{
+    out << '"';
+    for (const char* c = text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            out << '\\' << *c;
+        else if ((unsigned char)*c < 0x20)
+            out << ' ';
+        else
+            out << *c;
+    }
+    out << '"';
+}
+
+// Writes every event recorded so far, can be called at any time from the GL thread
+bool TraceExport(const char* path)
+{
+    TraceResolveGpuScopes(true);
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cout << "ERROR::TRACE::Could not open " << path << std::endl;
+        return false;
+    }
+
+    // nanosecond resolution in microseconds, never rounded to 6 digits or exponents
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool firstEvent = true;
+    unsigned int eventCount = 0;
+    unsigned int droppedCount = 0;
+
+    for (TraceThreadBuffer* buffer = traceBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->nextBuffer)
+    {
+        if (!firstEvent)
+            out << ",\n";
+        firstEvent = false;
+
+        out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"args\":{\"name\":";
+        TraceWriteJsonString(out, buffer->threadName);
+        out << "}}";
+
+        for (TraceChunk* chunk = buffer->first; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            const unsigned int count = chunk->count.load(std::memory_order_acquire);
+            for (unsigned int i = 0; i < count; i++)
+            {
+                const TraceEvent& event = chunk->events[i];
+
+                // trace format timestamps are in microseconds
+                out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+                    << ",\"ts\":" << event.beginNs / 1000.0
+                    << ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0
+                    << ",\"name\":";
+                TraceWriteJsonString(out, event.name);
+                if (event.detail[0])
+                {
+                    out << ",\"args\":{\"detail\":";
+                    TraceWriteJsonString(out, event.detail);
+                    out << '}';
+                }
+                out << '}';
+                eventCount++;
+            }
+        }
+        droppedCount += buffer->dropped.load(std::memory_order_relaxed);
+    }
+
+    out << "\n]}\n";
+
+    std::cout << "Trace written to " << path << " (" << eventCount << " events";
+    if (droppedCount)
+        std::cout << ", " << droppedCount << " dropped";
+    std::cout << ")" << std::endl;
+
+    return true;
+}
+
+// Scopes
+// ------
+
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* detail = nullptr) : name(name), detail(detail), beginNs(TraceNowNs()) {}
+    ~TraceScope() { TraceCpuEvent(name, beginNs, TraceNowNs(), detail); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    const char* detail;
+    int64_t beginNs;
+};
+
+// CPU and GPU timing of the same scope, GL thread only
+class TraceGpuScope
+{
+public:
+    TraceGpuScope(const char* name, const char* detail = nullptr) : cpu(name, detail)
+    {
+        // no queries at all while tracing is off
+        active = traceEnabled.load(std::memory_order_relaxed);
+        if (!active)
+            return;
+
+        scope.name = name;
+        scope.detail[0] = '\0';
+        if (detail)
+        {
+            std::strncpy(scope.detail, detail, TRACE_DETAIL_LENGTH - 1);
+            scope.detail[TRACE_DETAIL_LENGTH - 1] = '\0';
+        }
+        glGenQueries(2, scope.queries);
+        glQueryCounter(scope.queries[0], GL_TIMESTAMP);
+    }
+    ~TraceGpuScope()
+    {
+        if (!active)
+            return;
+        glQueryCounter(scope.queries[1], GL_TIMESTAMP);
+        tracePendingGpuScopes.push_back(scope);
+    }
+
+    TraceGpuScope(const TraceGpuScope&) = delete;
+    TraceGpuScope& operator=(const TraceGpuScope&) = delete;
+
+private:
+    TraceScope cpu;
+    TracePendingGpuScope scope;
+    bool active;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_SCOPE_DETAIL(name, detail) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name, detail)
+#define TRACE_GPU_SCOPE(name) TraceGpuScope TRACE_CONCAT(traceGpuScope_, __LINE__)(name)
+
+#endif